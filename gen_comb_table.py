@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+#******************************************************************************
+# Copyright 2019 Google
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#****************************************************************************
+
+# Generates src/crypto/secp256r1_comb.cpp, the fixed-base comb table used by
+# ecc_fast_mul_base when ECC_FIXED_BASE_COMB is enabled. Run it from this
+# directory after changing ECC_COMB_TEETH in src/crypto/ecc_fast.h:
+#
+#   ./gen_comb_table.py 8 > src/crypto/secp256r1_comb.cpp
+
+import sys
+
+P = 0xffffffff00000001000000000000000000000000ffffffffffffffffffffffff
+A = P - 3
+GX = 0x6b17d1f2e12c4247f8bce6e563a440f277037d812deb33a0f4a13945d898c296
+GY = 0x4fe342e2fe1a7f9b8ee7eb4a7c0f9e162bce33576b315ececbb6406837bf51f5
+KEY_BITS = 256
+DIGIT_BITS = 32
+
+
+def add(p1, p2):
+    if p1 is None:
+        return p2
+    if p2 is None:
+        return p1
+    if p1[0] == p2[0] and (p1[1] + p2[1]) % P == 0:
+        return None
+    if p1 == p2:
+        l = (3 * p1[0] * p1[0] + A) * pow(2 * p1[1], -1, P) % P
+    else:
+        l = (p2[1] - p1[1]) * pow(p2[0] - p1[0], -1, P) % P
+    x = (l * l - p1[0] - p2[0]) % P
+    return (x, (l * (p1[0] - x) - p1[1]) % P)
+
+
+def mul(k, pt):
+    r = None
+    while k:
+        if k & 1:
+            r = add(r, pt)
+        pt = add(pt, pt)
+        k >>= 1
+    return r
+
+
+def digits(v):
+    mask = (1 << DIGIT_BITS) - 1
+    return ', '.join('0x%08X' % ((v >> (DIGIT_BITS * i)) & mask)
+                     for i in range(KEY_BITS // DIGIT_BITS))
+
+
+def main():
+    teeth = int(sys.argv[1]) if len(sys.argv) > 1 else 8
+    spacing = (KEY_BITS + teeth - 1) // teeth
+    # teeth[j] = 2^(j*spacing) * G
+    base = [mul(1 << (j * spacing), (GX, GY)) for j in range(teeth)]
+
+    print('// AUTOGENERATED by gen_comb_table.py, DO NOT EDIT.')
+    print('// Fixed-base comb table for secp256r1, ECC_COMB_TEETH = %d.' % teeth)
+    print('// Entry i-1 holds sum(2^(j*%d) * G) over the bits j set in i.' % spacing)
+    print('#include <Arduino.h>')
+    print('#include "ecc_fast.h"')
+    print()
+    print('#if ECC_FIXED_BASE_COMB && defined(THIRTYTWO_BIT_PROCESSOR)')
+    print('#if ECC_COMB_TEETH != %d' % teeth)
+    print('#error "secp256r1_comb.cpp was generated for a different ECC_COMB_TEETH"')
+    print('#endif')
+    print()
+    print('const NN_DIGIT ecc_comb_table[ECC_COMB_POINTS][2][KEYDIGITS] PROGMEM = {')
+    for i in range(1, 1 << teeth):
+        pt = None
+        for j in range(teeth):
+            if i & (1 << j):
+                pt = add(pt, base[j])
+        print('  {{%s},' % digits(pt[0]))
+        print('   {%s}},' % digits(pt[1]))
+    print('};')
+    print()
+    print('#endif /* ECC_FIXED_BASE_COMB */')
+
+
+if __name__ == '__main__':
+    main()
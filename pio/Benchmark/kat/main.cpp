@@ -0,0 +1,476 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+/*
+ * Known answer tests for the crypto and JWT code, run on the host by the
+ * kat envs. Every tuning macro (NN_P256_FIELD, ECC_WNAF, CONF_W_BITS,
+ * ECC_FIXED_BASE_COMB) has an env of its own, so each code path is checked
+ * against fixed vectors and against the upstream code it replaces. Prints
+ * the failed checks and exits non-zero if there are any.
+ */
+#include <Arduino.h>
+
+#include "crypto/ecc.h"
+#include "crypto/ecc_fast.h"
+#include "crypto/ecdsa.h"
+#include "crypto/ecdsa_fast.h"
+#include "crypto/nn.h"
+#include "crypto/p256.h"
+#include "crypto/sha256.h"
+#include "crypto/sha256_fast.h"
+#include "jwt.h"
+
+static int checks = 0;
+static int failures = 0;
+
+#define KAT_CHECK(cond)                                              \
+  do {                                                               \
+    checks++;                                                        \
+    if (!(cond)) {                                                   \
+      printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);         \
+      failures++;                                                    \
+    }                                                                \
+  } while (0)
+
+// Decodes 64 hex digits, most significant first, into a NUMWORDS number
+static void from_hex(NN_DIGIT *a, const char *hex) {
+  unsigned char bytes[32];
+  for (int i = 0; i < 32; i++) {
+    unsigned int byte;
+    sscanf(hex + 2 * i, "%2x", &byte);
+    bytes[i] = (unsigned char)byte;
+  }
+  NN_Decode(a, NUMWORDS, bytes, sizeof(bytes));
+}
+
+static bool equal(NN_DIGIT *a, NN_DIGIT *b) {
+  return NN_Cmp(a, b, NUMWORDS) == 0;
+}
+
+static bool equal(point_t *a, point_t *b) {
+  return equal(a->x, b->x) && equal(a->y, b->y);
+}
+
+static bool is_one(NN_DIGIT *a) {
+  return NN_One(a, NUMWORDS) == 1;
+}
+
+// Reproducible pseudo random numbers below m, independent of the libc
+static uint32_t kat_seed = 0x2545f491;
+
+static void random_below(NN_DIGIT *a, NN_DIGIT *m) {
+  NN_DIGIT t[NUMWORDS];
+  for (int i = 0; i < KEYDIGITS; i++) {
+    kat_seed ^= kat_seed << 13;
+    kat_seed ^= kat_seed >> 17;
+    kat_seed ^= kat_seed << 5;
+    t[i] = kat_seed;
+  }
+  t[NUMWORDS - 1] = 0;
+  NN_Mod(a, t, NUMWORDS, m, NUMWORDS);
+}
+
+// Field elements where the reduction has to fold or subtract at the edges
+static const char *const field_edges[] = {
+    "0000000000000000000000000000000000000000000000000000000000000000",
+    "0000000000000000000000000000000000000000000000000000000000000001",
+    "0000000000000000000000000000000000000000000000000000000000000002",
+    "ffffffff00000001000000000000000000000000fffffffffffffffffffffffe",  // p-1
+    "ffffffff00000001000000000000000000000000fffffffffffffffffffffffd",  // p-2
+    "00000000fffffffeffffffffffffffffffffffff000000000000000000000001",  // 2^256-p
+    "7fffffff800000008000000000000000000000007fffffffffffffffffffffff",  // (p-1)/2
+    "8000000000000000000000000000000000000000000000000000000000000000",
+    "00000000ffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+    "0000000000000001000000000000000000000000000000000000000000000000",
+    "0000000000000000000000000000000000000001000000000000000000000000",
+    "00000000000000000000000000000000000000000000000000000000ffffffff",
+    "ffffffff00000000ffffffffffffffffbce6faada7179e84f3b9cac2fc632550",  // n-1
+};
+#define FIELD_EDGES (sizeof(field_edges) / sizeof(field_edges[0]))
+
+static void kat_field() {
+  curve_params_t *param = ecc_get_param();
+  NN_DIGIT a[NUMWORDS], b[NUMWORDS], c[NUMWORDS], ref[NUMWORDS];
+
+  // NN_ModMultOpt and NN_ModSqrOpt, with p256.cpp or the omega reduction,
+  // against the plain multiply and divide of NN_ModMult
+  for (size_t i = 0; i < FIELD_EDGES; i++) {
+    from_hex(a, field_edges[i]);
+    for (size_t j = 0; j < FIELD_EDGES; j++) {
+      from_hex(b, field_edges[j]);
+      NN_ModMultOpt(c, a, b, param->p, param->omega, NUMWORDS);
+      NN_ModMult(ref, a, b, param->p, NUMWORDS);
+      KAT_CHECK(equal(c, ref));
+    }
+    NN_ModSqrOpt(c, a, param->p, param->omega, NUMWORDS);
+    NN_ModMult(ref, a, a, param->p, NUMWORDS);
+    KAT_CHECK(equal(c, ref));
+  }
+  for (int i = 0; i < 200; i++) {
+    random_below(a, param->p);
+    random_below(b, param->p);
+    NN_ModMultOpt(c, a, b, param->p, param->omega, NUMWORDS);
+    NN_ModMult(ref, a, b, param->p, NUMWORDS);
+    KAT_CHECK(equal(c, ref));
+  }
+
+  // (p-1)^2 = 1 and (p-1)*2 = p-2
+  from_hex(a, field_edges[3]);
+  NN_ModSqrOpt(c, a, param->p, param->omega, NUMWORDS);
+  KAT_CHECK(is_one(c));
+  from_hex(b, field_edges[2]);
+  NN_ModMultOpt(c, a, b, param->p, param->omega, NUMWORDS);
+  from_hex(ref, field_edges[4]);
+  KAT_CHECK(equal(c, ref));
+
+#if NN_P256_FIELD
+  // p256_reduce on full products, and the constant time add and sub
+  for (size_t i = 0; i < FIELD_EDGES; i++) {
+    from_hex(a, field_edges[i]);
+    for (size_t j = 0; j < FIELD_EDGES; j++) {
+      NN_DIGIT t[2 * KEYDIGITS];
+      from_hex(b, field_edges[j]);
+      NN_Mult(t, a, b, KEYDIGITS);
+      memset(c, 0, sizeof(c));
+      p256_reduce(c, t);
+      NN_Mod(ref, t, 2 * KEYDIGITS, param->p, NUMWORDS);
+      KAT_CHECK(equal(c, ref));
+
+      if (NN_Cmp(a, param->p, NUMWORDS) < 0 &&
+          NN_Cmp(b, param->p, NUMWORDS) < 0) {
+        p256_add(c, a, b);
+        NN_ModAdd(ref, a, b, param->p, NUMWORDS);
+        KAT_CHECK(equal(c, ref));
+        p256_sub(c, a, b);
+        NN_ModSub(ref, a, b, param->p, NUMWORDS);
+        KAT_CHECK(equal(c, ref));
+      }
+    }
+  }
+#endif
+}
+
+static void kat_inverse() {
+  curve_params_t *param = ecc_get_param();
+  NN_DIGIT order[NUMWORDS];
+  NN_DIGIT x[NUMWORDS], ref[NUMWORDS], t[NUMWORDS];
+#if NN_P256_FIELD
+  NN_DIGIT inv[NUMWORDS];
+#endif
+
+  ecc_get_order(order);
+
+  // inverse * x == 1, mod p and mod n, for 1, p-1, n-1, ... and random x
+  for (int i = 0; i < 40 + (int)FIELD_EDGES; i++) {
+    if (i < (int)FIELD_EDGES) {
+      from_hex(x, field_edges[i]);
+    } else {
+      random_below(x, order);
+    }
+    if (NN_Zero(x, NUMWORDS)) {
+      continue;
+    }
+
+    if (NN_Cmp(x, param->p, NUMWORDS) < 0) {
+      NN_ModInv(ref, x, param->p, NUMWORDS);
+      NN_ModMult(t, ref, x, param->p, NUMWORDS);
+      KAT_CHECK(is_one(t));
+#if NN_P256_FIELD
+      memset(inv, 0, sizeof(inv));
+      p256_inv(inv, x);
+      KAT_CHECK(equal(inv, ref));
+#endif
+    }
+
+    if (NN_Cmp(x, order, NUMWORDS) < 0) {
+      NN_ModInv(ref, x, order, NUMWORDS);
+      NN_ModMult(t, ref, x, order, NUMWORDS);
+      KAT_CHECK(is_one(t));
+#if NN_P256_FIELD
+      memset(inv, 0, sizeof(inv));
+      p256_order_inv(inv, x);
+      KAT_CHECK(equal(inv, ref));
+#endif
+    }
+  }
+}
+
+// RFC 6979, A.2.5: ECDSA with P-256 and SHA-256
+static const char rfc6979_priv[] =
+    "c9afa9d845ba75166b5c215767b1d6934e50c3db36e89b127b8a622b120f6721";
+static const char rfc6979_ux[] =
+    "60fed4ba255a9d31c961eb74c6356d68c049b8923b61fa6ce669622e60f29fb6";
+static const char rfc6979_uy[] =
+    "7903fe1008b8bc99a41ae9e95628bc64f2f1b20c2d7e9f5177a3c294d4462299";
+
+static const struct {
+  const char *message;
+  const char *k;
+  const char *r;
+  const char *s;
+} rfc6979_vectors[] = {
+    {"sample",
+     "a6e3c57dd01abe90086538398355dd4c3b17aa873382b0f24d6129493d8aad60",
+     "efd48b2aacb6a8fd1140dd9cd45e81d69d2c877b56aaf991c34d0ea84eaf3716",
+     "f7cb1c942d657c41d436c7a1b6e29f65f3e900dbb9aff4064dc4ab2f843acda8"},
+    {"test",
+     "d16b6ae827f17175e040871a1c7ec3500192c4c92677336ec2537acaee0008e0",
+     "f1abb023518351cd71d881567b1ea663ed3efcf6c5132b354f28d3b0b7d38367",
+     "019f4113742a2b14bd25926b49c649155f267e60d3814b4c0cc84250e46f0083"},
+};
+
+static NN_DIGIT priv_key[NUMWORDS];
+static point_t pub_key;
+static point_t pub_table[NUM_POINTS];
+
+static void kat_scalar_mul() {
+  curve_params_t *param = ecc_get_param();
+  NN_DIGIT order[NUMWORDS], k[NUMWORDS];
+  point_t ref, p;
+  ecc_mul_state_t state;
+
+  ecc_get_order(order);
+
+  // the public key of the RFC 6979 private key
+  ecc_fast_mul_base(&p, priv_key);
+  KAT_CHECK(equal(&p, &pub_key));
+
+  // (n-1)*G = -G
+  from_hex(k, field_edges[12]);
+  ecc_fast_mul_base(&p, k);
+  NN_Sub(ref.y, param->p, param->G.y, NUMWORDS);
+  KAT_CHECK(equal(p.x, param->G.x) && equal(p.y, ref.y));
+
+  // comb or sliding window and wNAF against the binary method of ecc_mul
+  for (int i = 0; i < 64 + (int)FIELD_EDGES; i++) {
+    if (i < (int)FIELD_EDGES) {
+      from_hex(k, field_edges[i]);
+      if (NN_Zero(k, NUMWORDS) || NN_Cmp(k, order, NUMWORDS) >= 0) {
+        continue;
+      }
+    } else {
+      random_below(k, order);
+    }
+
+    ecc_mul(&ref, &param->G, k);
+    ecc_fast_mul_base(&p, k);
+    KAT_CHECK(equal(&p, &ref));
+
+    // one window (or comb column) per step
+    ecc_fast_mul_base_begin(&state, k);
+    while (!ecc_fast_mul_base_step(&state, 1)) {
+    }
+    KAT_CHECK(equal(&state.P0, &ref));
+
+    ecc_mul(&ref, &pub_key, k);
+    ecc_fast_win_mul(&p, k, pub_table);
+    KAT_CHECK(equal(&p, &ref));
+  }
+}
+
+static void kat_ecdsa() {
+  NN_DIGIT order[NUMWORDS], k[NUMWORDS];
+  NN_DIGIT r[NUMWORDS], s[NUMWORDS], want_r[NUMWORDS], want_s[NUMWORDS];
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  ecdsa_nonce_t nonce;
+  point_t R;
+
+  ecc_get_order(order);
+
+  for (size_t i = 0; i < sizeof(rfc6979_vectors) / sizeof(rfc6979_vectors[0]);
+       i++) {
+    Sha256Fast sha;
+    sha.update((const uint8_t *)rfc6979_vectors[i].message,
+               strlen(rfc6979_vectors[i].message));
+    sha.final(digest);
+    from_hex(k, rfc6979_vectors[i].k);
+    from_hex(want_r, rfc6979_vectors[i].r);
+    from_hex(want_s, rfc6979_vectors[i].s);
+
+    // the nonce ecdsa_gen_nonce would make for this k
+    ecc_fast_mul_base(&R, k);
+    NN_Mod(nonce.r, R.x, NUMWORDS, order, NUMWORDS);
+    NN_ModInv(nonce.k_inv, k, order, NUMWORDS);
+    KAT_CHECK(equal(nonce.r, want_r));
+
+    KAT_CHECK(ecdsa_sign_nonce(digest, r, s, priv_key, &nonce) == 1);
+    KAT_CHECK(equal(r, want_r));
+    KAT_CHECK(equal(s, want_s));
+
+    KAT_CHECK(ecdsa_fast_verify(digest, want_r, want_s, pub_table) == 1);
+    KAT_CHECK(ecdsa_verify(digest, want_r, want_s, &pub_key) == 1);
+
+    // a different digest, r = 0 and s = n
+    digest[0] ^= 1;
+    KAT_CHECK(ecdsa_fast_verify(digest, want_r, want_s, pub_table) == 2);
+    digest[0] ^= 1;
+    NN_AssignZero(r, NUMWORDS);
+    KAT_CHECK(ecdsa_fast_verify(digest, r, want_s, pub_table) == 4);
+    KAT_CHECK(ecdsa_fast_verify(digest, want_r, order, pub_table) == 5);
+  }
+
+  // random nonces, each side verifies the signatures of the other. Not
+  // with a zero digest: ecdsa_verify mishandles u1*G at infinity.
+  for (int i = 1; i <= 8; i++) {
+    memset(digest, 0x11 * i, sizeof(digest));
+    ecdsa_fast_sign(digest, r, s, priv_key);
+    KAT_CHECK(ecdsa_verify(digest, r, s, &pub_key) == 1);
+    ecdsa_sign(digest, r, s, priv_key);
+    KAT_CHECK(ecdsa_fast_verify(digest, r, s, pub_table) == 1);
+  }
+}
+
+static void kat_sha256() {
+  static const struct {
+    const char *message;
+    const char *digest;
+  } vectors[] = {
+      {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+      {"abc",
+       "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+      {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+       "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+  };
+  static uint8_t block[700];
+  uint8_t want[SHA256_DIGEST_LENGTH], got[SHA256_DIGEST_LENGTH];
+
+  for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+    for (int j = 0; j < SHA256_DIGEST_LENGTH; j++) {
+      unsigned int byte;
+      sscanf(vectors[i].digest + 2 * j, "%2x", &byte);
+      want[j] = (uint8_t)byte;
+    }
+    Sha256Fast sha;
+    sha.update((const uint8_t *)vectors[i].message,
+               strlen(vectors[i].message));
+    sha.final(got);
+    KAT_CHECK(memcmp(got, want, sizeof(want)) == 0);
+  }
+
+  // every length across a few block boundaries, split over two updates
+  for (size_t i = 0; i < sizeof(block); i++) {
+    block[i] = (uint8_t)(i * 7);
+  }
+  for (size_t len = 0; len < sizeof(block); len += 13) {
+    Sha256 upstream;
+    Sha256Fast sha;
+    upstream.update(block, len / 3);
+    upstream.update(block + len / 3, len - len / 3);
+    upstream.final(want);
+    sha.update(block, len / 3);
+    sha.update(block + len / 3, len - len / 3);
+    sha.final(got);
+    KAT_CHECK(memcmp(got, want, sizeof(want)) == 0);
+  }
+}
+
+// base64url without padding, as the JWT signature is written
+static size_t base64url_decode(uint8_t *out, const char *in) {
+  static const char chars[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  uint32_t bits = 0;
+  int nbits = 0;
+  size_t len = 0;
+
+  for (; *in != '\0'; in++) {
+    const char *c = strchr(chars, *in);
+    if (c == NULL) {
+      return 0;
+    }
+    bits = (bits << 6) | (uint32_t)(c - chars);
+    nbits += 6;
+    if (nbits >= 8) {
+      nbits -= 8;
+      out[len++] = (uint8_t)(bits >> nbits);
+    }
+  }
+  return len;
+}
+
+static void kat_jwt() {
+  // header and claims for iat 1546300800 and one hour, and their SHA-256
+  static const char signing_input[] =
+      "eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCJ9."
+      "eyJpYXQiOjE1NDYzMDA4MDAsImV4cCI6MTU0NjMwNDQwMCwiYXVkIjoiYmVuY2htYXJrLXBy"
+      "b2plY3QifQ";
+  static const char signing_digest[] =
+      "713d3f084366da8a96465b02e5058bdb4a68d99ec64a4a23b85e581030d3ab6f";
+  JwtSigningContext ctx;
+  char jwt[JWT_MAX_LEN];
+  uint8_t digest[SHA256_DIGEST_LENGTH], sig[64];
+  NN_DIGIT r[NUMWORDS], s[NUMWORDS];
+  size_t prefix = strlen(signing_input);
+
+  for (int j = 0; j < SHA256_DIGEST_LENGTH; j++) {
+    unsigned int byte;
+    sscanf(signing_digest + 2 * j, "%2x", &byte);
+    digest[j] = (uint8_t)byte;
+  }
+
+  ctx.init(priv_key);
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      // the second token takes a precomputed nonce
+      ctx.precomputeNonces(10000000);
+      KAT_CHECK(ctx.getNonceCount() == JWT_NONCE_POOL_SIZE);
+    }
+    size_t len = CreateJwt(jwt, sizeof(jwt), "benchmark-project", 1546300800,
+                           ctx, 3600);
+    KAT_CHECK(len == strlen(jwt));
+    KAT_CHECK(len > prefix && strncmp(jwt, signing_input, prefix) == 0 &&
+              jwt[prefix] == '.');
+    if (len <= prefix) {
+      continue;
+    }
+    KAT_CHECK(base64url_decode(sig, jwt + prefix + 1) == sizeof(sig));
+    NN_Decode(r, NUMWORDS, sig, 32);
+    NN_Decode(s, NUMWORDS, sig + 32, 32);
+    KAT_CHECK(ecdsa_fast_verify(digest, r, s, pub_table) == 1);
+  }
+
+  // a buffer one byte short of the token
+  KAT_CHECK(CreateJwt(jwt, strlen(jwt), "benchmark-project", 1546300800, ctx,
+                      3600) == 0);
+  String token = CreateJwt("benchmark-project", 1546300800, ctx, 3600);
+  KAT_CHECK(strncmp(token.c_str(), signing_input, prefix) == 0);
+}
+
+int main() {
+  NN_DIGIT x[NUMWORDS];
+
+  // the upstream checks need ecc_init, ecc_fast_init reloads the same curve
+  ecc_init();
+  ecc_fast_init();
+  ecdsa_fast_init();
+  from_hex(priv_key, rfc6979_priv);
+  from_hex(x, rfc6979_ux);
+  NN_Assign(pub_key.x, x, NUMWORDS);
+  from_hex(x, rfc6979_uy);
+  NN_Assign(pub_key.y, x, NUMWORDS);
+  ecc_win_precompute(&pub_key, pub_table);
+  ecdsa_init(&pub_key);
+
+  kat_field();
+  kat_inverse();
+  kat_scalar_mul();
+  kat_ecdsa();
+  kat_sha256();
+  kat_jwt();
+
+  printf("NN_P256_FIELD=%d ECC_WNAF=%d W_BITS=%d ECC_FIXED_BASE_COMB=%d: "
+         "%d checks, %d failed\n",
+         NN_P256_FIELD, ECC_WNAF, W_BITS, ECC_FIXED_BASE_COMB, checks,
+         failures);
+  return failures == 0 ? 0 : 1;
+}
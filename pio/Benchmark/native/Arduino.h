@@ -0,0 +1,64 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+/*
+ * Just enough of the Arduino core to build src/crypto and jwt.cpp on the
+ * host for the native benchmark env.
+ */
+#ifndef BENCH_NATIVE_ARDUINO_H
+#define BENCH_NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+
+#define PROGMEM
+#define memcpy_P memcpy
+
+inline unsigned long micros() {
+  using namespace std::chrono;
+  return (unsigned long)duration_cast<microseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+inline unsigned long millis() {
+  return micros() / 1000;
+}
+
+inline long random(long max) {
+  return max > 0 ? rand() % max : 0;
+}
+
+inline long random(long min, long max) {
+  return min + random(max - min);
+}
+
+inline void yield() {}
+
+class String {
+ public:
+  String() {}
+  String(const char *cstr) : s(cstr != NULL ? cstr : "") {}
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.length(); }
+
+ private:
+  std::string s;
+};
+
+#endif  // BENCH_NATIVE_ARDUINO_H
@@ -0,0 +1,230 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+/*
+ * Crypto and JWT benchmarks. Prints one line per benchmark with the time
+ * per operation, operations per second and, where a cycle counter is
+ * available, cycles per operation.
+ */
+#include <Arduino.h>
+
+#include "crypto/ecc.h"
+#include "crypto/ecc_fast.h"
+#include "crypto/ecdsa.h"
+#include "crypto/ecdsa_fast.h"
+#include "crypto/nn.h"
+#include "crypto/p256.h"
+#include "crypto/sha256.h"
+#include "crypto/sha256_fast.h"
+#include "jwt.h"
+
+#if defined(BENCH_NATIVE)
+#define BENCH_PRINTF(...) printf(__VA_ARGS__)
+#else
+#define BENCH_PRINTF(...) Serial.printf(__VA_ARGS__)
+#endif
+
+// Each benchmark repeats until it has run this long
+#ifndef BENCH_MIN_US
+#define BENCH_MIN_US 500000
+#endif
+
+static uint64_t bench_cycles() {
+#if defined(ESP8266) || defined(ESP32)
+  return ESP.getCycleCount();
+#elif defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return 0;
+#endif
+}
+
+typedef void (*bench_fn)(void);
+
+static void bench_run(const char *name, bench_fn fn) {
+  unsigned long iterations = 0;
+  uint64_t cycles = 0;
+  unsigned long start = micros();
+  unsigned long elapsed;
+
+  do {
+    uint64_t c = bench_cycles();
+    fn();
+    // the cycle counter is 32 bits on the ESPs, so sum per iteration
+    cycles += (uint32_t)(bench_cycles() - c);
+    iterations++;
+    yield();
+    elapsed = micros() - start;
+  } while (elapsed < BENCH_MIN_US);
+
+  double us = (double)elapsed / iterations;
+  BENCH_PRINTF("%-18s %8lu %12.2f %12.1f %12lu\n", name, iterations, us,
+               1000000.0 / us, (unsigned long)(cycles / iterations));
+}
+
+// Fixed inputs so runs are comparable
+static const uint8_t bench_key[32] = {
+    0x5a, 0x2e, 0x06, 0xb5, 0xc1, 0xf2, 0x9c, 0xb3, 0x77, 0xb2, 0x89,
+    0xf5, 0x29, 0x29, 0x93, 0xf5, 0xd4, 0x3a, 0x22, 0x62, 0x19, 0x4c,
+    0x2b, 0x17, 0x4b, 0xa9, 0xc7, 0x9e, 0x8e, 0xcc, 0x25, 0x6e};
+
+static NN_DIGIT priv_key[NUMWORDS];
+static NN_DIGIT a[NUMWORDS], b[NUMWORDS], c[NUMWORDS];
+static point_t pub_key, result;
+static point_t pub_table[NUM_POINTS];
+static uint8_t digest[SHA256_DIGEST_LENGTH];
+static NN_DIGIT sig_r[NUMWORDS], sig_s[NUMWORDS];
+static uint8_t sha_block[1024];
+static JwtSigningContext ctx;
+static char jwt[JWT_MAX_LEN];
+
+static void bench_mult() {
+  curve_params_t *param = ecc_get_param();
+  NN_ModMultOpt(c, a, b, param->p, param->omega, NUMWORDS);
+}
+
+static void bench_sqr() {
+  curve_params_t *param = ecc_get_param();
+  NN_ModSqrOpt(c, a, param->p, param->omega, NUMWORDS);
+}
+
+static void bench_inv() {
+  curve_params_t *param = ecc_get_param();
+  NN_ModInv(c, a, param->p, NUMWORDS);
+}
+
+#if NN_P256_FIELD
+static void bench_p256_inv() {
+  p256_inv(c, a);
+}
+
+static void bench_order_inv() {
+  p256_order_inv(c, a);
+}
+#endif
+
+static void bench_win_mul() {
+  ecc_win_mul(&result, priv_key, pub_table);
+}
+
+static void bench_fast_win_mul() {
+  ecc_fast_win_mul(&result, priv_key, pub_table);
+}
+
+static void bench_mul_base() {
+  ecc_win_mul_base(&result, priv_key);
+}
+
+static void bench_fast_mul_base() {
+  ecc_fast_mul_base(&result, priv_key);
+}
+
+static void bench_sign() {
+  ecdsa_sign(digest, sig_r, sig_s, priv_key);
+}
+
+static void bench_fast_sign() {
+  ecdsa_fast_sign(digest, sig_r, sig_s, priv_key);
+}
+
+static void bench_verify() {
+  ecdsa_verify(digest, sig_r, sig_s, &pub_key);
+}
+
+static void bench_fast_verify() {
+  ecdsa_fast_verify(digest, sig_r, sig_s, pub_table);
+}
+
+static void bench_sha() {
+  Sha256 sha;
+  sha.update(sha_block, sizeof(sha_block));
+  sha.final(digest);
+}
+
+static void bench_fast_sha() {
+  Sha256Fast sha;
+  sha.update(sha_block, sizeof(sha_block));
+  sha.final(digest);
+}
+
+static void bench_jwt() {
+  CreateJwt(jwt, sizeof(jwt), "benchmark-project", 1546300800, ctx, 3600);
+}
+
+static void bench_all() {
+  // the upstream rows need ecc_init, ecc_fast_init reloads the same curve
+  ecc_init();
+  ecc_fast_init();
+  NN_Decode(priv_key, NUMWORDS, (unsigned char *)bench_key, sizeof(bench_key));
+  ecc_gen_pub_key(priv_key, &pub_key);
+  ecc_win_precompute(&pub_key, pub_table);
+  ecdsa_init(&pub_key);
+  ecdsa_fast_init();
+  NN_Assign(a, pub_key.x, NUMWORDS);
+  NN_Assign(b, pub_key.y, NUMWORDS);
+  for (size_t i = 0; i < sizeof(sha_block); i++) {
+    sha_block[i] = (uint8_t)i;
+  }
+  memset(digest, 0x5a, sizeof(digest));
+  ecdsa_sign(digest, sig_r, sig_s, priv_key);
+  if (ecdsa_verify(digest, sig_r, sig_s, &pub_key) != 1) {
+    BENCH_PRINTF("ecdsa_verify failed, results are meaningless\n");
+  }
+  ecdsa_fast_sign(digest, sig_r, sig_s, priv_key);
+  if (ecdsa_fast_verify(digest, sig_r, sig_s, pub_table) != 1) {
+    BENCH_PRINTF("ecdsa_fast_verify failed, results are meaningless\n");
+  }
+  ctx.init(priv_key);
+
+  BENCH_PRINTF("%-18s %8s %12s %12s %12s\n", "benchmark", "iters", "us/op",
+               "ops/s", "cycles/op");
+  bench_run("NN_ModMultOpt", bench_mult);
+  bench_run("NN_ModSqrOpt", bench_sqr);
+  bench_run("NN_ModInv", bench_inv);
+#if NN_P256_FIELD
+  bench_run("p256_inv", bench_p256_inv);
+  bench_run("p256_order_inv", bench_order_inv);
+#endif
+  bench_run("ecc_win_mul", bench_win_mul);
+  bench_run("ecc_fast_win_mul", bench_fast_win_mul);
+  bench_run("ecc_win_mul_base", bench_mul_base);
+  bench_run("ecc_fast_mul_base", bench_fast_mul_base);
+  bench_run("ecdsa_sign", bench_sign);
+  bench_run("ecdsa_fast_sign", bench_fast_sign);
+  bench_run("ecdsa_verify", bench_verify);
+  bench_run("ecdsa_fast_verify", bench_fast_verify);
+  bench_run("Sha256 1KB", bench_sha);
+  bench_run("Sha256Fast 1KB", bench_fast_sha);
+  bench_run("CreateJwt", bench_jwt);
+}
+
+#if defined(BENCH_NATIVE)
+int main() {
+  bench_all();
+  return 0;
+}
+#else
+void setup() {
+  Serial.begin(115200);
+  delay(2000);
+#if defined(ESP8266)
+  // the slow benchmarks run longer than the software watchdog allows
+  ESP.wdtDisable();
+#endif
+  bench_all();
+}
+
+void loop() {
+}
+#endif
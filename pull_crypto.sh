@@ -59,4 +59,10 @@ do
   sed -i '1i// AUTOGENERATED, DO NOT EDIT. See CONTRIBUTING.md for instructions.' $f
 done
 
+# Apply the few hooks that the other files in src/crypto build on.
+for p in crypto_patches/*.patch
+do
+  patch -p1 < $p
+done
+
 rm -rf tmp
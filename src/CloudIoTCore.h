@@ -76,4 +76,29 @@
     "ewv4n4Q=\n" \
     "-----END CERTIFICATE-----\n";
 
+// How GCloudIoTMqtt authenticates the server:
+//  GCIOT_TRUST_PEM    parse the PEM roots above into an X509List (default)
+//  GCIOT_TRUST_DER    load the same roots from DER kept in PROGMEM. This
+//                     only skips the PEM decoding: setTrustAnchors() takes
+//                     an X509List, so the decoded anchors still live on the
+//                     heap as with GCIOT_TRUST_PEM
+//  GCIOT_TRUST_PINNED only accept the server key GCIOT_PINNED_KEY (PEM),
+//                     no chain validation and no X509List at all
+#define GCIOT_TRUST_PEM    0
+#define GCIOT_TRUST_DER    1
+#define GCIOT_TRUST_PINNED 2
+
+#ifndef GCIOT_TRUST_MODE
+#define GCIOT_TRUST_MODE GCIOT_TRUST_PEM
+#endif
+
+#if GCIOT_TRUST_MODE == GCIOT_TRUST_DER
+extern const uint8_t gciot_primary_ca_der[];
+extern const size_t gciot_primary_ca_der_len;
+extern const uint8_t gciot_backup_ca_der[];
+extern const size_t gciot_backup_ca_der_len;
+#elif GCIOT_TRUST_MODE == GCIOT_TRUST_PINNED && !defined(GCIOT_PINNED_KEY)
+#error "GCIOT_TRUST_PINNED needs GCIOT_PINNED_KEY, the server public key in PEM"
+#endif
+
 #endif // CloudIoTCore_h
@@ -17,6 +17,13 @@
 #include "CloudIoTCore.h"
 #include "jwt.h"
 
+#if GCIOT_HAS_FS
+#include <FS.h>
+#include <stddef.h>
+
+#include "crypto/sha256_fast.h"
+#endif
+
 CloudIoTCoreDevice::CloudIoTCoreDevice() {}
 
 CloudIoTCoreDevice::CloudIoTCoreDevice(const char *project_id,
@@ -49,6 +56,8 @@ int CloudIoTCoreDevice::getJwtExpSecs() {
   return jwt_exp_secs;
 }
 
+// Signs a new active JWT. Returns an empty String, keeping the current
+// token, if it does not fit JWT_MAX_LEN.
 String CloudIoTCoreDevice::createJWT() {
   
 #if defined(ESP8266)
@@ -57,38 +66,378 @@ String CloudIoTCoreDevice::createJWT() {
 #endif
 
   long long int current_time = time(nullptr);
-
-  exp_millis = millis() + (jwt_exp_secs * 1000);
-  jwt = CreateJwt(project_id, current_time, priv_key, jwt_exp_secs);
+  unsigned long new_exp_millis = millis() + (jwt_exp_secs * 1000);
+  // signed aside, so a token that does not fit leaves the current one alone
+  char jwt[JWT_MAX_LEN];
+  bool ok = signJWT(jwt, current_time);
 
 #if defined(ESP8266)  
   ESP.wdtEnable(0);
 #endif 
-  
-  return jwt;
+
+  if (!ok) {
+    return String();
+  }
+  memcpy(jwt_buf[jwt_index], jwt, sizeof(jwt));
+  exp_millis = new_exp_millis;
+  return String(jwt_buf[jwt_index]);
 }
 
 
+// Builds a JWT into buf and records how long hashing and signing took.
+// Returns false, leaving buf empty, if the token does not fit JWT_MAX_LEN.
+bool CloudIoTCoreDevice::signJWT(char *buf, long long int iat) {
+  loadKey();
+  unsigned long start = micros();
+  size_t len = CreateJwt(buf, JWT_MAX_LEN, project_id, iat, signing_ctx, jwt_exp_secs);
+  unsigned long total_us = micros() - start;
+
+  if (len == 0) {
+    GCIOT_DEBUG_LOG("Error: JWT does not fit, raise JWT_MAX_LEN\n");
+    buf[0] = '\0';
+    return false;
+  }
+  jwt_sign_us = signing_ctx.getLastSignMicros();
+  jwt_hash_us = total_us > jwt_sign_us ? total_us - jwt_sign_us : 0;
+  jwt_count++;
+  return true;
+}
+
+unsigned long CloudIoTCoreDevice::getJwtCount() {
+  return jwt_count;
+}
+
+unsigned long CloudIoTCoreDevice::getJwtHashMicros() {
+  return jwt_hash_us;
+}
+
+unsigned long CloudIoTCoreDevice::getJwtSignMicros() {
+  return jwt_sign_us;
+}
+
 String CloudIoTCoreDevice::getJWT() {
-  return jwt;
+  return String(jwt_buf[jwt_index]);
+}
+
+// The active JWT without a copy. Valid until the next createJWT() or
+// swapJWT().
+const char* CloudIoTCoreDevice::getJWTCStr() {
+  return jwt_buf[jwt_index];
+}
+
+// Spends up to budget_us filling the signing nonce pool so the next
+// createJWT() only has to hash and finish the signature.
+void CloudIoTCoreDevice::precomputeNonces(unsigned long budget_us) {
+  loadKey();
+  signing_ctx.precomputeNonces(budget_us);
+}
+
+// The context holding the device key and its nonce pool, shared by the
+// JWT and payload signing so both draw from the same precomputed nonces.
+JwtSigningContext &CloudIoTCoreDevice::getSigningContext() {
+  loadKey();
+  return signing_ctx;
+}
+
+// Starts preparing the next JWT without blocking. The token is stamped
+// with the current time; call stepJWT() until jwtReady(), then swapJWT()
+// makes it the active one.
+void CloudIoTCoreDevice::beginJWT() {
+  next_iat = time(nullptr);
+  next_exp_millis = millis() + (jwt_exp_secs * 1000);
+  next_jwt_state = JWT_SIGNING;
+}
+
+// Spends up to budget_us on the JWT started by beginJWT(). Returns true
+// once it is ready. If the token does not fit JWT_MAX_LEN it is dropped
+// and jwtInProgress() turns false without it becoming ready.
+bool CloudIoTCoreDevice::stepJWT(unsigned long budget_us) {
+  if (next_jwt_state != JWT_SIGNING) {
+    return next_jwt_state == JWT_READY;
+  }
+
+  loadKey();
+  signing_ctx.precomputeNonces(budget_us);
+  if (signing_ctx.getNonceCount() > 0) {
+    // hashing and finishing the signature with a pooled nonce is cheap
+    next_jwt_state = signJWT(jwt_buf[jwt_index ^ 1], next_iat) ? JWT_READY : JWT_IDLE;
+  }
+  return next_jwt_state == JWT_READY;
+}
+
+bool CloudIoTCoreDevice::jwtInProgress() {
+  return next_jwt_state == JWT_SIGNING;
+}
+
+bool CloudIoTCoreDevice::jwtReady() {
+  return next_jwt_state == JWT_READY;
+}
+
+// Makes the JWT prepared by beginJWT()/stepJWT() the active one. Returns
+// false, leaving the current JWT alone, if none is ready.
+bool CloudIoTCoreDevice::swapJWT() {
+  if (next_jwt_state != JWT_READY) {
+    return false;
+  }
+  jwt_index ^= 1;
+  exp_millis = next_exp_millis;
+  next_jwt_state = JWT_IDLE;
+  return true;
+}
+
+// Any earlier wall clock means time() was never set since the reset
+#define CLOUDIOT_MIN_VALID_TIME 1546300800 // 2019-01-01
+
+#if GCIOT_HAS_RTC
+#define CLOUDIOT_RTC_STATE_MAGIC 0x4a575431 // "JWT1"
+
+// JWT as kept in RTC memory. millis() restarts after deep sleep, so the
+// expiry is stored as wall clock time.
+struct cloudiot_rtc_state {
+  uint32_t exp_time;
+  uint32_t saved_time;
+  char jwt[JWT_MAX_LEN];
+};
+
+// Saves the active JWT to RTC memory. Returns false, clearing the saved
+// state, if there is no JWT or it already expired.
+bool CloudIoTCoreDevice::saveState(uint32_t rtc_offset) {
+  struct cloudiot_rtc_state state;
+  long remaining_ms = (long)(exp_millis - millis());
+
+  if (jwt_buf[jwt_index][0] == '\0' || remaining_ms <= 0) {
+    gciot_rtc_clear(rtc_offset);
+    return false;
+  }
+  state.saved_time = time(nullptr);
+  state.exp_time = state.saved_time + remaining_ms / 1000;
+  memcpy(state.jwt, jwt_buf[jwt_index], sizeof(state.jwt));
+  return gciot_rtc_save(rtc_offset, CLOUDIOT_RTC_STATE_MAGIC, &state, sizeof(state));
+}
+
+// Makes the JWT saved by saveState() the active one again, so the next
+// connect() does not have to sign. If the clock is not set yet (no NTP
+// since waking) the time is estimated from slept_ms.
+bool CloudIoTCoreDevice::restoreState(unsigned long slept_ms, uint32_t rtc_offset) {
+  struct cloudiot_rtc_state state;
+  uint32_t now = time(nullptr);
+
+  if (!gciot_rtc_load(rtc_offset, CLOUDIOT_RTC_STATE_MAGIC, &state, sizeof(state))) {
+    return false;
+  }
+  if (now < CLOUDIOT_MIN_VALID_TIME) {
+    now = state.saved_time + slept_ms / 1000;
+  }
+  if (state.exp_time <= now) {
+    return false;
+  }
+
+  state.jwt[JWT_MAX_LEN - 1] = '\0';
+  memcpy(jwt_buf[jwt_index], state.jwt, sizeof(state.jwt));
+  exp_millis = millis() + (state.exp_time - now) * 1000;
+  next_jwt_state = JWT_IDLE;
+  return true;
+}
+#endif
+
+#if GCIOT_HAS_FS
+#define CLOUDIOT_CACHE_MAGIC 0x4b455931 // "KEY1"
+
+// Cold boot cache as written by saveCache(). id ties it to the key and
+// project it was made for, check covers everything after it. The base
+// point table is already in flash with ECC_FIXED_BASE_COMB.
+struct cloudiot_cache {
+  uint32_t magic;
+  uint8_t check[4];
+  uint8_t id[SHA256_DIGEST_LENGTH];
+  NN_DIGIT priv_key[9];
+  uint32_t exp_time; // 0 if no JWT was saved
+  char jwt[JWT_MAX_LEN];
+#if !ECC_FIXED_BASE_COMB
+  point_t base_table[NUM_POINTS];
+#endif
+};
+
+static void cache_check(const struct cloudiot_cache *cache, uint8_t *check) {
+  uint8_t hash[SHA256_DIGEST_LENGTH];
+  Sha256Fast sha256Instance;
+
+  sha256Instance.update(cache->id, sizeof(*cache) - offsetof(struct cloudiot_cache, id));
+  sha256Instance.final(hash);
+  memcpy(check, hash, sizeof(cache->check));
+}
+
+// Reads a cache record, false if there is none or it was cut short or
+// corrupted.
+static bool cache_read(fs::FS &fs, const char *path, struct cloudiot_cache *cache) {
+  uint8_t check[sizeof(cache->check)];
+
+  fs::File f = fs.open(path, "r");
+  if (!f) {
+    return false;
+  }
+  bool ok = f.size() == sizeof(*cache) &&
+            f.read((uint8_t *)cache, sizeof(*cache)) == sizeof(*cache);
+  f.close();
+  if (!ok || cache->magic != CLOUDIOT_CACHE_MAGIC) {
+    return false;
+  }
+  cache_check(cache, check);
+  return memcmp(check, cache->check, sizeof(check)) == 0;
 }
 
+// Hash of the key and project id, so a cache made for either of them
+// before they changed is never used.
+void CloudIoTCoreDevice::cacheId(uint8_t *id) {
+  Sha256Fast sha256Instance;
+
+  sha256Instance.update((const uint8_t *)private_key, strlen(private_key));
+  sha256Instance.update((const uint8_t *)"/", 1);
+  if (project_id != NULL) {
+    sha256Instance.update((const uint8_t *)project_id, strlen(project_id));
+  }
+  sha256Instance.final(id);
+}
+
+// Saves the decoded key, the base point table and, if the clock is set,
+// the active JWT to path on fs (LittleFS, SPIFFS), which must be mounted.
+// The file is only written when the key, project or JWT changed, so this
+// is cheap to call after every connect.
+bool CloudIoTCoreDevice::saveCache(fs::FS &fs, const char *path) {
+  struct cloudiot_cache cache;
+  uint8_t id[SHA256_DIGEST_LENGTH];
+  long remaining_ms = (long)(exp_millis - millis());
+  uint32_t now = time(nullptr);
+  bool has_jwt = jwt_buf[jwt_index][0] != '\0' && remaining_ms > 0 &&
+                 now >= CLOUDIOT_MIN_VALID_TIME;
+
+  if (private_key == NULL) {
+    return false;
+  }
+  loadKey();
+  cacheId(id);
+
+  // flash wears out, keep a record that still matches
+  if (cache_read(fs, path, &cache) && memcmp(cache.id, id, sizeof(id)) == 0 &&
+      (!has_jwt || strcmp(cache.jwt, jwt_buf[jwt_index]) == 0)) {
+    return true;
+  }
+
+  memset(&cache, 0, sizeof(cache));
+  cache.magic = CLOUDIOT_CACHE_MAGIC;
+  memcpy(cache.id, id, sizeof(id));
+  memcpy(cache.priv_key, signing_ctx.getPrivateKey(), sizeof(cache.priv_key));
+  if (has_jwt) {
+    cache.exp_time = now + remaining_ms / 1000;
+    memcpy(cache.jwt, jwt_buf[jwt_index], sizeof(cache.jwt));
+  }
+#if !ECC_FIXED_BASE_COMB
+  memcpy(cache.base_table, ecc_fast_get_base_table(), sizeof(cache.base_table));
+#endif
+  cache_check(&cache, cache.check);
+
+  fs::File f = fs.open(path, "w");
+  if (!f) {
+    return false;
+  }
+  bool ok = f.write((const uint8_t *)&cache, sizeof(cache)) == sizeof(cache);
+  f.close();
+  return ok;
+}
+
+// Takes the key, and the base point table, from the file saveCache()
+// wrote instead of decoding and computing them, and makes its JWT the
+// active one if there is none yet and it has not expired. Call after
+// setPrivateKey() and setProjectId(), and once the clock is set if the JWT
+// should be reused; a cache for another key or project is removed.
+bool CloudIoTCoreDevice::restoreCache(fs::FS &fs, const char *path) {
+  struct cloudiot_cache cache;
+  uint8_t id[SHA256_DIGEST_LENGTH];
+  uint32_t now = time(nullptr);
+
+  if (private_key == NULL || !cache_read(fs, path, &cache)) {
+    return false;
+  }
+  cacheId(id);
+  if (memcmp(cache.id, id, sizeof(id)) != 0) {
+    fs.remove(path);
+    return false;
+  }
+
+#if !ECC_FIXED_BASE_COMB
+  InitEcc(cache.base_table);
+#endif
+  signing_ctx.init(cache.priv_key);
+  key_loaded = true;
+
+  if (jwt_buf[jwt_index][0] == '\0' && now >= CLOUDIOT_MIN_VALID_TIME &&
+      cache.exp_time > now) {
+    cache.jwt[JWT_MAX_LEN - 1] = '\0';
+    memcpy(jwt_buf[jwt_index], cache.jwt, sizeof(cache.jwt));
+    exp_millis = millis() + (cache.exp_time - now) * 1000;
+    next_jwt_state = JWT_IDLE;
+  }
+  return true;
+}
+#endif
+
 String CloudIoTCoreDevice::getBasePath() {
   return String("/v1/projects/") + project_id + "/locations/" + location +
          "/registries/" + registry_id + "/devices/" + device_id;
 }
 
+// Formats the client id and topics into their buffers. Called by the
+// setters; the client id stays empty until all ids are known.
+void CloudIoTCoreDevice::buildTopics() {
+  int len;
+
+  ids_truncated = false;
+  client_id[0] = '\0';
+  if (project_id != NULL && location != NULL && registry_id != NULL &&
+      device_id != NULL) {
+    len = snprintf(client_id, sizeof(client_id),
+                   "projects/%s/locations/%s/registries/%s/devices/%s",
+                   project_id, location, registry_id, device_id);
+    if (len >= (int)sizeof(client_id)) {
+      GCIOT_DEBUG_LOG("Error: client id needs %d bytes, raise CLOUDIOT_CLIENT_ID_LEN\n",
+                      len + 1);
+      client_id[0] = '\0';
+      ids_truncated = true;
+    }
+  }
+
+  events_topic[0] = state_topic[0] = config_topic[0] = commands_topic[0] = '\0';
+  if (device_id != NULL) {
+    // the commands topic is the longest one
+    len = snprintf(commands_topic, sizeof(commands_topic), "/devices/%s/commands/#",
+                   device_id);
+    if (len >= (int)sizeof(commands_topic)) {
+      GCIOT_DEBUG_LOG("Error: topics need %d bytes, raise CLOUDIOT_TOPIC_LEN\n",
+                      len + 1);
+      commands_topic[0] = '\0';
+      ids_truncated = true;
+      return;
+    }
+    snprintf(events_topic, sizeof(events_topic), "/devices/%s/events", device_id);
+    snprintf(state_topic, sizeof(state_topic), "/devices/%s/state", device_id);
+    snprintf(config_topic, sizeof(config_topic), "/devices/%s/config", device_id);
+  }
+}
+
+bool CloudIoTCoreDevice::idsTruncated() {
+  return ids_truncated;
+}
+
 String CloudIoTCoreDevice::getClientId(){
-  return String("projects/") + project_id + "/locations/" + location +
-         "/registries/" + registry_id + "/devices/" + device_id;
+  return String(client_id);
 }
 
 String CloudIoTCoreDevice::getConfigTopic(){
-  return String("/devices/") + device_id + "/config";
+  return String(config_topic);
 }
 
 String CloudIoTCoreDevice::getCommandsTopic(){
-  return String("/devices/") + device_id + "/commands/#";
+  return String(commands_topic);
 }
 
 String CloudIoTCoreDevice::getDeviceId(){
@@ -96,11 +445,35 @@ String CloudIoTCoreDevice::getDeviceId(){
 }
 
 String CloudIoTCoreDevice::getEventsTopic(){
-  return String("/devices/") + device_id + "/events";
+  return String(events_topic);
 }
 
 String CloudIoTCoreDevice::getStateTopic(){
-  return String("/devices/") + device_id + "/state";
+  return String(state_topic);
+}
+
+const char* CloudIoTCoreDevice::getClientIdCStr() {
+  return client_id;
+}
+
+const char* CloudIoTCoreDevice::getDeviceIdCStr() {
+  return device_id;
+}
+
+const char* CloudIoTCoreDevice::getCommandsTopicCStr() {
+  return commands_topic;
+}
+
+const char* CloudIoTCoreDevice::getConfigTopicCStr() {
+  return config_topic;
+}
+
+const char* CloudIoTCoreDevice::getEventsTopicCStr() {
+  return events_topic;
+}
+
+const char* CloudIoTCoreDevice::getStateTopicCStr() {
+  return state_topic;
 }
 
 String CloudIoTCoreDevice::getConfigPath(int version) {
@@ -121,7 +494,20 @@ String CloudIoTCoreDevice::getSetStatePath() {
   return this->getBasePath() + ":setState";
 }
 
-void CloudIoTCoreDevice::fillPrivateKey() {
+// Decodes private_key for the signing context, unless that was already
+// done or restoreCache() provided it.
+void CloudIoTCoreDevice::loadKey() {
+  if (key_loaded || private_key == NULL) {
+    return;
+  }
+  NN_DIGIT priv_key[9];
+  fillPrivateKey(priv_key);
+  signing_ctx.init(priv_key);
+  key_loaded = true;
+}
+
+void CloudIoTCoreDevice::fillPrivateKey(NN_DIGIT *priv_key) {
+  const char *private_key = this->private_key;
   priv_key[8] = 0;
   for (int i = 7; i >= 0; i--) {
     priv_key[i] = 0;
@@ -138,21 +524,25 @@ void CloudIoTCoreDevice::setJwtExpSecs(int exp_in_secs) {
 
 CloudIoTCoreDevice &CloudIoTCoreDevice::setProjectId(const char *project_id) {
   this->project_id = project_id;
+  buildTopics();
   return *this;
 }
 
 CloudIoTCoreDevice &CloudIoTCoreDevice::setLocation(const char *location) {
   this->location = location;
+  buildTopics();
   return *this;
 }
 
 CloudIoTCoreDevice &CloudIoTCoreDevice::setRegistryId(const char *registry_id) {
   this->registry_id = registry_id;
+  buildTopics();
   return *this;
 }
 
 CloudIoTCoreDevice &CloudIoTCoreDevice::setDeviceId(const char *device_id) {
   this->device_id = device_id;
+  buildTopics();
   return *this;
 }
 
@@ -161,6 +551,7 @@ CloudIoTCoreDevice &CloudIoTCoreDevice::setPrivateKey(const char *private_key) {
   if ( strlen(private_key) != (95) ) {
     GCIOT_DEBUG_LOG("Warning: expected private key to be 95, was: %d", strlen(private_key));
   }
-  fillPrivateKey();
+  // decoded on first use, so restoreCache() can skip it
+  key_loaded = false;
   return *this;
 }
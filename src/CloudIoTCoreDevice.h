@@ -18,21 +18,81 @@
 
 #include <Arduino.h>
 #include "jwt.h"
+#include "CloudIoTRtc.h"
+
+// Buffer sizes for the MQTT client id and the per device topics, including
+// the terminating zero. They fit the longest ids Cloud IoT Core allows: 30
+// characters for the project, 64 for the registry and 128 for the device,
+// with a location name of up to 24.
+#ifndef CLOUDIOT_CLIENT_ID_LEN
+#define CLOUDIOT_CLIENT_ID_LEN 288
+#endif
+#ifndef CLOUDIOT_TOPIC_LEN
+#define CLOUDIOT_TOPIC_LEN 160
+#endif
+
+// Cold boot cache in a flash file system (LittleFS, SPIFFS), see
+// saveCache()
+#if defined(ESP8266) || defined(ESP32)
+#define GCIOT_HAS_FS 1
+#else
+#define GCIOT_HAS_FS 0
+#endif
+
+#if GCIOT_HAS_FS
+// File saveCache() and restoreCache() use by default
+#ifndef CLOUDIOT_CACHE_PATH
+#define CLOUDIOT_CACHE_PATH "/gciot.key"
+#endif
+
+namespace fs {
+class FS;
+}
+#endif
 
 class CloudIoTCoreDevice {
  private:
-  const char *project_id;
-  const char *location;
-  const char *registry_id;
-  const char *device_id;
-  const char *private_key;
-
-  NN_DIGIT priv_key[9];
-  String jwt;
+  const char *project_id = NULL;
+  const char *location = NULL;
+  const char *registry_id = NULL;
+  const char *device_id = NULL;
+  const char *private_key = NULL;
+  // private_key is decoded on first use, or taken from restoreCache()
+  bool key_loaded = false;
+
+  // client id and topics, rebuilt by the setters so publishing never
+  // has to concatenate them
+  char client_id[CLOUDIOT_CLIENT_ID_LEN] = {0};
+  char events_topic[CLOUDIOT_TOPIC_LEN] = {0};
+  char state_topic[CLOUDIOT_TOPIC_LEN] = {0};
+  char config_topic[CLOUDIOT_TOPIC_LEN] = {0};
+  char commands_topic[CLOUDIOT_TOPIC_LEN] = {0};
+  bool ids_truncated = false; // an id did not fit, see idsTruncated()
+
+  JwtSigningContext signing_ctx;
+  // current and next JWT; swapJWT() just flips jwt_index
+  char jwt_buf[2][JWT_MAX_LEN] = {{0}, {0}};
+  uint8_t jwt_index = 0;
   int jwt_exp_secs = 3600;
   unsigned long exp_millis = 0;
 
-  void fillPrivateKey();
+  // next JWT, prepared in the background by beginJWT()/stepJWT()
+  enum { JWT_IDLE, JWT_SIGNING, JWT_READY } next_jwt_state = JWT_IDLE;
+  long long int next_iat = 0;
+  unsigned long next_exp_millis = 0;
+
+  // cost of the last JWT: hashing and encoding, signing
+  unsigned long jwt_count = 0;
+  unsigned long jwt_hash_us = 0;
+  unsigned long jwt_sign_us = 0;
+
+  void fillPrivateKey(NN_DIGIT *priv_key);
+  void loadKey();
+#if GCIOT_HAS_FS
+  void cacheId(uint8_t *id);
+#endif
+  bool signJWT(char *buf, long long int iat);
+  void buildTopics();
   String getBasePath();
 
  public:
@@ -55,6 +115,32 @@ class CloudIoTCoreDevice {
   String createJWT();
   String createJWT(long long int time, int jwt_in_time);
   String getJWT();
+  const char* getJWTCStr();
+  void precomputeNonces(unsigned long budget_us);
+  JwtSigningContext &getSigningContext();
+  unsigned long getJwtCount();
+  unsigned long getJwtHashMicros();
+  unsigned long getJwtSignMicros();
+
+  /* Incremental JWT generation, see beginJWT() */
+  void beginJWT();
+  bool stepJWT(unsigned long budget_us);
+  bool jwtInProgress();
+  bool jwtReady();
+  bool swapJWT();
+
+#if GCIOT_HAS_RTC
+  /* Keep the JWT across deep sleep */
+  bool saveState(uint32_t rtc_offset = CLOUDIOT_RTC_STATE_OFFSET);
+  bool restoreState(unsigned long slept_ms,
+                    uint32_t rtc_offset = CLOUDIOT_RTC_STATE_OFFSET);
+#endif
+
+#if GCIOT_HAS_FS
+  /* Keep the decoded key, base point table and JWT across power cycles */
+  bool saveCache(fs::FS &fs, const char *path = CLOUDIOT_CACHE_PATH);
+  bool restoreCache(fs::FS &fs, const char *path = CLOUDIOT_CACHE_PATH);
+#endif
 
   /* HTTP methods path */
   String getConfigPath(int version);
@@ -69,5 +155,17 @@ class CloudIoTCoreDevice {
   String getDeviceId();
   String getEventsTopic();
   String getStateTopic();
+
+  /* True if the client id or topics did not fit their buffers. They are
+     left empty then, so nothing is sent under a wrong name. */
+  bool idsTruncated();
+
+  /* MQTT methods, without copies. Valid until the next setter call. */
+  const char* getClientIdCStr();
+  const char* getDeviceIdCStr();
+  const char* getCommandsTopicCStr();
+  const char* getConfigTopicCStr();
+  const char* getEventsTopicCStr();
+  const char* getStateTopicCStr();
 };
 #endif  // CloudIoTCoreDevice_h
@@ -0,0 +1,114 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#include <Arduino.h>
+
+#include "CloudIoTCore.h"
+
+#if GCIOT_TRUST_MODE == GCIOT_TRUST_DER
+
+// DER encodings of the LTS roots in CloudIoTCore.h, kept in flash so setup()
+// does not have to parse the PEM text.
+
+// CLOUD_IOT_CORE_LTS_PRIMARY_CA
+const uint8_t gciot_primary_ca_der[] PROGMEM = {
+    0x30, 0x82, 0x01, 0xc5, 0x30, 0x82, 0x01, 0x6b, 0xa0, 0x03, 0x02, 0x01,
+    0x02, 0x02, 0x0d, 0x01, 0xf0, 0xf7, 0x9d, 0x59, 0xdd, 0x6e, 0x50, 0xf7,
+    0x42, 0x73, 0x71, 0x50, 0x30, 0x0a, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce,
+    0x3d, 0x04, 0x03, 0x02, 0x30, 0x44, 0x31, 0x0b, 0x30, 0x09, 0x06, 0x03,
+    0x55, 0x04, 0x06, 0x13, 0x02, 0x55, 0x53, 0x31, 0x22, 0x30, 0x20, 0x06,
+    0x03, 0x55, 0x04, 0x0a, 0x13, 0x19, 0x47, 0x6f, 0x6f, 0x67, 0x6c, 0x65,
+    0x20, 0x54, 0x72, 0x75, 0x73, 0x74, 0x20, 0x53, 0x65, 0x72, 0x76, 0x69,
+    0x63, 0x65, 0x73, 0x20, 0x4c, 0x4c, 0x43, 0x31, 0x11, 0x30, 0x0f, 0x06,
+    0x03, 0x55, 0x04, 0x03, 0x13, 0x08, 0x47, 0x54, 0x53, 0x20, 0x4c, 0x54,
+    0x53, 0x52, 0x30, 0x1e, 0x17, 0x0d, 0x31, 0x38, 0x31, 0x31, 0x30, 0x31,
+    0x30, 0x30, 0x30, 0x30, 0x34, 0x32, 0x5a, 0x17, 0x0d, 0x34, 0x32, 0x31,
+    0x31, 0x30, 0x31, 0x30, 0x30, 0x30, 0x30, 0x34, 0x32, 0x5a, 0x30, 0x44,
+    0x31, 0x0b, 0x30, 0x09, 0x06, 0x03, 0x55, 0x04, 0x06, 0x13, 0x02, 0x55,
+    0x53, 0x31, 0x22, 0x30, 0x20, 0x06, 0x03, 0x55, 0x04, 0x0a, 0x13, 0x19,
+    0x47, 0x6f, 0x6f, 0x67, 0x6c, 0x65, 0x20, 0x54, 0x72, 0x75, 0x73, 0x74,
+    0x20, 0x53, 0x65, 0x72, 0x76, 0x69, 0x63, 0x65, 0x73, 0x20, 0x4c, 0x4c,
+    0x43, 0x31, 0x11, 0x30, 0x0f, 0x06, 0x03, 0x55, 0x04, 0x03, 0x13, 0x08,
+    0x47, 0x54, 0x53, 0x20, 0x4c, 0x54, 0x53, 0x52, 0x30, 0x59, 0x30, 0x13,
+    0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01, 0x06, 0x08, 0x2a,
+    0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00, 0x04, 0xcd,
+    0xf1, 0x8c, 0x8e, 0xda, 0xef, 0xb2, 0x09, 0x0a, 0x19, 0x77, 0x00, 0x24,
+    0x50, 0xdb, 0xf9, 0x73, 0x77, 0x68, 0x91, 0xf5, 0x0b, 0x7e, 0xb0, 0x3a,
+    0x40, 0x98, 0x05, 0x57, 0x65, 0xcc, 0xb8, 0x43, 0x6d, 0x41, 0x92, 0x06,
+    0xe4, 0x75, 0x0e, 0x4b, 0xa8, 0xc5, 0x9f, 0xc7, 0xf4, 0xc9, 0x29, 0x55,
+    0x78, 0xe4, 0x42, 0xc6, 0xa1, 0x72, 0x8c, 0x32, 0x72, 0x46, 0x7f, 0x3a,
+    0x77, 0xe2, 0x24, 0xa3, 0x42, 0x30, 0x40, 0x30, 0x0e, 0x06, 0x03, 0x55,
+    0x1d, 0x0f, 0x01, 0x01, 0xff, 0x04, 0x04, 0x03, 0x02, 0x01, 0x86, 0x30,
+    0x0f, 0x06, 0x03, 0x55, 0x1d, 0x13, 0x01, 0x01, 0xff, 0x04, 0x05, 0x30,
+    0x03, 0x01, 0x01, 0xff, 0x30, 0x1d, 0x06, 0x03, 0x55, 0x1d, 0x0e, 0x04,
+    0x16, 0x04, 0x14, 0x3e, 0xfe, 0xff, 0xcc, 0x52, 0xeb, 0xbf, 0x34, 0x3e,
+    0x3d, 0xf3, 0x40, 0xd0, 0xe4, 0x25, 0xb1, 0x5f, 0xb8, 0xbb, 0x52, 0x30,
+    0x0a, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x02, 0x03,
+    0x48, 0x00, 0x30, 0x45, 0x02, 0x21, 0x00, 0xf2, 0xae, 0x7f, 0xf5, 0x6d,
+    0x04, 0x7a, 0x86, 0xc3, 0x74, 0xd4, 0xc1, 0x42, 0x2a, 0xed, 0x37, 0xda,
+    0x13, 0x1a, 0x77, 0x6c, 0x7e, 0xdb, 0x8c, 0x20, 0x66, 0x55, 0x72, 0x6e,
+    0xa5, 0x3f, 0x45, 0x02, 0x20, 0x6b, 0xd1, 0x29, 0x82, 0xb6, 0xcb, 0xa4,
+    0x9a, 0x21, 0xa0, 0xa5, 0xa8, 0xe3, 0x7f, 0xf8, 0x05, 0x8a, 0x01, 0x8c,
+    0xdf, 0x81, 0x7d, 0xd3, 0x6d, 0x5b, 0x09, 0x6b, 0x35, 0x31, 0xb2, 0xf4,
+    0x48,
+};
+const size_t gciot_primary_ca_der_len = sizeof(gciot_primary_ca_der);
+
+// CLOUD_IOT_CORE_LTS_BACKUP_CA
+const uint8_t gciot_backup_ca_der[] PROGMEM = {
+    0x30, 0x82, 0x01, 0xe1, 0x30, 0x82, 0x01, 0x87, 0xa0, 0x03, 0x02, 0x01,
+    0x02, 0x02, 0x11, 0x2a, 0x38, 0xa4, 0x1c, 0x96, 0x0a, 0x04, 0xde, 0x42,
+    0xb2, 0x28, 0xa5, 0x0b, 0xe8, 0x34, 0x98, 0x02, 0x30, 0x0a, 0x06, 0x08,
+    0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x02, 0x30, 0x50, 0x31, 0x24,
+    0x30, 0x22, 0x06, 0x03, 0x55, 0x04, 0x0b, 0x13, 0x1b, 0x47, 0x6c, 0x6f,
+    0x62, 0x61, 0x6c, 0x53, 0x69, 0x67, 0x6e, 0x20, 0x45, 0x43, 0x43, 0x20,
+    0x52, 0x6f, 0x6f, 0x74, 0x20, 0x43, 0x41, 0x20, 0x2d, 0x20, 0x52, 0x34,
+    0x31, 0x13, 0x30, 0x11, 0x06, 0x03, 0x55, 0x04, 0x0a, 0x13, 0x0a, 0x47,
+    0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x53, 0x69, 0x67, 0x6e, 0x31, 0x13, 0x30,
+    0x11, 0x06, 0x03, 0x55, 0x04, 0x03, 0x13, 0x0a, 0x47, 0x6c, 0x6f, 0x62,
+    0x61, 0x6c, 0x53, 0x69, 0x67, 0x6e, 0x30, 0x1e, 0x17, 0x0d, 0x31, 0x32,
+    0x31, 0x31, 0x31, 0x33, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x5a, 0x17,
+    0x0d, 0x33, 0x38, 0x30, 0x31, 0x31, 0x39, 0x30, 0x33, 0x31, 0x34, 0x30,
+    0x37, 0x5a, 0x30, 0x50, 0x31, 0x24, 0x30, 0x22, 0x06, 0x03, 0x55, 0x04,
+    0x0b, 0x13, 0x1b, 0x47, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x53, 0x69, 0x67,
+    0x6e, 0x20, 0x45, 0x43, 0x43, 0x20, 0x52, 0x6f, 0x6f, 0x74, 0x20, 0x43,
+    0x41, 0x20, 0x2d, 0x20, 0x52, 0x34, 0x31, 0x13, 0x30, 0x11, 0x06, 0x03,
+    0x55, 0x04, 0x0a, 0x13, 0x0a, 0x47, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x53,
+    0x69, 0x67, 0x6e, 0x31, 0x13, 0x30, 0x11, 0x06, 0x03, 0x55, 0x04, 0x03,
+    0x13, 0x0a, 0x47, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x53, 0x69, 0x67, 0x6e,
+    0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02,
+    0x01, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03,
+    0x42, 0x00, 0x04, 0xb8, 0xc6, 0x79, 0xd3, 0x8f, 0x6c, 0x25, 0x0e, 0x9f,
+    0x2e, 0x39, 0x19, 0x1c, 0x03, 0xa4, 0xae, 0x9a, 0xe5, 0x39, 0x07, 0x09,
+    0x16, 0xca, 0x63, 0xb1, 0xb9, 0x86, 0xf8, 0x8a, 0x57, 0xc1, 0x57, 0xce,
+    0x42, 0xfa, 0x73, 0xa1, 0xf7, 0x65, 0x42, 0xff, 0x1e, 0xc1, 0x00, 0xb2,
+    0x6e, 0x73, 0x0e, 0xff, 0xc7, 0x21, 0xe5, 0x18, 0xa4, 0xaa, 0xd9, 0x71,
+    0x3f, 0xa8, 0xd4, 0xb9, 0xce, 0x8c, 0x1d, 0xa3, 0x42, 0x30, 0x40, 0x30,
+    0x0e, 0x06, 0x03, 0x55, 0x1d, 0x0f, 0x01, 0x01, 0xff, 0x04, 0x04, 0x03,
+    0x02, 0x01, 0x06, 0x30, 0x0f, 0x06, 0x03, 0x55, 0x1d, 0x13, 0x01, 0x01,
+    0xff, 0x04, 0x05, 0x30, 0x03, 0x01, 0x01, 0xff, 0x30, 0x1d, 0x06, 0x03,
+    0x55, 0x1d, 0x0e, 0x04, 0x16, 0x04, 0x14, 0x54, 0xb0, 0x7b, 0xad, 0x45,
+    0xb8, 0xe2, 0x40, 0x7f, 0xfb, 0x0a, 0x6e, 0xfb, 0xbe, 0x33, 0xc9, 0x3c,
+    0xa3, 0x84, 0xd5, 0x30, 0x0a, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d,
+    0x04, 0x03, 0x02, 0x03, 0x48, 0x00, 0x30, 0x45, 0x02, 0x21, 0x00, 0xdc,
+    0x92, 0xa1, 0xa0, 0x13, 0xa6, 0xcf, 0x03, 0xb0, 0xe6, 0xc4, 0x21, 0x97,
+    0x90, 0xfa, 0x14, 0x57, 0x2d, 0x03, 0xec, 0xee, 0x3c, 0xd3, 0x6e, 0xca,
+    0xa8, 0x6c, 0x76, 0xbc, 0xa2, 0xde, 0xbb, 0x02, 0x20, 0x27, 0xa8, 0x85,
+    0x27, 0x35, 0x9b, 0x56, 0xc6, 0xa3, 0xf2, 0x47, 0xd2, 0xb7, 0x6e, 0x1b,
+    0x02, 0x00, 0x17, 0xaa, 0x67, 0xa6, 0x15, 0x91, 0xde, 0xfa, 0x94, 0xec,
+    0x7b, 0x0b, 0xf8, 0x9f, 0x84,
+};
+const size_t gciot_backup_ca_der_len = sizeof(gciot_backup_ca_der);
+
+#endif // GCIOT_TRUST_MODE == GCIOT_TRUST_DER
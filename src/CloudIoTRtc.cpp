@@ -0,0 +1,115 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#include "CloudIoTRtc.h"
+
+#if GCIOT_HAS_RTC
+
+#if defined(ESP32)
+RTC_DATA_ATTR static uint32_t gciot_rtc_mem[GCIOT_RTC_BLOCKS];
+#endif
+
+#define RTC_CHUNK_WORDS 16
+
+static bool rtc_write(uint32_t block, const uint32_t *words, size_t count) {
+  if (block + count > GCIOT_RTC_BLOCKS) {
+    return false;
+  }
+#if defined(ESP8266)
+  return ESP.rtcUserMemoryWrite(block, (uint32_t *)words, count * 4);
+#else
+  memcpy(&gciot_rtc_mem[block], words, count * 4);
+  return true;
+#endif
+}
+
+static bool rtc_read(uint32_t block, uint32_t *words, size_t count) {
+  if (block + count > GCIOT_RTC_BLOCKS) {
+    return false;
+  }
+#if defined(ESP8266)
+  return ESP.rtcUserMemoryRead(block, words, count * 4);
+#else
+  memcpy(words, &gciot_rtc_mem[block], count * 4);
+  return true;
+#endif
+}
+
+// FNV-1a, enough to tell a saved record from RTC garbage
+static uint32_t rtc_check(uint32_t magic, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  uint32_t h = 2166136261u ^ magic;
+  while (len--) {
+    h = (h ^ *p++) * 16777619u;
+  }
+  return h;
+}
+
+bool gciot_rtc_save(uint32_t block, uint32_t magic, const void *data, size_t len) {
+  uint32_t chunk[RTC_CHUNK_WORDS];
+  const uint8_t *p = (const uint8_t *)data;
+
+  chunk[0] = magic;
+  chunk[1] = rtc_check(magic, data, len);
+  if (!rtc_write(block, chunk, 2)) {
+    return false;
+  }
+  block += 2;
+
+  // RTC memory is word addressed, so copy through an aligned buffer
+  while (len > 0) {
+    size_t n = len < sizeof(chunk) ? len : sizeof(chunk);
+    memset(chunk, 0, sizeof(chunk));
+    memcpy(chunk, p, n);
+    if (!rtc_write(block, chunk, (n + 3) / 4)) {
+      return false;
+    }
+    block += RTC_CHUNK_WORDS;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool gciot_rtc_load(uint32_t block, uint32_t magic, void *data, size_t len) {
+  uint32_t chunk[RTC_CHUNK_WORDS];
+  uint8_t *p = (uint8_t *)data;
+  size_t remaining = len;
+  uint32_t check;
+
+  if (!rtc_read(block, chunk, 2) || chunk[0] != magic) {
+    return false;
+  }
+  check = chunk[1];
+  block += 2;
+
+  while (remaining > 0) {
+    size_t n = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+    if (!rtc_read(block, chunk, (n + 3) / 4)) {
+      return false;
+    }
+    memcpy(p, chunk, n);
+    block += RTC_CHUNK_WORDS;
+    p += n;
+    remaining -= n;
+  }
+  return check == rtc_check(magic, data, len);
+}
+
+void gciot_rtc_clear(uint32_t block) {
+  uint32_t zero = 0;
+  rtc_write(block, &zero, 1);
+}
+
+#endif // GCIOT_HAS_RTC
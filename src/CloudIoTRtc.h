@@ -0,0 +1,52 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#ifndef CLOUDIOT_RTC_H
+#define CLOUDIOT_RTC_H
+
+#include <Arduino.h>
+
+// Small records kept in memory that survives deep sleep: RTC user memory
+// on ESP8266, RTC slow memory on ESP32. Offsets are in 4 byte blocks, 128
+// of them in total.
+#if defined(ESP8266) || defined(ESP32)
+#define GCIOT_HAS_RTC 1
+#else
+#define GCIOT_HAS_RTC 0
+#endif
+
+#define GCIOT_RTC_BLOCKS 128
+
+// Default layout: TLS session, MQTT backoff, device JWT
+#ifndef GCIOT_RTC_SESSION_OFFSET
+#define GCIOT_RTC_SESSION_OFFSET 0   // 24 blocks
+#endif
+#ifndef GCIOT_RTC_MQTT_OFFSET
+#define GCIOT_RTC_MQTT_OFFSET 26     // 4 blocks
+#endif
+#ifndef CLOUDIOT_RTC_STATE_OFFSET
+#define CLOUDIOT_RTC_STATE_OFFSET 30 // 3 + JWT_MAX_LEN / 4 blocks
+#endif
+
+#if GCIOT_HAS_RTC
+// Writes data behind a magic word and a checksum starting at block.
+bool gciot_rtc_save(uint32_t block, uint32_t magic, const void *data, size_t len);
+// Reads a record written by gciot_rtc_save(). Returns false if the magic
+// or checksum do not match, e.g. after a power cycle.
+bool gciot_rtc_load(uint32_t block, uint32_t magic, void *data, size_t len);
+// Invalidates the record at block.
+void gciot_rtc_clear(uint32_t block);
+#endif
+
+#endif // CLOUDIOT_RTC_H
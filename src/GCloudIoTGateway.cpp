@@ -0,0 +1,421 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#include "GCloudIoTGateway.h"
+#include "TelemetryBatcher.h"
+
+// Attachment of one device, advanced by step()
+#define GW_DETACHED     0
+#define GW_SUB_CONFIG   1 // attached, config not subscribed yet
+#define GW_SUB_COMMANDS 2 // attached, commands not subscribed yet
+#define GW_ATTACHED     3
+
+GCloudIoTGateway::GCloudIoTGateway(GCloudIoTMqtt *mqtt) {
+  this->mqtt = mqtt;
+}
+
+GCloudIoTGateway::~GCloudIoTGateway() {
+  cleanup();
+}
+
+// Call after GCloudIoTMqtt::setup(). Also registers the gateway with it.
+bool GCloudIoTGateway::setup(int max_devices, int batch_bytes,
+                             unsigned long max_latency_ms) {
+  cleanup();
+
+  this->entries = new Entry[max_devices];
+  this->max_devices = max_devices;
+  this->batch_bytes = batch_bytes;
+  this->max_latency_ms = max_latency_ms;
+  if (batch_bytes > 0) {
+    // one block for every device, so batching never fragments the heap
+    this->batch_mem = new char[max_devices * batch_bytes];
+  }
+  mqtt->setGateway(this);
+  return true;
+}
+
+void GCloudIoTGateway::cleanup() {
+  if (this->entries != NULL) {
+    mqtt->setGateway(NULL);
+    delete[] this->entries;
+    this->entries = NULL;
+  }
+  if (this->batch_mem != NULL) {
+    delete[] this->batch_mem;
+    this->batch_mem = NULL;
+  }
+  this->max_devices = 0;
+  this->count = 0;
+  this->next_step = 0;
+}
+
+bool GCloudIoTGateway::addDevice(const char *device_id) {
+  Entry *e = add(device_id);
+
+  if (e == NULL) {
+    return false;
+  }
+  e->auth = NULL;
+  e->wanted = true;
+  return true;
+}
+
+bool GCloudIoTGateway::addDevice(CloudIoTCoreDevice *device) {
+  Entry *e = add(device->getDeviceIdCStr());
+
+  if (e == NULL) {
+    return false;
+  }
+  e->auth = device;
+  e->wanted = true;
+  return true;
+}
+
+// Detaches the device at the next step(); its entry stays, so addDevice()
+// attaches it again.
+void GCloudIoTGateway::removeDevice(const char *device_id) {
+  Entry *e = find(device_id);
+
+  if (e != NULL) {
+    flushEntry(e);
+    e->wanted = false;
+  }
+}
+
+bool GCloudIoTGateway::isAttached(const char *device_id) {
+  Entry *e = find(device_id);
+  return e != NULL && e->state == GW_ATTACHED;
+}
+
+int GCloudIoTGateway::getDeviceCount() {
+  return this->count;
+}
+
+int GCloudIoTGateway::getAttachedCount() {
+  int attached = 0;
+  for (int i = 0; i < this->count; i++) {
+    if (this->entries[i].state == GW_ATTACHED) {
+      attached++;
+    }
+  }
+  return attached;
+}
+
+// Queues a sample on the device's batch, or sends it right away without
+// batching. Returns false if it, or the batch it displaced, was not sent.
+bool GCloudIoTGateway::publishTelemetry(const char *device_id,
+                                        const char *data, int length) {
+  Entry *e = find(device_id);
+
+  // with batching, samples wait in the batch while the device is detached
+  if (e == NULL || (e->state != GW_ATTACHED && e->batch == NULL)) {
+    return false;
+  }
+  if (e->batch == NULL || length + 1 > e->capacity) {
+    // keep the order when a sample is sent on its own
+    if (!flushEntry(e)) {
+      return false;
+    }
+    return mqtt->publishTopic(deviceTopic(e->device_id, "events"), data, length, 0);
+  }
+  if (e->length + length + 1 > e->capacity && !flushEntry(e)) {
+    return false;
+  }
+
+  if (e->samples == 0) {
+    e->first_sample_millis = millis();
+  } else {
+    e->batch[e->length++] = '\n';
+  }
+  memcpy(e->batch + e->length, data, length);
+  e->length += length;
+  e->samples++;
+  return true;
+}
+
+bool GCloudIoTGateway::publishState(const char *device_id,
+                                    const char *data, int length) {
+  Entry *e = find(device_id);
+
+  if (e == NULL || e->state != GW_ATTACHED) {
+    return false;
+  }
+  return mqtt->publishTopic(deviceTopic(e->device_id, "state"), data, length, 0);
+}
+
+bool GCloudIoTGateway::flush(const char *device_id) {
+  Entry *e = find(device_id);
+  return e == NULL || flushEntry(e);
+}
+
+bool GCloudIoTGateway::flushAll() {
+  bool ok = true;
+  for (int i = 0; i < this->count; i++) {
+    ok = flushEntry(&this->entries[i]) && ok;
+  }
+  return ok;
+}
+
+// Sends batches whose oldest sample is max_latency_ms old. Call this along
+// with GCloudIoTMqtt::loop().
+void GCloudIoTGateway::loop() {
+  if (this->max_latency_ms == 0) {
+    return;
+  }
+  for (int i = 0; i < this->count; i++) {
+    Entry *e = &this->entries[i];
+    if (e->samples > 0 &&
+        (millis() - e->first_sample_millis) >= this->max_latency_ms) {
+      flushEntry(e);
+    }
+  }
+}
+
+void GCloudIoTGateway::setConfigCallback(GCloudIoTGatewayCallback cb) {
+  this->configCB = cb;
+}
+
+void GCloudIoTGateway::setCommandCallback(GCloudIoTGatewayCallback cb) {
+  this->commandCB = cb;
+}
+
+void GCloudIoTGateway::setErrorCallback(GCloudIoTMessageCallback cb) {
+  this->errorCB = cb;
+}
+
+// A new MQTT session has no attachments or subscriptions, start over.
+// Batches are kept and go out once their device is attached again.
+void GCloudIoTGateway::onConnect() {
+  for (int i = 0; i < this->count; i++) {
+    this->entries[i].state = GW_DETACHED;
+  }
+  this->errors_subscribed = false;
+  this->next_step = 0;
+}
+
+// Does the next pending attach, detach or subscribe, at most one MQTT round
+// trip, so loop() is never held up for long however many devices there are.
+void GCloudIoTGateway::step() {
+  if (!this->errors_subscribed) {
+    this->errors_subscribed = mqtt->subscribe(
+        deviceTopic(mqtt->getDevice()->getDeviceIdCStr(), "errors"), 0);
+    return;
+  }
+  for (int i = 0; i < this->count; i++) {
+    Entry *e = &this->entries[(this->next_step + i) % this->count];
+    if (stepEntry(e)) {
+      // the next step starts with the device after this one
+      this->next_step = (this->next_step + i + 1) % this->count;
+      return;
+    }
+  }
+}
+
+// Routes config, commands and errors of the gateway's devices. Returns
+// false for topics that are not the gateway's.
+bool GCloudIoTGateway::route(const char *topic, const uint8_t *payload, size_t len) {
+  const char *id, *rest;
+  size_t id_len;
+
+  if (strncmp(topic, "/devices/", 9) != 0) {
+    return false;
+  }
+  id = topic + 9;
+  rest = strchr(id, '/');
+  if (rest == NULL) {
+    return false;
+  }
+  id_len = rest - id;
+
+  if (strcmp(rest, "/errors") == 0) {
+    if (this->errorCB != NULL) {
+      this->errorCB(topic, payload, len);
+    }
+    return true;
+  }
+  for (int i = 0; i < this->count; i++) {
+    const char *device_id = this->entries[i].device_id;
+    if (strncmp(device_id, id, id_len) != 0 || device_id[id_len] != '\0') {
+      continue;
+    }
+    if (strcmp(rest, "/config") == 0) {
+      if (this->configCB != NULL) {
+        this->configCB(device_id, topic, payload, len);
+      }
+      return true;
+    }
+    if (strncmp(rest, "/commands", 9) == 0) {
+      if (this->commandCB != NULL) {
+        this->commandCB(device_id, topic, payload, len);
+      }
+      return true;
+    }
+    return false;
+  }
+  return false;
+}
+
+GCloudIoTGateway::Entry *GCloudIoTGateway::find(const char *device_id) {
+  for (int i = 0; i < this->count; i++) {
+    if (strcmp(this->entries[i].device_id, device_id) == 0) {
+      return &this->entries[i];
+    }
+  }
+  return NULL;
+}
+
+// The entry for device_id, new and detached if there was none. NULL if the
+// id does not fit the topics or there is no room.
+GCloudIoTGateway::Entry *GCloudIoTGateway::add(const char *device_id) {
+  Entry *e;
+
+  if (device_id == NULL) {
+    return NULL;
+  }
+  e = find(device_id);
+  if (e != NULL) {
+    return e;
+  }
+  // the commands subscription is the longest topic
+  if (deviceTopic(device_id, "commands/#") == NULL) {
+    GCIOT_DEBUG_LOG("gateway: device id does not fit the topics\n");
+    return NULL;
+  }
+  if (this->count >= this->max_devices) {
+    GCIOT_DEBUG_LOG("gateway: no room for %s\n", device_id);
+    return NULL;
+  }
+  e = &this->entries[this->count];
+  e->device_id = device_id;
+  e->state = GW_DETACHED;
+  e->batch = this->batch_mem != NULL ?
+             this->batch_mem + this->count * this->batch_bytes : NULL;
+  // a batch has to fit one PUBLISH on the device's events topic
+  e->capacity = mqtt->getBufferSize() - GCIOT_PUBLISH_OVERHEAD -
+                strlen(deviceTopic(device_id, "events"));
+  if (e->capacity > this->batch_bytes) {
+    e->capacity = this->batch_bytes;
+  }
+  e->length = 0;
+  e->samples = 0;
+  this->count++;
+  return e;
+}
+
+// "/devices/<id>/<suffix>", built in topic_buf. NULL if it does not fit.
+const char *GCloudIoTGateway::deviceTopic(const char *device_id,
+                                          const char *suffix) {
+  int len = snprintf(this->topic_buf, sizeof(this->topic_buf),
+                     "/devices/%s/%s", device_id, suffix);
+
+  if (len >= (int)sizeof(this->topic_buf)) {
+    return NULL;
+  }
+  return this->topic_buf;
+}
+
+// One round trip, or one JWT signing step, for e if it needs one. Returns
+// false if it had nothing to do.
+bool GCloudIoTGateway::stepEntry(Entry *e) {
+  CloudIoTCoreDevice *device = e->auth;
+
+  if (!e->wanted) {
+    if (e->state == GW_DETACHED) {
+      return false;
+    }
+    // detaching drops the device's subscriptions on the broker as well
+    if (mqtt->publishTopic(deviceTopic(e->device_id, "detach"), "{}", 2, 1)) {
+      e->state = GW_DETACHED;
+    }
+    return true;
+  }
+
+  switch (e->state) {
+    case GW_DETACHED:
+      if (device != NULL) {
+        char payload[JWT_MAX_LEN + 24];
+        if (!tokenReady(e)) {
+          // still signing, or the JWT does not fit
+          return true;
+        }
+        int len = snprintf(payload, sizeof(payload), "{\"authorization\":\"%s\"}",
+                           device->getJWTCStr());
+        if (mqtt->publishTopic(deviceTopic(e->device_id, "attach"), payload, len, 1)) {
+          e->state = GW_SUB_CONFIG;
+        }
+      } else if (mqtt->publishTopic(deviceTopic(e->device_id, "attach"), "{}", 2, 1)) {
+        e->state = GW_SUB_CONFIG;
+      }
+      return true;
+
+    case GW_SUB_CONFIG:
+      if (mqtt->subscribe(deviceTopic(e->device_id, "config"), 1)) {
+        e->state = GW_SUB_COMMANDS;
+      }
+      return true;
+
+    case GW_SUB_COMMANDS:
+      if (mqtt->subscribe(deviceTopic(e->device_id, "commands/#"), 0)) {
+        e->state = GW_ATTACHED;
+      }
+      return true;
+  }
+  return false;
+}
+
+// Makes sure e's device has a JWT to attach with. Like the gateway's own,
+// it is signed within GCloudIoTMqtt's JWT step budget over as many steps
+// as it takes, or at once if the budget is 0. Returns false until it is
+// ready; if it does not fit JWT_MAX_LEN the device is given up.
+bool GCloudIoTGateway::tokenReady(Entry *e) {
+  CloudIoTCoreDevice *device = e->auth;
+  unsigned long budget_us = mqtt->getJwtStepBudget();
+
+  if (millis() + 60000 <= device->getExpMillis()) {
+    return true;
+  }
+  if (budget_us == 0) {
+    if (device->createJWT().length() == 0) {
+      e->wanted = false;
+      return false;
+    }
+    return true;
+  }
+  if (!device->jwtInProgress() && !device->jwtReady()) {
+    device->beginJWT();
+  }
+  if (!device->stepJWT(budget_us)) {
+    if (!device->jwtInProgress()) {
+      e->wanted = false;
+    }
+    return false;
+  }
+  device->swapJWT();
+  return true;
+}
+
+// Sends e's batch. On failure it stays queued.
+bool GCloudIoTGateway::flushEntry(Entry *e) {
+  if (e->samples == 0) {
+    return true;
+  }
+  if (e->state != GW_ATTACHED ||
+      !mqtt->publishTopic(deviceTopic(e->device_id, "events"), e->batch, e->length, 0)) {
+    return false;
+  }
+  e->length = 0;
+  e->samples = 0;
+  return true;
+}
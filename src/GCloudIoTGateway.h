@@ -0,0 +1,117 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#ifndef GCLOUD_IOT_GATEWAY_H
+#define GCLOUD_IOT_GATEWAY_H
+
+#include <Arduino.h>
+
+#include "CloudIoTCoreDevice.h"
+#include "GCloudIoTMqtt.h"
+
+// Inbound message for one of the gateway's devices. payload is only valid
+// during the call and may not be terminated.
+typedef void (*GCloudIoTGatewayCallback)(const char *device_id,
+                                         const char *topic,
+                                         const uint8_t *payload, size_t len);
+
+// Lets one GCloudIoTMqtt connection, authenticated as a Cloud IoT Core
+// gateway, carry many bound devices: each is attached over the gateway's
+// MQTT session, gets its config and commands routed back by topic, and
+// publishes its own telemetry and state.
+//
+// Devices are attached one MQTT round trip per GCloudIoTMqtt::loop() once
+// the gateway is connected, and again after every reconnect. Telemetry is
+// batched per device in one block allocated by setup(), newline separated
+// like TelemetryBatcher, and sent when a device's batch is full or, from
+// loop(), max_latency_ms after its oldest sample.
+//
+// A bound device is only its id: its topics are built when they are
+// needed, so each one costs sizeof(Entry) (32 bytes on the ESPs) plus
+// batch_bytes. Only devices that attach with their own JWT need a
+// CloudIoTCoreDevice, which holds their key, tokens and topics.
+class GCloudIoTGateway {
+  public:
+    GCloudIoTGateway(GCloudIoTMqtt *mqtt);
+    virtual ~GCloudIoTGateway();
+
+    // batch_bytes per device, 0 sends every sample on its own.
+    bool setup(int max_devices, int batch_bytes = 0,
+               unsigned long max_latency_ms = 1000);
+    void cleanup();
+
+    // Attaches device_id on the strength of the gateway binding alone.
+    // The string is not copied and must stay valid.
+    bool addDevice(const char *device_id);
+    // Attaches with the device's own JWT, for registries whose gateway
+    // auth method needs one. The JWT is signed in steps like the
+    // gateway's, see GCloudIoTMqtt::setJwtStepBudget(). device must stay
+    // valid.
+    bool addDevice(CloudIoTCoreDevice *device);
+    void removeDevice(const char *device_id);
+    bool isAttached(const char *device_id);
+    int getDeviceCount();
+    int getAttachedCount();
+
+    bool publishTelemetry(const char *device_id, const char *data, int length);
+    bool publishState(const char *device_id, const char *data, int length);
+    bool flush(const char *device_id);
+    bool flushAll();
+    void loop();
+
+    void setConfigCallback(GCloudIoTGatewayCallback cb);
+    void setCommandCallback(GCloudIoTGatewayCallback cb);
+    // Errors Cloud IoT Core reports for the gateway and its devices
+    void setErrorCallback(GCloudIoTMessageCallback cb);
+
+    // Called by GCloudIoTMqtt.
+    void onConnect();
+    void step();
+    bool route(const char *topic, const uint8_t *payload, size_t len);
+
+  private:
+    struct Entry {
+      const char *device_id;
+      CloudIoTCoreDevice *auth; // signs the attach JWT, NULL if not needed
+      bool wanted;
+      uint8_t state;        // see GW_* in the .cpp
+      char *batch;          // slice of batch_mem
+      int capacity;
+      int length;
+      int samples;
+      unsigned long first_sample_millis;
+    };
+
+    GCloudIoTMqtt *mqtt = NULL;
+    Entry *entries = NULL;
+    int max_devices = 0;
+    int count = 0;
+    int next_step = 0; // round robin over entries
+    char *batch_mem = NULL;
+    int batch_bytes = 0;
+    unsigned long max_latency_ms = 0;
+    bool errors_subscribed = false;
+    char topic_buf[CLOUDIOT_TOPIC_LEN];
+    GCloudIoTGatewayCallback configCB = NULL;
+    GCloudIoTGatewayCallback commandCB = NULL;
+    GCloudIoTMessageCallback errorCB = NULL;
+
+    Entry *find(const char *device_id);
+    Entry *add(const char *device_id);
+    const char *deviceTopic(const char *device_id, const char *suffix);
+    bool stepEntry(Entry *e);
+    bool tokenReady(Entry *e);
+    bool flushEntry(Entry *e);
+};
+#endif // GCLOUD_IOT_GATEWAY_H
@@ -13,8 +13,14 @@
  * limitations under the License.
  *****************************************************************************/
 #include "GCloudIoTMqtt.h"
+#include "GCloudIoTGateway.h"
+#include "PayloadSigner.h"
+#include "TelemetryQueue.h"
+#include "CloudIoTRtc.h"
 #include "CloudIoTCore.h"
 
+#include <new>
+
 #ifdef ESP8266
 #include <ESP8266WiFi.h>
 #endif
@@ -23,39 +29,45 @@
 #include <WiFi.h>
 #endif
 
-// connection exponential backoff settings
+// default connection backoff settings
 // see: https://cloud.google.com/iot/docs/how-tos/exponential-backoff
-#define EXP_BACKOFF_FACTOR    2
 #define EXP_BACKOFF_MIN_MS    1000
 #define EXP_BACKOFF_MAX_MS    32000
-#define EXP_BACKOFF_JITTER_MS 500
+// an overloaded broker is given more room
+#define EXP_BACKOFF_SERVER_MIN_MS 5000
+#define EXP_BACKOFF_SERVER_MAX_MS 120000
+
+// JWT rotation: reconnect this long before the JWT expires, and start
+// signing the next one in the background this long before.
+#define JWT_ROTATE_MS  60000
+#define JWT_PREPARE_MS 300000
+
+// A keep-alive counts as working once a connection using it lasted this
+// many intervals.
+#define KEEPALIVE_PROVEN_INTERVALS 3
 
+#if GCIOT_TRUST_MODE == GCIOT_TRUST_PEM
 // Certificates for SSL on the Google Cloud IOT LTS server
 const char* gciot_primary_ca = CLOUD_IOT_CORE_LTS_PRIMARY_CA;
 const char* gciot_backup_ca = CLOUD_IOT_CORE_LTS_BACKUP_CA;
+#endif
 
 
 
-class MQTTClientWithCookie : public MQTTClient {
-public:
-  MQTTClientWithCookie(int bufSize, void * cookie)
-    : MQTTClient(bufSize) { _cookie_ = cookie; }
-
-  void * _cookie_;
-};
-
-
 void gciot_onMessageAdv(MQTTClient *client, char topic[], char bytes[], int length) {
   
   GCloudIoTMqtt * gcmqtt = (GCloudIoTMqtt*)((MQTTClientWithCookie *)client)->_cookie_;
-  String topic_str = String(topic);
-  String payload_str = String((const char *)bytes);
 
   if (gcmqtt != NULL) {
-    gcmqtt->onMessageReceived(topic_str, payload_str);
+    gcmqtt->onMessageReceived(topic, (const uint8_t *)bytes, (size_t)length);
   }
 }
 
+// Kinds of inbound topics, see topicKind()
+#define GCIOT_TOPIC_OTHER    0
+#define GCIOT_TOPIC_COMMANDS 1
+#define GCIOT_TOPIC_CONFIG   2
+
 ///////////////////////////////
 // MQTT common functions
 ///////////////////////////////
@@ -63,6 +75,13 @@ void gciot_onMessageAdv(MQTTClient *client, char topic[], char bytes[], int leng
 GCloudIoTMqtt::GCloudIoTMqtt(CloudIoTCoreDevice * device)
 {
   this->device = device;
+  setBackoffPolicy(GCIOT_FAIL_NETWORK, EXP_BACKOFF_MIN_MS, EXP_BACKOFF_MAX_MS);
+  // a fresh JWT usually fixes it, so retry once right away
+  setBackoffPolicy(GCIOT_FAIL_AUTH, EXP_BACKOFF_MIN_MS, EXP_BACKOFF_MAX_MS, 1);
+  setBackoffPolicy(GCIOT_FAIL_SERVER, EXP_BACKOFF_SERVER_MIN_MS,
+                   EXP_BACKOFF_SERVER_MAX_MS);
+  setBackoffPolicy(GCIOT_FAIL_REJECTED, EXP_BACKOFF_MAX_MS,
+                   EXP_BACKOFF_SERVER_MAX_MS);
 }
 
 GCloudIoTMqtt::~GCloudIoTMqtt()
@@ -70,30 +89,142 @@ GCloudIoTMqtt::~GCloudIoTMqtt()
   cleanup();
 }	
 
+// Makes setup(), setPayloadSigning() and setStateCoalescing() place their
+// objects and buffers in mem instead of the heap, so they cannot fragment it.
+// mem must be GCIOT_ARENA_ALIGN aligned and, for len, add up the
+// GCIOT_ARENA_*_SIZE() of the calls that will be made. Only the newest
+// allocation is given back early; cleanup() empties the whole arena. The
+// MQTT read and write buffers, the parsed roots and the TLS I/O buffers
+// are allocated inside arduino-mqtt and BearSSL, and stay on the heap.
+// Call before setup(); NULL goes back to the heap.
+bool GCloudIoTMqtt::setArena(void *mem, size_t len) {
+  if (this->mqttClient != NULL ||
+      ((uintptr_t)mem & (GCIOT_ARENA_ALIGN - 1)) != 0) {
+    return false;
+  }
+  this->arena = (uint8_t *)mem;
+  this->arena_len = mem != NULL ? len : 0;
+  this->arena_used = 0;
+  return true;
+}
+
+size_t GCloudIoTMqtt::getArenaUsed() {
+  return this->arena_used;
+}
+
+// Storage for objects that live until cleanup(), from the arena if one is
+// set. Each arena allocation starts with a header that holds its size.
+void *GCloudIoTMqtt::allocLong(size_t size) {
+  size_t need = GCIOT_ARENA_ITEM(size);
+  uint8_t *item;
+
+  if (this->arena == NULL) {
+    return malloc(size);
+  }
+  if (need > this->arena_len - this->arena_used) {
+    GCIOT_DEBUG_LOG("arena: %u of %u bytes used, %u more needed\n",
+                    (unsigned)this->arena_used, (unsigned)this->arena_len,
+                    (unsigned)need);
+    return NULL;
+  }
+  item = this->arena + this->arena_used;
+  *(size_t *)item = need;
+  this->arena_used += need;
+  return item + GCIOT_ARENA_ALIGN;
+}
+
+void GCloudIoTMqtt::freeLong(void *p) {
+  uint8_t *item;
+
+  if (p == NULL) {
+    return;
+  }
+  if (this->arena == NULL) {
+    free(p);
+    return;
+  }
+  item = (uint8_t *)p - GCIOT_ARENA_ALIGN;
+  if (item + *(size_t *)item == this->arena + this->arena_used) {
+    this->arena_used = item - this->arena;
+  }
+}
+
 bool GCloudIoTMqtt::setup(int bufsize, int keepAlive_sec, int timeout_ms)
 { 
+  void *mem;
+
+  if (device->idsTruncated()) {
+    GCIOT_DEBUG_LOG("cloudiotmqtt: client id or topics do not fit\n");
+    return false;
+  }
+
   // ESP8266 WiFi setup
-  this->netClient = new BearSSL::WiFiClientSecure();
-  this->certList = new BearSSL::X509List();
+  if ((mem = allocLong(sizeof(BearSSL::WiFiClientSecure))) == NULL) {
+    return false;
+  }
+  this->netClient = new (mem) BearSSL::WiFiClientSecure();
+
+#if GCIOT_TRUST_MODE == GCIOT_TRUST_PINNED
+  // Only the pinned key is accepted, so there is no chain to validate
+  if ((mem = allocLong(sizeof(BearSSL::PublicKey))) == NULL) {
+    cleanup();
+    return false;
+  }
+  this->pinnedKey = new (mem) BearSSL::PublicKey(GCIOT_PINNED_KEY);
+  this->netClient->setKnownKey(this->pinnedKey);
+#else
+  if ((mem = allocLong(sizeof(BearSSL::X509List))) == NULL) {
+    cleanup();
+    return false;
+  }
+  this->certList = new (mem) BearSSL::X509List();
   
   // ESP8266 WiFi secure initialization
   // Set CA cert on wifi client
+#if GCIOT_TRUST_MODE == GCIOT_TRUST_DER
+  this->certList->append(gciot_primary_ca_der, gciot_primary_ca_der_len);
+  this->certList->append(gciot_backup_ca_der, gciot_backup_ca_der_len);
+#else
   this->certList->append(gciot_primary_ca);
   this->certList->append(gciot_backup_ca);
+#endif
   this->netClient->setTrustAnchors(this->certList);
+#endif
+
+  // keep the TLS session so JWT rotations get an abbreviated handshake
+  if ((mem = allocLong(sizeof(BearSSL::Session))) == NULL) {
+    cleanup();
+    return false;
+  }
+  this->session = new (mem) BearSSL::Session();
+  if (this->useSessions) {
+    this->netClient->setSession(this->session);
+  }
   
-  this->mqttClient = new MQTTClientWithCookie(bufsize, this);
+  this->bufsize = bufsize;
+  this->timeout_ms = timeout_ms;
+  this->keepalive_sec = keepAlive_sec;
+  this->keepalive_min_sec = keepAlive_sec;
+  this->keepalive_good_sec = keepAlive_sec;
+  if ((mem = allocLong(sizeof(MQTTClientWithCookie))) == NULL) {
+    cleanup();
+    return false;
+  }
+  this->mqttClient = new (mem) MQTTClientWithCookie(bufsize, this);
   this->mqttClient->setOptions(keepAlive_sec, true, timeout_ms);
+  // bounds the TLS step of a connection attempt like the MQTT ones
+  this->netClient->setTimeout(timeout_ms);
   
   this->backoff_until_millis = 0;
   this->backoff_ms = 0;
   this->useLts = true;
 
   if (this->useLts) {
-    this->mqttClient->begin(CLOUD_IOT_CORE_MQTT_HOST_LTS, CLOUD_IOT_CORE_MQTT_PORT, *netClient);
+    this->host = CLOUD_IOT_CORE_MQTT_HOST_LTS;
   } else {
-    this->mqttClient->begin(CLOUD_IOT_CORE_MQTT_HOST, CLOUD_IOT_CORE_MQTT_PORT, *netClient);
+    this->host = CLOUD_IOT_CORE_MQTT_HOST;
   }
+  this->mqttClient->begin(this->host, CLOUD_IOT_CORE_MQTT_PORT, *netClient);
 
   this->mqttClient->onMessageAdvanced(gciot_onMessageAdv);
   
@@ -104,74 +235,299 @@ void GCloudIoTMqtt::cleanup() {
 	
   if (this->mqttClient != NULL) {
     this->mqttClient->disconnect();
-    delete this->mqttClient;
-    this->mqttClient = NULL;
   }
+  freeLong(this->state_buf);
+  this->state_buf = NULL;
+  this->state_pending = false;
+  freeLong(this->sign_buf);
+  this->sign_buf = NULL;
+  // newest first, so each one goes back to the arena
+  destroyLong(this->mqttClient);
+  destroyLong(this->session);
+  destroyLong(this->certList);
+  destroyLong(this->pinnedKey);
+  destroyLong(this->netClient);
+  this->arena_used = 0;
+}
 
-  if (this->netClient != NULL) {
-    delete this->netClient;
-    this->netClient = NULL;
-  }
+// Connects and blocks until the attempt succeeded or failed. loop() uses
+// beginConnect() instead, so reconnects never stall the caller for more
+// than one step.
+bool GCloudIoTMqtt::connect(bool auto_reconnect, bool skip) {
+  this->autoReconnect = true;
 
-  if (this->certList != NULL) {
-    delete this->certList;
-    this->certList = NULL;
+  beginConnect(skip);
+  while (!connectStep()) {
+    yield();
   }
-
+  return !device->idsTruncated() && this->mqttClient->connected();
 }
 
-bool GCloudIoTMqtt::connect(bool auto_reconnect, bool skip) {
+// Starts a connection attempt that loop() advances one bounded step per
+// call: JWT, TLS, MQTT CONNECT, then one SUBSCRIBE per step.
+void GCloudIoTMqtt::beginConnect(bool skip) {
   this->autoReconnect = true;
+  this->conn_skip = skip;
+  this->conn_state = GCIOT_CONN_JWT;
+}
 
-  // regenerate JWT if expiring
-  if ((millis() + 60000) > device->getExpMillis()) {
-    // reconnecting before JWT expiration
-    GCIOT_DEBUG_LOG("cloudiotmqtt: JWT expired, regenerating...\n");
-	  device->createJWT(); // Regenerate JWT using device function
-  }
+bool GCloudIoTMqtt::connecting() {
+  return this->conn_state != GCIOT_CONN_IDLE;
+}
+
+GCloudIoTConnectState GCloudIoTMqtt::getConnectState() {
+  return this->conn_state;
+}
 
-  bool result =
-      this->mqttClient->connect(
-          device->getClientId().c_str(),
+// Ends the attempt for good on an error retrying cannot fix, such as ids
+// or a JWT too long for their buffers.
+void GCloudIoTMqtt::connectAbort() {
+  this->autoReconnect = false;
+  this->conn_state = GCIOT_CONN_IDLE;
+}
+
+// Runs the current step of the attempt started by beginConnect(). Each
+// network step waits at most timeout_ms (see setup()). Returns true once
+// the attempt is over, connected or not.
+bool GCloudIoTMqtt::connectStep() {
+  bool result;
+  unsigned long start = micros();
+
+  switch (this->conn_state) {
+    case GCIOT_CONN_IDLE:
+      return true;
+
+    case GCIOT_CONN_JWT:
+      if (device->idsTruncated()) {
+        // an id set after setup() did not fit
+        GCIOT_DEBUG_LOG("cloudiotmqtt: client id or topics do not fit\n");
+        connectAbort();
+        return true;
+      }
+      // regenerate JWT if expiring or rotating, unless loop() already
+      // prepared one
+      if (this->conn_rotate || (millis() + JWT_ROTATE_MS) > device->getExpMillis()) {
+        if (device->swapJWT()) {
+          this->conn_rotate = false;
+        }
+      }
+      if (this->conn_rotate || (millis() + JWT_ROTATE_MS) > device->getExpMillis()) {
+        GCIOT_DEBUG_LOG("cloudiotmqtt: JWT expired, regenerating...\n");
+        if (this->jwt_step_budget_us == 0) {
+          // Regenerate JWT using device function
+          if (device->createJWT().length() == 0) {
+            connectAbort();
+            return true;
+          }
+        } else {
+          if (!device->jwtInProgress() && !device->jwtReady()) {
+            device->beginJWT();
+          }
+          if (!device->stepJWT(this->jwt_step_budget_us)) {
+            if (!device->jwtInProgress()) {
+              // the JWT does not fit JWT_MAX_LEN
+              connectAbort();
+              return true;
+            }
+            return false;
+          }
+          device->swapJWT();
+        }
+        this->conn_rotate = false;
+      }
+      this->conn_state = this->conn_skip ? GCIOT_CONN_MQTT : GCIOT_CONN_TLS;
+      return false;
+
+    case GCIOT_CONN_TLS:
+      // open the TLS connection here so the handshake and the MQTT CONNECT
+      // are timed separately, then let the MQTT client skip it
+      if (this->mqttClient->connected()) {
+        this->link_up = false;
+        this->mqttClient->disconnect();
+      }
+      result = this->netClient->connect(this->host, CLOUD_IOT_CORE_MQTT_PORT) > 0;
+      this->stats.tls_handshake_us = micros() - start;
+      if (!result) {
+        // the MQTT client never saw this attempt, so report it for it
+        this->tls_error = LWMQTT_NETWORK_FAILED_CONNECT;
+        connectFailed(GCIOT_FAIL_NETWORK);
+        return true;
+      }
+      this->conn_state = GCIOT_CONN_MQTT;
+      return false;
+
+    case GCIOT_CONN_MQTT:
+      this->tls_error = LWMQTT_SUCCESS;
+      // the keep-alive only takes effect with a new CONNECT
+      this->mqttClient->setOptions(this->keepalive_sec, true, this->timeout_ms);
+      result = this->mqttClient->connect(
+          device->getClientIdCStr(),
           "unused",
-          device->getJWT().c_str(),
-          skip);
-
-  GCIOT_DEBUG_LOG("cloudiotmqtt: connect rc=%s [%d], errcode=%s [%d]\n",
-      getLastConnectReturnCodeAsString().c_str(), mqttClient->returnCode(),
-      getLastErrorCodeAsString().c_str(), getLastErrorCode());
-		  
-  if (result && this->mqttClient->connected()) {
-    this->backoff_ms = 0;
-    // Set QoS to 1 (ack) for configuration messages
-    this->mqttClient->subscribe(device->getConfigTopic(), 1);
-    // QoS 0 (no ack) for commands
-    this->mqttClient->subscribe(device->getCommandsTopic(), 0);
+          device->getJWTCStr(),
+          true);
+      this->stats.mqtt_connect_us = micros() - start;
+
+      GCIOT_DEBUG_LOG("cloudiotmqtt: connect rc=%s [%d], errcode=%s [%d]\n",
+          getLastConnectReturnCodeAsString().c_str(), mqttClient->returnCode(),
+          getLastErrorCodeAsString().c_str(), getLastErrorCode());
 
-    onConnect(); 
+      if (!result || !this->mqttClient->connected()) {
+        connectFailed(classifyFailure());
+        return true;
+      }
+      this->backoff_ms = 0;
+      this->fail_streak = 0;
+      this->conn_keepalive_sec = this->keepalive_sec;
+      this->link_up = true;
+      this->link_up_millis = millis();
+      this->last_activity_millis = millis();
+      if (this->stats.connect_count++ > 0) {
+        this->stats.reconnect_count++;
+      }
+      this->conn_state = GCIOT_CONN_SUB_CONFIG;
+      return false;
 
+    case GCIOT_CONN_SUB_CONFIG:
+      // Set QoS to 1 (ack) for configuration messages
+      this->mqttClient->subscribe(device->getConfigTopicCStr(), 1);
+      this->conn_state = GCIOT_CONN_SUB_COMMANDS;
+      return false;
+
+    case GCIOT_CONN_SUB_COMMANDS:
+      // QoS 0 (no ack) for commands
+      this->mqttClient->subscribe(device->getCommandsTopicCStr(), 0);
+      this->conn_state = GCIOT_CONN_IDLE;
+      onConnect();
+      return true;
+  }
+  return true;
+}
+
+// True when the connection should move to the next JWT now: always in the
+// last JWT_ROTATE_MS, and with the adaptive policy already in the prepare
+// window once the next JWT is at hand and nothing was sent or received for
+// rotate_idle_ms, so the reconnect does not land in the middle of traffic.
+bool GCloudIoTMqtt::rotationDue() {
+  unsigned long now = millis();
+
+  if ((now + JWT_ROTATE_MS) > device->getExpMillis()) {
     return true;
   }
+  if (this->rotate_idle_ms == 0 ||
+      (now + JWT_PREPARE_MS) <= device->getExpMillis() ||
+      (this->jwt_step_budget_us > 0 && !device->jwtReady()) ||
+      (now - this->last_activity_millis) < this->rotate_idle_ms) {
+    return false;
+  }
+  this->stats.idle_rotate_count++;
+  return true;
+}
 
-  switch(mqttClient->returnCode()) {
-    case (LWMQTT_BAD_USERNAME_OR_PASSWORD):
-    case (LWMQTT_NOT_AUTHORIZED):
-      GCIOT_DEBUG_LOG("cloudiotmqtt: auth failed: regenerating JWT token\n");
-      device->createJWT(); // Regenerate JWT using device function
+// Tracks how the current connection fares with its keep-alive. One that
+// lasted KEEPALIVE_PROVEN_INTERVALS is trusted and the next CONNECT tries
+// half as long again, up to keepalive_max_sec. One that is lost sooner,
+// while trying an unproven value, is taken as a NAT or broker idle timeout
+// below it: the ceiling drops to 3/4 of it and the next CONNECT goes back
+// to the longest proven value.
+void GCloudIoTMqtt::updateKeepAlive() {
+  unsigned long up_ms;
+
+  if (!this->link_up) {
+    return;
+  }
+  up_ms = millis() - this->link_up_millis;
+  if (!this->mqttClient->connected()) {
+    this->link_up = false;
+    this->stats.link_drop_count++;
+    if (this->keepalive_max_sec > 0 &&
+        this->conn_keepalive_sec > this->keepalive_good_sec &&
+        up_ms < KEEPALIVE_PROVEN_INTERVALS * 1000UL * this->conn_keepalive_sec) {
+      this->keepalive_max_sec = this->conn_keepalive_sec * 3 / 4;
+      if (this->keepalive_max_sec < this->keepalive_good_sec) {
+        this->keepalive_max_sec = this->keepalive_good_sec;
+      }
+      this->keepalive_sec = this->keepalive_good_sec;
+      GCIOT_DEBUG_LOG("cloudiotmqtt: lost link at keep-alive %ds, ceiling %ds\n",
+                      this->conn_keepalive_sec, this->keepalive_max_sec);
+    }
+    return;
+  }
+  if (this->keepalive_max_sec > 0 &&
+      this->conn_keepalive_sec > this->keepalive_good_sec &&
+      up_ms >= KEEPALIVE_PROVEN_INTERVALS * 1000UL * this->conn_keepalive_sec) {
+    this->keepalive_good_sec = this->conn_keepalive_sec;
+  }
+  if (this->keepalive_max_sec > 0 &&
+      this->keepalive_sec == this->keepalive_good_sec &&
+      this->keepalive_sec < this->keepalive_max_sec) {
+    this->keepalive_sec = this->keepalive_good_sec * 3 / 2;
+    if (this->keepalive_sec > this->keepalive_max_sec) {
+      this->keepalive_sec = this->keepalive_max_sec;
+    }
+  }
+}
+
+// Sorts a failed MQTT CONNECT by what the broker answered, if anything.
+GCloudIoTFailure GCloudIoTMqtt::classifyFailure() {
+  if (mqttClient->lastError() != LWMQTT_CONNECTION_DENIED) {
+    return GCIOT_FAIL_NETWORK;
+  }
+  switch (mqttClient->returnCode()) {
+    case LWMQTT_BAD_USERNAME_OR_PASSWORD:
+    case LWMQTT_NOT_AUTHORIZED:
+      return GCIOT_FAIL_AUTH;
+    case LWMQTT_SERVER_UNAVAILABLE:
+      return GCIOT_FAIL_SERVER;
     default:
-      break;
+      return GCIOT_FAIL_REJECTED;
+  }
+}
+
+// Ends a failed attempt and schedules the next one.
+void GCloudIoTMqtt::connectFailed(GCloudIoTFailure failure) {
+  this->conn_state = GCIOT_CONN_IDLE;
+
+  if (failure == GCIOT_FAIL_AUTH) {
+    // the JWT step of the next attempt signs a new one, in budgeted steps
+    GCIOT_DEBUG_LOG("cloudiotmqtt: auth failed: regenerating JWT token\n");
+    this->conn_rotate = true;
   }
 
-  // See https://cloud.google.com/iot/docs/how-tos/exponential-backoff
-  if (this->backoff_ms < EXP_BACKOFF_MIN_MS) {
-    this->backoff_ms = EXP_BACKOFF_MIN_MS + random(EXP_BACKOFF_JITTER_MS);
-  } else if (this->backoff_ms < EXP_BACKOFF_MAX_MS) {
-    this->backoff_ms = this->backoff_ms * EXP_BACKOFF_FACTOR + random(EXP_BACKOFF_JITTER_MS);
+  // a new kind of failure starts its own backoff from scratch
+  if (failure != this->fail_class) {
+    this->fail_class = failure;
+    this->fail_streak = 0;
+    this->backoff_ms = 0;
   }
+  this->fail_streak++;
+  this->backoff_ms = nextBackoff(failure, this->fail_streak, this->backoff_ms);
+
+  this->backoff_until_millis = millis() + this->backoff_ms;
+  this->stats.connect_fail_count++;
+  this->stats.backoff_ms += this->backoff_ms;
+}
 
-	this->backoff_until_millis = millis() + this->backoff_ms;
+// Delay before the next attempt after the streak-th failure of a class in
+// a row, last_ms being the previous delay (0 at the start of a streak).
+// Decorrelated jitter spreads a fleet that failed together over the whole
+// range instead of keeping it in step, as plain doubling would. Override
+// to plug in another strategy.
+unsigned long GCloudIoTMqtt::nextBackoff(GCloudIoTFailure failure, int streak,
+                                         unsigned long last_ms) {
+  const GCloudIoTBackoffPolicy *p = &this->backoff_policy[failure];
+  unsigned long hi;
 
-  return false;
+  if (streak <= p->immediate_retries) {
+    return 0;
+  }
+  if (last_ms < p->base_ms) {
+    last_ms = p->base_ms;
+  }
+  hi = last_ms * 3 < p->cap_ms ? last_ms * 3 : p->cap_ms;
+  if (hi <= p->base_ms) {
+    return p->base_ms;
+  }
+  return p->base_ms + random(hi - p->base_ms + 1);
 }
 
 bool GCloudIoTMqtt::connected()
@@ -182,81 +538,582 @@ bool GCloudIoTMqtt::connected()
 bool GCloudIoTMqtt::disconnect()
 {
   this->autoReconnect = false;
+  this->conn_state = GCIOT_CONN_IDLE;
+  this->link_up = false;
   return mqttClient->disconnect();
 }
 
 void GCloudIoTMqtt::loop() {
-  
-  if (mqttClient->connected() && (millis() + 60000) > device->getExpMillis()) {
+  unsigned long loop_start = micros();
+
+  updateKeepAlive();
+
+  // sign the next JWT in small steps ahead of the rotation below
+  if (this->jwt_step_budget_us > 0 && mqttClient->connected() &&
+      (millis() + JWT_PREPARE_MS) > device->getExpMillis() && !device->jwtReady()) {
+    if (!device->jwtInProgress()) {
+      GCIOT_DEBUG_LOG("cloudiotmqtt: preparing next JWT...\n");
+      device->beginJWT();
+    }
+    device->stepJWT(this->jwt_step_budget_us);
+  }
+
+  if (connecting()) {
+    // one step of the connection attempt per loop()
+    connectStep();
+  } else if (mqttClient->connected() && rotationDue()) {
     // reconnecting before JWT expiration
     GCIOT_DEBUG_LOG("cloudiotmqtt: JWT expiring, disconnecting to regenerate...\n");
+    this->link_up = false;
     mqttClient->disconnect();
-    connect(autoReconnect, false); // TODO: should we skip closing connection
+    beginConnect(false);
+    this->conn_rotate = true;
   } else if (autoReconnect && !mqttClient->connected() && millis() > this->backoff_until_millis) {
     if (isNetworkConnected()) {
       // attempt to reconnect only if network is connected
       GCIOT_DEBUG_LOG("cloudiotmqtt: reconnecting...\n");
-      connect(true);
+      beginConnect(false);
     }
   }
 
   this->mqttClient->loop();
+
+  // attach gateway devices, one round trip per loop()
+  if (this->gateway != NULL && mqttClient->connected() && !connecting()) {
+    this->gateway->step();
+  }
+
+  // send the latest coalesced state once the rate limit allows
+  if (this->state_pending) {
+    flushState();
+  }
+
+  // forward samples recorded while offline, a few per loop()
+  if (this->offlineQueue != NULL && mqttClient->connected()) {
+    drainOfflineQueue();
+  }
+
+  // use idle time to precompute signing nonces for the next JWT
+  if (this->nonce_budget_us > 0) {
+    device->precomputeNonces(this->nonce_budget_us);
+  }
+
+  if (this->stats_interval_ms > 0 && mqttClient->connected() &&
+      (millis() - this->stats_last_millis) >= this->stats_interval_ms) {
+    this->stats_last_millis = millis();
+    publishStats();
+  }
+
+#if defined(ESP8266) || defined(ESP32)
+  uint32_t heap = ESP.getFreeHeap();
+  if (this->stats.heap_min == 0 || heap < this->stats.heap_min) {
+    this->stats.heap_min = heap;
+  }
+#endif
+  unsigned long loop_us = micros() - loop_start;
+  if (loop_us > this->stats.loop_max_us) {
+    this->stats.loop_max_us = loop_us;
+  }
+  this->stats.loop_count++;
 }
 
 
 bool GCloudIoTMqtt::publishTelemetry(String data) {
-  return this->mqttClient->publish(device->getEventsTopic(), data);
+  return publishEvents(NULL, data.c_str(), data.length(), 0);
 }
 
 bool GCloudIoTMqtt::publishTelemetry(String data, int qos) {
-  return this->mqttClient->publish(device->getEventsTopic(), data, false, qos);
+  return publishEvents(NULL, data.c_str(), data.length(), qos);
 }
 
 bool GCloudIoTMqtt::publishTelemetry(const char* data, int length) {
-  return this->mqttClient->publish(device->getEventsTopic().c_str(), data, length);
+  return publishEvents(NULL, data, length, 0);
 }
 
 bool GCloudIoTMqtt::publishTelemetry(String subtopic, String data) {
-  return this->mqttClient->publish(device->getEventsTopic() + subtopic, data);
+  return publishEvents(subtopic.c_str(), data.c_str(), data.length(), 0);
 }
 
 bool GCloudIoTMqtt::publishTelemetry(String subtopic, String data, int qos) {
-  return this->mqttClient->publish(device->getEventsTopic() + subtopic, data, false, qos);
+  return publishEvents(subtopic.c_str(), data.c_str(), data.length(), qos);
 }
 
 bool GCloudIoTMqtt::publishTelemetry(String subtopic, const char* data, int length) {
-  return this->mqttClient->publish(String(device->getEventsTopic() + subtopic).c_str(), data, length);
+  return publishEvents(subtopic.c_str(), data, length, 0);
+}
+
+bool GCloudIoTMqtt::publishTelemetry(const char* subtopic, const char* data, int length) {
+  return publishEvents(subtopic, data, length, 0);
+}
+
+// Common path of the publishTelemetry() overloads. While offline the
+// sample goes to the offline queue, if one is set, and counts as sent.
+bool GCloudIoTMqtt::publishEvents(const char* subtopic, const char* data, int length, int qos) {
+  if (this->offlineQueue != NULL && !this->mqttClient->connected()) {
+    return this->offlineQueue->push(subtopic, data, length);
+  }
+  return sendEvents(subtopic, data, length, qos);
+}
+
+bool GCloudIoTMqtt::sendEvents(const char* subtopic, const char* data, int length, int qos) {
+  const char *topic = device->getEventsTopicCStr();
+  if (subtopic != NULL && subtopic[0] != '\0') {
+    topic = eventsSubtopic(subtopic);
+    if (topic == NULL) {
+      return false;
+    }
+  }
+  if (this->sign_buf != NULL) {
+    // the signature trails the payload, so it covers queued samples too
+    if (length + PAYLOAD_SIG_LEN > this->bufsize) {
+      this->stats.publish_fail_count++;
+      return false;
+    }
+    unsigned long start = micros();
+    memcpy(this->sign_buf, data, length);
+    SignPayload((const uint8_t *)data, length, device->getSigningContext(),
+                (uint8_t *)this->sign_buf + length);
+    this->stats.sign_last_us = micros() - start;
+    this->stats.sign_count++;
+    data = this->sign_buf;
+    length += PAYLOAD_SIG_LEN;
+  }
+  return publishRaw(topic, data, length, qos);
+}
+
+// Every publish goes through here so it is counted and timed.
+bool GCloudIoTMqtt::publishRaw(const char* topic, const char* data, int length, int qos) {
+  unsigned long start = micros();
+  bool result = this->mqttClient->publish(topic, data, length, false, qos);
+  unsigned long publish_us = micros() - start;
+
+  this->stats.publish_last_us = publish_us;
+  if (publish_us > this->stats.publish_max_us) {
+    this->stats.publish_max_us = publish_us;
+  }
+  if (result) {
+    this->last_activity_millis = millis();
+    this->stats.publish_count++;
+    this->stats.bytes_sent += strlen(topic) + length;
+  } else {
+    this->stats.publish_fail_count++;
+  }
+  return result;
+}
+
+// Sends up to queue_drain_per_loop queued samples, oldest first.
+void GCloudIoTMqtt::drainOfflineQueue() {
+  const char *subtopic, *data;
+  int length, sent = 0;
+
+  while (sent < this->queue_drain_per_loop && this->mqttClient->connected() &&
+         this->offlineQueue->peek(&subtopic, &data, &length)) {
+    if (!sendEvents(subtopic, data, length, 0)) {
+      break;
+    }
+    this->offlineQueue->pop();
+    sent++;
+  }
+  if (sent > 0) {
+    this->offlineQueue->sync();
+  }
+}
+
+// Joins the events topic and subtopic in topic_buf. Returns NULL if the
+// subtopic is longer than GCIOT_SUBTOPIC_LEN allows.
+const char* GCloudIoTMqtt::eventsSubtopic(const char* subtopic) {
+  int len = snprintf(topic_buf, sizeof(topic_buf), "%s%s",
+                     device->getEventsTopicCStr(), subtopic);
+  if (len >= (int)sizeof(topic_buf)) {
+    GCIOT_DEBUG_LOG("cloudiotmqtt: subtopic too long: %s\n", subtopic);
+    return NULL;
+  }
+  return topic_buf;
+}
+
+void GCloudIoTMqtt::setSessionResumption(bool enabled) {
+  this->useSessions = enabled;
+  if (this->netClient != NULL) {
+    this->netClient->setSession(enabled ? this->session : NULL);
+  }
+}
+
+#if defined(ESP8266)
+#define GCIOT_RTC_SESSION_MAGIC 0x53534c31 // "SSL1"
+
+// Saves the TLS session to RTC user memory, which survives deep sleep.
+// Call it before ESP.deepSleep().
+bool GCloudIoTMqtt::saveSession(uint32_t rtc_offset) {
+  if (this->session == NULL) {
+    return false;
+  }
+  return gciot_rtc_save(rtc_offset, GCIOT_RTC_SESSION_MAGIC,
+                        this->session->getSession(),
+                        sizeof(br_ssl_session_parameters));
+}
+
+// Loads a session saved by saveSession(), after setup() and before the
+// first connect(). Returns false if there is none.
+bool GCloudIoTMqtt::restoreSession(uint32_t rtc_offset) {
+  br_ssl_session_parameters params;
+
+  if (this->session == NULL ||
+      !gciot_rtc_load(rtc_offset, GCIOT_RTC_SESSION_MAGIC, &params, sizeof(params))) {
+    return false;
+  }
+  memcpy(this->session->getSession(), &params, sizeof(params));
+  return true;
+}
+#endif
+
+#if GCIOT_HAS_RTC
+#define GCIOT_RTC_MQTT_MAGIC 0x4d515431 // "MQT1"
+
+// Saves everything a wake from deep sleep needs to publish without
+// signing a new JWT or doing a full handshake: the device JWT, the TLS
+// session and the backoff state.
+bool GCloudIoTMqtt::saveState() {
+  uint32_t backoff[2];
+  bool ok = device->saveState();
+
+#if defined(ESP8266)
+  ok = saveSession() && ok;
+#endif
+  backoff[0] = this->backoff_ms;
+  backoff[1] = (long)(this->backoff_until_millis - millis()) > 0 ?
+               this->backoff_until_millis - millis() : 0;
+  return gciot_rtc_save(GCIOT_RTC_MQTT_OFFSET, GCIOT_RTC_MQTT_MAGIC,
+                        backoff, sizeof(backoff)) && ok;
+}
+
+// Restores the state written by saveState(). Call after setup() and
+// before connect(); slept_ms is how long the device was asleep. Returns
+// true if the JWT could be reused.
+bool GCloudIoTMqtt::restoreState(unsigned long slept_ms) {
+  uint32_t backoff[2];
+
+#if defined(ESP8266)
+  restoreSession();
+#endif
+  if (gciot_rtc_load(GCIOT_RTC_MQTT_OFFSET, GCIOT_RTC_MQTT_MAGIC,
+                     backoff, sizeof(backoff))) {
+    this->backoff_ms = backoff[0];
+    this->backoff_until_millis = millis() +
+        (backoff[1] > slept_ms ? backoff[1] - slept_ms : 0);
+  }
+  return device->restoreState(slept_ms);
+}
+#endif
+
+// Records telemetry published while offline in queue and forwards it once
+// connected again, drain_per_loop samples per loop(). NULL turns it off.
+void GCloudIoTMqtt::setOfflineQueue(TelemetryQueue *queue, int drain_per_loop) {
+  this->offlineQueue = queue;
+  this->queue_drain_per_loop = drain_per_loop;
+}
+
+// Appends an ES256 signature of each telemetry payload, made with the
+// device key, as PAYLOAD_SIG_LEN raw bytes after it. Call after setup();
+// payloads then have to leave getSignatureLength() bytes of the buffer.
+bool GCloudIoTMqtt::setPayloadSigning(bool enabled) {
+  if (enabled && this->sign_buf != NULL) {
+    return true;
+  }
+  freeLong(this->sign_buf);
+  this->sign_buf = NULL;
+  if (enabled) {
+    if (this->bufsize <= PAYLOAD_SIG_LEN) {
+      return false;
+    }
+    this->sign_buf = (char *)allocLong(this->bufsize);
+    return this->sign_buf != NULL;
+  }
+  return true;
+}
+
+// Rate limits publishState() to one state per interval_ms, dropping states
+// equal to the last one sent (compared by SHA-256) and keeping only the
+// newest of those that arrive faster; loop() sends it when allowed. A state
+// waiting while offline goes out after the next connect. Call after
+// setup().
+bool GCloudIoTMqtt::setStateCoalescing(bool enabled, unsigned long interval_ms) {
+  this->state_interval_ms = interval_ms;
+  if (!enabled) {
+    freeLong(this->state_buf);
+    this->state_buf = NULL;
+    this->state_pending = false;
+    this->state_sent = false;
+    return true;
+  }
+  if (this->state_buf == NULL) {
+    this->state_buf = (char *)allocLong(this->bufsize);
+  }
+  return this->state_buf != NULL;
+}
+
+// With a verifier set, config and commands have to end in a signature over
+// the rest of the payload, in the format setPayloadSigning() uses. Messages
+// that fail are dropped; callbacks only see the payload without it.
+void GCloudIoTMqtt::setPayloadVerifier(PayloadVerifier *verifier) {
+  this->verifier = verifier;
+}
+
+// Routes the messages of bound devices to gateway and attaches them after
+// every connect. GCloudIoTGateway::setup() calls this.
+void GCloudIoTMqtt::setGateway(GCloudIoTGateway *gateway) {
+  this->gateway = gateway;
+}
+
+CloudIoTCoreDevice *GCloudIoTMqtt::getDevice() {
+  return this->device;
+}
+
+int GCloudIoTMqtt::getSignatureLength() {
+  return this->sign_buf != NULL ? PAYLOAD_SIG_LEN : 0;
+}
+
+GCloudIoTStats GCloudIoTMqtt::getStats() {
+  this->stats.jwt_count = device->getJwtCount();
+  this->stats.jwt_hash_us = device->getJwtHashMicros();
+  this->stats.jwt_sign_us = device->getJwtSignMicros();
+  this->stats.keepalive_sec = this->conn_keepalive_sec;
+  this->stats.jwt_exp_sec = device->getJwtExpSecs();
+  return this->stats;
+}
+
+void GCloudIoTMqtt::resetStats() {
+  memset(&this->stats, 0, sizeof(this->stats));
+}
+
+// Publishes getStats() as JSON on the stats subtopic.
+bool GCloudIoTMqtt::publishStats() {
+  GCloudIoTStats s = getStats();
+  char buf[608];
+  int len = snprintf(buf, sizeof(buf),
+      "{\"jwt\":%u,\"jwt_hash_us\":%u,\"jwt_sign_us\":%u,"
+      "\"tls_us\":%u,\"connect_us\":%u,\"connects\":%u,"
+      "\"connect_fails\":%u,\"reconnects\":%u,\"backoff_ms\":%u,"
+      "\"publishes\":%u,\"publish_fails\":%u,\"publish_us\":%u,"
+      "\"publish_max_us\":%u,\"tx\":%u,\"rx\":%u,\"loops\":%u,"
+      "\"loop_max_us\":%u,\"heap_min\":%u,\"signs\":%u,"
+      "\"sign_us\":%u,\"verify_fails\":%u,\"keepalive_s\":%u,"
+      "\"jwt_exp_s\":%u,\"idle_rotations\":%u,\"link_drops\":%u,"
+      "\"state_suppressed\":%u,\"state_coalesced\":%u}",
+      (unsigned)s.jwt_count, (unsigned)s.jwt_hash_us, (unsigned)s.jwt_sign_us,
+      (unsigned)s.tls_handshake_us, (unsigned)s.mqtt_connect_us,
+      (unsigned)s.connect_count, (unsigned)s.connect_fail_count,
+      (unsigned)s.reconnect_count, (unsigned)s.backoff_ms,
+      (unsigned)s.publish_count, (unsigned)s.publish_fail_count,
+      (unsigned)s.publish_last_us, (unsigned)s.publish_max_us,
+      (unsigned)s.bytes_sent, (unsigned)s.bytes_received,
+      (unsigned)s.loop_count, (unsigned)s.loop_max_us, (unsigned)s.heap_min,
+      (unsigned)s.sign_count, (unsigned)s.sign_last_us,
+      (unsigned)s.verify_fail_count, (unsigned)s.keepalive_sec,
+      (unsigned)s.jwt_exp_sec, (unsigned)s.idle_rotate_count,
+      (unsigned)s.link_drop_count, (unsigned)s.state_suppressed,
+      (unsigned)s.state_coalesced);
+  if (len >= (int)sizeof(buf)) {
+    return false;
+  }
+  return publishTelemetry(this->stats_subtopic != NULL ? this->stats_subtopic : "/stats",
+                          buf, len);
+}
+
+// Publishes the stats from loop() every interval_ms, 0 turns it off.
+void GCloudIoTMqtt::setStatsInterval(unsigned long interval_ms, const char* subtopic) {
+  this->stats_interval_ms = interval_ms;
+  this->stats_subtopic = subtopic;
+  this->stats_last_millis = millis();
+}
+
+int GCloudIoTMqtt::getBufferSize() {
+  return this->bufsize;
+}
+
+// Length of the topic publishTelemetry() uses for subtopic, NULL for the
+// plain events topic.
+int GCloudIoTMqtt::getEventsTopicLength(const char* subtopic) {
+  return strlen(device->getEventsTopicCStr()) +
+         (subtopic != NULL ? strlen(subtopic) : 0);
 }
 
 // Helper that just sends default sensor
 bool GCloudIoTMqtt::publishState(String data) {
-  return this->mqttClient->publish(device->getStateTopic(), data);
+  return publishRaw(device->getStateTopicCStr(), data.c_str(), data.length(), 0);
 }
 
 bool GCloudIoTMqtt::publishState(const char* data, int length) {
-  return this->mqttClient->publish(device->getStateTopic().c_str(), data, length);
+  if (this->state_buf != NULL) {
+    return coalesceState(data, length);
+  }
+  return publishRaw(device->getStateTopicCStr(), data, length, 0);
 }
 
+// Keeps only the newest state: one equal to the last state sent is
+// dropped, and one that arrives within interval_ms of the last send
+// replaces whatever was waiting. Returns false only if it does not fit.
+bool GCloudIoTMqtt::coalesceState(const char* data, int length) {
+  uint8_t hash[SHA256_DIGEST_LENGTH];
+  Sha256Fast sha;
+
+  sha.update((const uint8_t *)data, length);
+  sha.final(hash);
+
+  if (this->state_sent && memcmp(hash, this->state_hash, sizeof(hash)) == 0) {
+    // the broker has it already, so anything still waiting is stale too
+    if (this->state_pending) {
+      this->state_pending = false;
+      this->stats.state_coalesced++;
+    }
+    this->stats.state_suppressed++;
+    return true;
+  }
+  if (length > this->bufsize) {
+    return false;
+  }
+  if (this->state_pending) {
+    this->stats.state_coalesced++;
+  }
+  memcpy(this->state_buf, data, length);
+  memcpy(this->state_pending_hash, hash, sizeof(hash));
+  this->state_len = length;
+  this->state_pending = true;
+  flushState();
+  return true;
+}
+
+// Sends the waiting state if connected and interval_ms have passed since
+// the last one. A failed send is retried from loop().
+void GCloudIoTMqtt::flushState() {
+  if (!this->mqttClient->connected() ||
+      (this->state_sent &&
+       (millis() - this->state_last_millis) < this->state_interval_ms)) {
+    return;
+  }
+  if (publishRaw(device->getStateTopicCStr(), this->state_buf, this->state_len, 0)) {
+    memcpy(this->state_hash, this->state_pending_hash, sizeof(this->state_hash));
+    this->state_sent = true;
+    this->state_pending = false;
+    this->state_last_millis = millis();
+  }
+}
+
+// Publishes on any topic, such as those of devices bound to a gateway. The
+// payload is sent as is, without the offline queue or payload signing.
+bool GCloudIoTMqtt::publishTopic(const char* topic, const char* data, int length, int qos) {
+  if (topic == NULL) {
+    return false;
+  }
+  return publishRaw(topic, data, length, qos);
+}
+
+// Blocks until the SUBACK or the timeout.
+bool GCloudIoTMqtt::subscribe(const char* topic, int qos) {
+  return topic != NULL && this->mqttClient->subscribe(topic, qos);
+}
 
 void GCloudIoTMqtt::onConnect() {
+  if (this->gateway != NULL) {
+    this->gateway->onConnect();
+  }
   if (logConnect) {
     publishState("connected");
     publishTelemetry("/events", device->getDeviceId() + String("-connected"));
   }
 }
 
+// Routes a message by its topic. Callbacks registered with the
+// GCloudIoTMessageCallback setters get the payload in place; otherwise the
+// message is copied into Strings for onMessageReceived(String&, String&).
+void GCloudIoTMqtt::onMessageReceived(const char *topic, const uint8_t *payload, size_t len) {
+  GCloudIoTMessageCallback cb;
+
+  int kind = topicKind(topic);
+
+  this->last_activity_millis = millis();
+  this->stats.bytes_received += strlen(topic) + len;
+
+  if (this->verifier != NULL &&
+      (kind == GCIOT_TOPIC_COMMANDS || kind == GCIOT_TOPIC_CONFIG)) {
+    if (len < PAYLOAD_SIG_LEN ||
+        !this->verifier->verify(payload, len - PAYLOAD_SIG_LEN,
+                                payload + len - PAYLOAD_SIG_LEN)) {
+      GCIOT_DEBUG_LOG("Dropping message on %s, bad signature\n", topic);
+      this->stats.verify_fail_count++;
+      return;
+    }
+    len -= PAYLOAD_SIG_LEN;
+  }
+
+  if (this->gateway != NULL && this->gateway->route(topic, payload, len)) {
+    return;
+  }
+
+  switch (kind) {
+    case GCIOT_TOPIC_COMMANDS:
+      cb = commandSpanCB;
+      break;
+    case GCIOT_TOPIC_CONFIG:
+      cb = configSpanCB;
+      break;
+    default:
+      cb = messageSpanCB;
+      break;
+  }
+  if (cb != NULL) {
+    cb(topic, payload, len);
+    return;
+  }
+
+  // compatibility path, String payloads end at the first zero byte
+  String topic_str = String(topic);
+  String payload_str;
+  // only len bytes are the payload: after a verified signature is cut off
+  // the signature bytes follow it, not a terminating zero
+  payload_str.reserve(len);
+  for (size_t i = 0; i < len && payload[i] != '\0'; i++) {
+    payload_str += (char)payload[i];
+  }
+  onMessageReceived(topic_str, payload_str);
+}
+
 void GCloudIoTMqtt::onMessageReceived(String &topic, String &payload) {
-  if (device->getCommandsTopic().startsWith(topic)) {
-    if (commandCB != NULL)
-      commandCB(topic, payload);
-  } else if (device->getConfigTopic().startsWith(topic)) {
-    if (configCB != NULL)
-      configCB(topic, payload);
-  } else if (messageCB != NULL) {
-	  messageCB(topic, payload);
+  switch (topicKind(topic.c_str())) {
+    case GCIOT_TOPIC_COMMANDS:
+      if (commandCB != NULL)
+        commandCB(topic, payload);
+      break;
+    case GCIOT_TOPIC_CONFIG:
+      if (configCB != NULL)
+        configCB(topic, payload);
+      break;
+    default:
+      if (messageCB != NULL)
+        messageCB(topic, payload);
+      break;
   }
 }
 
+// Matches topic against the cached device topics. Commands arrive on
+// ".../commands" or ".../commands/<subfolder>", config on ".../config".
+int GCloudIoTMqtt::topicKind(const char *topic) {
+  const char *commands = device->getCommandsTopicCStr();
+  size_t commands_len = strlen(commands);
+
+  // drop the "/#" wildcard of the subscription
+  if (commands_len >= 2) {
+    commands_len -= 2;
+  }
+  if (commands_len > 0 && strncmp(topic, commands, commands_len) == 0 &&
+      (topic[commands_len] == '\0' || topic[commands_len] == '/')) {
+    return GCIOT_TOPIC_COMMANDS;
+  }
+  if (strcmp(topic, device->getConfigTopicCStr()) == 0) {
+    return GCIOT_TOPIC_CONFIG;
+  }
+  return GCIOT_TOPIC_OTHER;
+}
+
 bool GCloudIoTMqtt::isNetworkConnected() {
   return WiFi.status() == WL_CONNECTED;
 }
@@ -265,6 +1122,65 @@ void GCloudIoTMqtt::setLogConnect(bool enabled) {
   this->logConnect = enabled;
 }
 
+void GCloudIoTMqtt::setNonceBudget(unsigned long budget_us) {
+  this->nonce_budget_us = budget_us;
+}
+
+void GCloudIoTMqtt::setJwtStepBudget(unsigned long budget_us) {
+  this->jwt_step_budget_us = budget_us;
+}
+
+unsigned long GCloudIoTMqtt::getJwtStepBudget() {
+  return this->jwt_step_budget_us;
+}
+
+// Lets the connection tune itself for mostly idle devices: JWTs get the
+// longest lifetime Cloud IoT Core accepts, so the device reconnects once a
+// day instead of every hour, the rotation moves to the first idle_ms quiet
+// spell of its last JWT_PREPARE_MS, and the keep-alive grows from the one
+// passed to setup() towards max_keepalive_sec, backing off where the
+// network drops idle connections (see updateKeepAlive()). getStats() shows
+// the values in use. Call after setup(); disabling keeps the JWT lifetime.
+void GCloudIoTMqtt::setAdaptivePolicy(bool enabled, int max_keepalive_sec,
+                                      unsigned long idle_ms) {
+  if (enabled) {
+    this->keepalive_max_sec = max_keepalive_sec > this->keepalive_min_sec ?
+                              max_keepalive_sec : this->keepalive_min_sec;
+    this->rotate_idle_ms = idle_ms;
+    device->setJwtExpSecs(GCIOT_JWT_MAX_EXP_SECS);
+  } else {
+    this->keepalive_max_sec = 0;
+    this->keepalive_sec = this->keepalive_min_sec;
+    this->keepalive_good_sec = this->keepalive_min_sec;
+    this->rotate_idle_ms = 0;
+  }
+}
+
+// Replaces the backoff policy of one failure class. Defaults: network 1 to
+// 32 s, auth the same after one immediate retry with a new JWT, server
+// unavailable 5 to 120 s and other refusals 32 to 120 s.
+void GCloudIoTMqtt::setBackoffPolicy(GCloudIoTFailure failure, uint32_t base_ms,
+                                     uint32_t cap_ms, uint8_t immediate_retries) {
+  if (failure >= GCIOT_FAIL_CLASSES) {
+    return;
+  }
+  GCloudIoTBackoffPolicy *p = &this->backoff_policy[failure];
+  p->base_ms = base_ms;
+  p->cap_ms = cap_ms > base_ms ? cap_ms : base_ms;
+  p->immediate_retries = immediate_retries;
+}
+
+// Caps the delay of every failure class at cap_ms.
+void GCloudIoTMqtt::setBackoffCap(uint32_t cap_ms) {
+  for (int i = 0; i < GCIOT_FAIL_CLASSES; i++) {
+    GCloudIoTBackoffPolicy *p = &this->backoff_policy[i];
+    p->cap_ms = cap_ms;
+    if (p->base_ms > cap_ms) {
+      p->base_ms = cap_ms;
+    }
+  }
+}
+
 void GCloudIoTMqtt::setUseLts(bool enabled) {
   this->useLts = enabled;
 }
@@ -281,14 +1197,29 @@ void GCloudIoTMqtt::setMessageCallback(MQTTClientCallbackSimple cb) {
   this->messageCB = cb;
 }
 
+void GCloudIoTMqtt::setCommandCallback(GCloudIoTMessageCallback cb) {
+  this->commandSpanCB = cb;
+}
+
+void GCloudIoTMqtt::setConfigCallback(GCloudIoTMessageCallback cb) {
+  this->configSpanCB = cb;
+}
+
+void GCloudIoTMqtt::setMessageCallback(GCloudIoTMessageCallback cb) {
+  this->messageSpanCB = cb;
+}
+
 int GCloudIoTMqtt::getLastErrorCode()
 {
+  if (this->tls_error != LWMQTT_SUCCESS) {
+    return this->tls_error;
+  }
   return this->mqttClient->lastError();
 }
 
 String GCloudIoTMqtt::getLastErrorCodeAsString()
 {
-  switch(mqttClient->lastError()) {
+  switch(getLastErrorCode()) {
     case (LWMQTT_BUFFER_TOO_SHORT):
       return String("LWMQTT_BUFFER_TOO_SHORT");
     case (LWMQTT_VARNUM_OVERFLOW):
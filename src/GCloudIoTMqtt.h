@@ -19,22 +19,159 @@
 
 #include "CloudIoTCore.h"
 #include "CloudIoTCoreDevice.h"
+#include "CloudIoTRtc.h"
 
 #include "WiFiClientSecureBearSSL.h"
 #include <MQTTClient.h>
 
+#include "crypto/sha256_fast.h"
+
+class TelemetryQueue;
+class PayloadVerifier;
+class GCloudIoTGateway;
+
+// Longest telemetry subtopic, including the leading '/'
+#ifndef GCIOT_SUBTOPIC_LEN
+#define GCIOT_SUBTOPIC_LEN 64
+#endif
+
+// Adaptive connection policy, see setAdaptivePolicy(). Cloud IoT Core
+// accepts keep-alives up to 20 minutes and JWTs valid for up to a day.
+#ifndef GCIOT_KEEPALIVE_MAX_SEC
+#define GCIOT_KEEPALIVE_MAX_SEC 1200
+#endif
+#define GCIOT_JWT_MAX_EXP_SECS 86400
+#ifndef GCIOT_ROTATE_IDLE_MS
+#define GCIOT_ROTATE_IDLE_MS 10000
+#endif
+
+// Cloud IoT Core accepts about one state update per second per device
+#ifndef GCIOT_STATE_INTERVAL_MS
+#define GCIOT_STATE_INTERVAL_MS 1000
+#endif
+
+// Reasons a connection attempt fails, each with its own backoff policy
+enum GCloudIoTFailure {
+  GCIOT_FAIL_NETWORK,  // DNS, TCP, TLS or no CONNACK: broker not reachable
+  GCIOT_FAIL_AUTH,     // CONNACK bad credentials or not authorized
+  GCIOT_FAIL_SERVER,   // CONNACK server unavailable, broker overloaded
+  GCIOT_FAIL_REJECTED, // CONNACK protocol or client id refused
+  GCIOT_FAIL_CLASSES
+};
+
+// How long to wait after a failure of one class, see setBackoffPolicy().
+// Delays use decorrelated jitter: each is random between base_ms and three
+// times the previous one, capped at cap_ms.
+struct GCloudIoTBackoffPolicy {
+  uint32_t base_ms;          // shortest delay, and the first one
+  uint32_t cap_ms;           // longest delay
+  uint8_t immediate_retries; // failures in a row retried without waiting
+};
+
 // error returned when wait backoff is not exceeded
 #define GCIOT_BACKOFF_WAIT_NOT_EXCEEDED -100
 
+// Inbound message callback that sees the payload in place, without any
+// copy. payload is only valid during the call and may not be terminated.
+typedef void (*GCloudIoTMessageCallback)(const char *topic,
+                                         const uint8_t *payload, size_t len);
+
+// Counters and timings kept by GCloudIoTMqtt, see getStats(). Times are in
+// microseconds unless noted, "last" values describe the latest event.
+struct GCloudIoTStats {
+  uint32_t jwt_count;
+  uint32_t jwt_hash_us;        // last JWT, hashing and encoding
+  uint32_t jwt_sign_us;        // last JWT, ECDSA signature
+  uint32_t tls_handshake_us;   // last TCP connect and TLS handshake
+  uint32_t mqtt_connect_us;    // last MQTT CONNECT round trip
+  uint32_t connect_count;      // successful connects
+  uint32_t connect_fail_count;
+  uint32_t reconnect_count;    // successful connects after the first
+  uint32_t backoff_ms;         // total backoff scheduled, milliseconds
+  uint32_t publish_count;
+  uint32_t publish_fail_count;
+  uint32_t publish_last_us;
+  uint32_t publish_max_us;
+  uint32_t bytes_sent;         // MQTT topic and payload bytes
+  uint32_t bytes_received;
+  uint32_t loop_count;
+  uint32_t loop_max_us;
+  uint32_t heap_min;           // lowest free heap seen by loop(), bytes
+  uint32_t sign_count;         // telemetry payloads signed
+  uint32_t sign_last_us;       // last payload, hashing and signing
+  uint32_t verify_fail_count;  // inbound messages dropped, bad signature
+  uint32_t keepalive_sec;      // keep-alive of the current connection, seconds
+  uint32_t jwt_exp_sec;        // JWT lifetime, seconds
+  uint32_t idle_rotate_count;  // JWT rotations done early on an idle link
+  uint32_t link_drop_count;    // connections lost without a disconnect()
+  uint32_t state_suppressed;   // states not sent, same as the last one sent
+  uint32_t state_coalesced;    // states replaced by a newer one before sending
+};
+
+// Steps of a connection attempt, see GCloudIoTMqtt::beginConnect()
+enum GCloudIoTConnectState {
+  GCIOT_CONN_IDLE,         // not connecting
+  GCIOT_CONN_JWT,          // waiting for a valid JWT, signed in steps
+  GCIOT_CONN_TLS,          // DNS, TCP and TLS handshake
+  GCIOT_CONN_MQTT,         // MQTT CONNECT and CONNACK
+  GCIOT_CONN_SUB_CONFIG,   // SUBSCRIBE to the config topic
+  GCIOT_CONN_SUB_COMMANDS  // SUBSCRIBE to the commands topic
+};
+
+// MQTTClient that finds its GCloudIoTMqtt again in the message callback
+class MQTTClientWithCookie : public MQTTClient {
+public:
+  MQTTClientWithCookie(int bufSize, void * cookie)
+    : MQTTClient(bufSize) { _cookie_ = cookie; }
+
+  void * _cookie_;
+};
+
+// Arena sizes, see GCloudIoTMqtt::setArena(). All of them are constant
+// expressions, so the block can be a static array whose size shows up in
+// the link map:
+//
+//   static uint8_t arena[GCIOT_ARENA_SIZE(512) + GCIOT_ARENA_SIGN_SIZE(512)]
+//       __attribute__((aligned(GCIOT_ARENA_ALIGN)));
+#define GCIOT_ARENA_ALIGN 8
+#define GCIOT_ARENA_ROUND(n) \
+  (((size_t)(n) + GCIOT_ARENA_ALIGN - 1) & ~(size_t)(GCIOT_ARENA_ALIGN - 1))
+// one allocation: a header that holds its size, then the object
+#define GCIOT_ARENA_ITEM(n) (GCIOT_ARENA_ALIGN + GCIOT_ARENA_ROUND(n))
+
+#if GCIOT_TRUST_MODE == GCIOT_TRUST_PINNED
+#define GCIOT_ARENA_TRUST_SIZE GCIOT_ARENA_ITEM(sizeof(BearSSL::PublicKey))
+#else
+#define GCIOT_ARENA_TRUST_SIZE GCIOT_ARENA_ITEM(sizeof(BearSSL::X509List))
+#endif
+
+// setup(bufsize)
+#define GCIOT_ARENA_SIZE(bufsize) \
+  (GCIOT_ARENA_ITEM(sizeof(BearSSL::WiFiClientSecure)) + \
+   GCIOT_ARENA_TRUST_SIZE + \
+   GCIOT_ARENA_ITEM(sizeof(BearSSL::Session)) + \
+   GCIOT_ARENA_ITEM(sizeof(MQTTClientWithCookie)))
+
+// setPayloadSigning(true)
+#define GCIOT_ARENA_SIGN_SIZE(bufsize) GCIOT_ARENA_ITEM(bufsize)
+
+// setStateCoalescing(true)
+#define GCIOT_ARENA_STATE_SIZE(bufsize) GCIOT_ARENA_ITEM(bufsize)
+
 class GCloudIoTMqtt {
   public:
     GCloudIoTMqtt(CloudIoTCoreDevice * device);
     virtual ~GCloudIoTMqtt();
 	
+    bool setArena(void *mem, size_t len);
+    size_t getArenaUsed();
     bool setup(int bufsize = 512, int keep_alive_sec = 180, int timeout_ms = 1000);
     void cleanup();
 
     bool connect(bool auto_reconnect = true, bool skip=false);
+    void beginConnect(bool skip = false);
+    bool connecting();
+    GCloudIoTConnectState getConnectState();
     bool connected();
     bool disconnect();
 
@@ -46,15 +183,55 @@ class GCloudIoTMqtt {
     bool publishTelemetry(String subtopic, String data);
     bool publishTelemetry(String subtopic, String data, int qos);
     bool publishTelemetry(String subtopic, const char* data, int length);
+    bool publishTelemetry(const char* subtopic, const char* data, int length);
     bool publishState(String data);
     bool publishState(const char* data, int length);
+    bool publishTopic(const char* topic, const char* data, int length, int qos = 0);
+    bool subscribe(const char* topic, int qos);
 
     void setLogConnect(bool enabled);
+    void setNonceBudget(unsigned long budget_us);
+    void setJwtStepBudget(unsigned long budget_us);
+    unsigned long getJwtStepBudget();
+    void setAdaptivePolicy(bool enabled,
+                           int max_keepalive_sec = GCIOT_KEEPALIVE_MAX_SEC,
+                           unsigned long idle_ms = GCIOT_ROTATE_IDLE_MS);
     void setUseLts(bool enabled);
+    void setSessionResumption(bool enabled);
+#if defined(ESP8266)
+    bool saveSession(uint32_t rtc_offset = GCIOT_RTC_SESSION_OFFSET);
+    bool restoreSession(uint32_t rtc_offset = GCIOT_RTC_SESSION_OFFSET);
+#endif
+#if GCIOT_HAS_RTC
+    bool saveState();
+    bool restoreState(unsigned long slept_ms);
+#endif
+    void setOfflineQueue(TelemetryQueue *queue, int drain_per_loop = 4);
+    void setBackoffPolicy(GCloudIoTFailure failure, uint32_t base_ms,
+                          uint32_t cap_ms, uint8_t immediate_retries = 0);
+    void setBackoffCap(uint32_t cap_ms);
+    bool setPayloadSigning(bool enabled);
+    bool setStateCoalescing(bool enabled,
+                            unsigned long interval_ms = GCIOT_STATE_INTERVAL_MS);
+    void setPayloadVerifier(PayloadVerifier *verifier);
+    void setGateway(GCloudIoTGateway *gateway);
+    CloudIoTCoreDevice *getDevice();
+    int getSignatureLength();
 
     void setMessageCallback(MQTTClientCallbackSimple cb);
     void setCommandCallback(MQTTClientCallbackSimple cb);
     void setConfigCallback(MQTTClientCallbackSimple cb);
+    void setMessageCallback(GCloudIoTMessageCallback cb);
+    void setCommandCallback(GCloudIoTMessageCallback cb);
+    void setConfigCallback(GCloudIoTMessageCallback cb);
+
+    GCloudIoTStats getStats();
+    void resetStats();
+    bool publishStats();
+    void setStatsInterval(unsigned long interval_ms, const char* subtopic = "/stats");
+
+    int getBufferSize();
+    int getEventsTopicLength(const char* subtopic);
 
     int getLastConnectReturnCode();
     String getLastConnectReturnCodeAsString();
@@ -63,28 +240,102 @@ class GCloudIoTMqtt {
     String getLastErrorCodeAsString();
 
     virtual void onMessageReceived(String &topic, String &payload);
+    virtual void onMessageReceived(const char *topic, const uint8_t *payload, size_t len);
     
     virtual bool isNetworkConnected();
+    virtual unsigned long nextBackoff(GCloudIoTFailure failure, int streak,
+                                      unsigned long last_ms);
 
   protected:
     void onConnect();
+    bool connectStep();
+    void connectFailed(GCloudIoTFailure failure);
+    void connectAbort();
+    GCloudIoTFailure classifyFailure();
+    bool rotationDue();
+    void updateKeepAlive();
     
     void logConfiguration(bool showJWT);
     void logError();
     void logReturnCode();
+    const char* eventsSubtopic(const char* subtopic);
+    bool publishEvents(const char* subtopic, const char* data, int length, int qos);
+    bool sendEvents(const char* subtopic, const char* data, int length, int qos);
+    bool publishRaw(const char* topic, const char* data, int length, int qos);
+    bool coalesceState(const char* data, int length);
+    void flushState();
+    void drainOfflineQueue();
+    int topicKind(const char* topic);
+    void *allocLong(size_t size);
+    void freeLong(void *p);
+    template <typename T> void destroyLong(T *&p) {
+      if (p != NULL) {
+        p->~T();
+        freeLong(p);
+        p = NULL;
+      }
+    }
 	
   private: 
+    uint8_t *arena = NULL; // caller's block for long-lived objects, see setArena()
+    size_t arena_len = 0;
+    size_t arena_used = 0;
+    int bufsize = 0; // MQTT packet buffer size passed to setup()
+    int timeout_ms = 1000; // MQTT command timeout passed to setup()
+    int keepalive_sec = 180; // keep-alive for the next CONNECT
+    int keepalive_min_sec = 180; // passed to setup(), the policy never goes lower
+    int keepalive_max_sec = 0; // policy ceiling, lowered on drops; 0 = policy off
+    int keepalive_good_sec = 0; // longest keep-alive a connection survived
+    int conn_keepalive_sec = 0; // keep-alive of the current connection
+    unsigned long rotate_idle_ms = 0; // idle time that allows an early rotation, 0 = off
+    unsigned long last_activity_millis = 0; // last publish sent or message received
+    unsigned long link_up_millis = 0;
+    bool link_up = false; // connected, and not closed by us since
+    bool conn_rotate = false; // the attempt has to switch to a new JWT
+    const char *host = NULL; // MQTT bridge passed to begin()
+    GCloudIoTStats stats = {};
+    unsigned long stats_interval_ms = 0; // 0 = stats are not published
+    unsigned long stats_last_millis = 0;
+    const char *stats_subtopic = NULL;
     int backoff_ms = 0; // current backoff, milliseconds
+    GCloudIoTBackoffPolicy backoff_policy[GCIOT_FAIL_CLASSES];
+    GCloudIoTFailure fail_class = GCIOT_FAIL_NETWORK; // of the last failure
+    int fail_streak = 0; // failures of fail_class in a row
     unsigned long backoff_until_millis = 0; // time to wait to until next attempt
     bool logConnect = true;
     bool useLts = true;
+    bool useSessions = true; // resume TLS sessions on reconnect
     bool autoReconnect = false;
+    GCloudIoTConnectState conn_state = GCIOT_CONN_IDLE;
+    bool conn_skip = false; // the attempt reuses an open network connection
+    lwmqtt_err_t tls_error = LWMQTT_SUCCESS; // set when the TLS step failed, until the next CONNECT
+    unsigned long nonce_budget_us = 0; // time per loop() for signing nonces, 0 = off
+    unsigned long jwt_step_budget_us = 2000; // time per loop() for the next JWT, 0 = off
+    TelemetryQueue *offlineQueue = NULL;
+    int queue_drain_per_loop = 4;
+    char *sign_buf = NULL; // payload and signature when signing telemetry
+    PayloadVerifier *verifier = NULL; // checks config and commands if set
+    GCloudIoTGateway *gateway = NULL; // attaches and routes bound devices if set
+    char *state_buf = NULL; // latest state not sent yet, when coalescing
+    int state_len = 0;
+    bool state_pending = false; // state_buf holds a state to send
+    bool state_sent = false; // state_hash is valid
+    unsigned long state_interval_ms = 0;
+    unsigned long state_last_millis = 0;
+    uint8_t state_hash[SHA256_DIGEST_LENGTH]; // of the last state sent
+    uint8_t state_pending_hash[SHA256_DIGEST_LENGTH];
     MQTTClient * mqttClient = NULL;
     BearSSL::X509List * certList = NULL;
+    BearSSL::PublicKey * pinnedKey = NULL;
     BearSSL::WiFiClientSecure * netClient = NULL;
+    BearSSL::Session * session = NULL;
     CloudIoTCoreDevice *device = NULL;
+    char topic_buf[CLOUDIOT_TOPIC_LEN + GCIOT_SUBTOPIC_LEN]; // events topic + subtopic
     MQTTClientCallbackSimple commandCB = NULL;
     MQTTClientCallbackSimple configCB = NULL;
     MQTTClientCallbackSimple messageCB = NULL;
+    GCloudIoTMessageCallback commandSpanCB = NULL;
+    GCloudIoTMessageCallback configSpanCB = NULL;
+    GCloudIoTMessageCallback messageSpanCB = NULL;
 };
 #endif // __CLOUDIOTCORE_MQTT_H__
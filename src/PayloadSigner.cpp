@@ -0,0 +1,103 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#include "PayloadSigner.h"
+
+#include "CloudIoTCore.h"
+#include "crypto/ecdsa_fast.h"
+#include "crypto/nn.h"
+
+#define PAYLOAD_COORD_LEN (KEYDIGITS * NN_DIGIT_LEN)
+
+PayloadSigner::PayloadSigner(JwtSigningContext &ctx) : ctx(&ctx) {}
+
+void PayloadSigner::update(const uint8_t* data, size_t len) {
+  this->sha.update(data, len);
+}
+
+void PayloadSigner::final(uint8_t sig[PAYLOAD_SIG_LEN]) {
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  NN_DIGIT r[NUMWORDS], s[NUMWORDS];
+
+  this->sha.final(digest);
+  this->ctx->sign(digest, r, s);
+  NN_Encode(sig, PAYLOAD_COORD_LEN, r, (NN_UINT)KEYDIGITS);
+  NN_Encode(sig + PAYLOAD_COORD_LEN, PAYLOAD_COORD_LEN, s, (NN_UINT)KEYDIGITS);
+}
+
+void SignPayload(const uint8_t* payload, size_t len, JwtSigningContext &ctx,
+                 uint8_t sig[PAYLOAD_SIG_LEN]) {
+  PayloadSigner signer(ctx);
+  signer.update(payload, len);
+  signer.final(sig);
+}
+
+void PayloadVerifier::setKey(const uint8_t pub_key[2 * PAYLOAD_COORD_LEN]) {
+  point_t Q;
+
+  // the table is the expensive part, keep it while the key stays the same
+  if (this->ready && memcmp(this->key, pub_key, sizeof(this->key)) == 0) {
+    return;
+  }
+  memcpy(this->key, pub_key, sizeof(this->key));
+
+  // verification needs the curve and the order, not the signing key
+  InitEcc();
+
+  NN_Decode(Q.x, NUMWORDS, (unsigned char *)pub_key, PAYLOAD_COORD_LEN);
+  NN_Decode(Q.y, NUMWORDS, (unsigned char *)pub_key + PAYLOAD_COORD_LEN,
+            PAYLOAD_COORD_LEN);
+  ecc_win_precompute(&Q, this->table);
+  this->ready = true;
+}
+
+bool PayloadVerifier::setKey(const char* pub_key) {
+  uint8_t bytes[2 * PAYLOAD_COORD_LEN];
+  size_t n = strlen(pub_key);
+
+  // 65 bytes with the 04 prefix take 194 characters, 64 bytes 191
+  if (n == 194 && strncmp(pub_key, "04:", 3) == 0) {
+    pub_key += 3;
+  } else if (n != 191) {
+    GCIOT_DEBUG_LOG("Warning: expected public key to be 194, was: %d", (int)n);
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(bytes); i++) {
+    bytes[i] = (uint8_t)strtoul(pub_key, NULL, 16);
+    pub_key += 3;
+  }
+  setKey(bytes);
+  return true;
+}
+
+bool PayloadVerifier::isReady() {
+  return this->ready;
+}
+
+bool PayloadVerifier::verify(const uint8_t* payload, size_t len,
+                             const uint8_t sig[PAYLOAD_SIG_LEN]) {
+  Sha256Fast sha;
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  NN_DIGIT r[NUMWORDS], s[NUMWORDS];
+
+  if (!this->ready) {
+    return false;
+  }
+  sha.update(payload, len);
+  sha.final(digest);
+  NN_Decode(r, NUMWORDS, (unsigned char *)sig, PAYLOAD_COORD_LEN);
+  NN_Decode(s, NUMWORDS, (unsigned char *)sig + PAYLOAD_COORD_LEN,
+            PAYLOAD_COORD_LEN);
+  return ecdsa_fast_verify(digest, r, s, this->table) == 1;
+}
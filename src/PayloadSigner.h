@@ -0,0 +1,71 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#ifndef PAYLOAD_SIGNER_H
+#define PAYLOAD_SIGNER_H
+
+#include <Arduino.h>
+
+#include "crypto/ecc.h"
+#include "crypto/sha256_fast.h"
+#include "jwt.h"
+
+// ES256 signature of a payload: r and s, 32 bytes big endian each, the
+// same encoding the JWT signature uses before base64url.
+#define PAYLOAD_SIG_LEN 64
+
+// Streaming ES256 signature over a payload with the device key. The hash
+// starts when the signer is constructed; final() signs with a nonce from
+// the context's pool when one is ready, so signing every message costs
+// one SHA-256 pass and a few modular multiplies as long as
+// precomputeNonces() keeps up.
+class PayloadSigner {
+ public:
+  PayloadSigner(JwtSigningContext &ctx);
+
+  void update(const uint8_t* data, size_t len);
+  void final(uint8_t sig[PAYLOAD_SIG_LEN]);
+
+ private:
+  JwtSigningContext *ctx;
+  Sha256Fast sha;
+};
+
+// Checks ES256 signatures made with one public key, typically the
+// server's. setKey() builds the key's window table once, so verify() only
+// pays for the hash and the two scalar multiplications; the base point
+// half uses the shared base table (the comb on ESP8266/ESP32).
+class PayloadVerifier {
+ public:
+  // Uncompressed point, x then y, 32 bytes big endian each
+  void setKey(const uint8_t pub_key[2 * KEYDIGITS * NN_DIGIT_LEN]);
+  // Same as hex bytes separated by ':', as printed by
+  // "openssl ec -pubout -text", with or without the leading 04
+  bool setKey(const char* pub_key);
+  bool isReady();
+
+  bool verify(const uint8_t* payload, size_t len,
+              const uint8_t sig[PAYLOAD_SIG_LEN]);
+
+ private:
+  point_t table[NUM_POINTS];
+  uint8_t key[2 * KEYDIGITS * NN_DIGIT_LEN];
+  bool ready = false;
+};
+
+// One shot signature of payload
+void SignPayload(const uint8_t* payload, size_t len, JwtSigningContext &ctx,
+                 uint8_t sig[PAYLOAD_SIG_LEN]);
+
+#endif  // PAYLOAD_SIGNER_H
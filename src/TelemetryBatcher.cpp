@@ -0,0 +1,142 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#include "TelemetryBatcher.h"
+
+TelemetryBatcher::TelemetryBatcher(GCloudIoTMqtt *mqtt) {
+  this->mqtt = mqtt;
+}
+
+TelemetryBatcher::~TelemetryBatcher() {
+  cleanup();
+}
+
+bool TelemetryBatcher::setup(int framing, int max_samples,
+                             unsigned long max_latency_ms, const char* subtopic) {
+  cleanup();
+
+  this->framing = framing;
+  this->max_samples = max_samples;
+  this->max_latency_ms = max_latency_ms;
+  this->subtopic = subtopic;
+
+  this->capacity = mqtt->getBufferSize() - GCIOT_PUBLISH_OVERHEAD -
+                   mqtt->getEventsTopicLength(subtopic) -
+                   mqtt->getSignatureLength();
+  if (this->capacity <= 0) {
+    GCIOT_DEBUG_LOG("batcher: MQTT buffer too small for the topic\n");
+    this->capacity = 0;
+    return false;
+  }
+  this->buf = new char[this->capacity];
+  return true;
+}
+
+void TelemetryBatcher::cleanup() {
+  if (this->buf != NULL) {
+    delete[] this->buf;
+    this->buf = NULL;
+  }
+  this->capacity = 0;
+  this->length = 0;
+  this->samples = 0;
+}
+
+// Queues a sample. Returns false if it was dropped because the batch it
+// displaced could not be published.
+bool TelemetryBatcher::add(const char* data, int length) {
+  int framed = length + (framing == GCIOT_BATCH_LENGTH ? 2 : 1);
+
+  if (this->buf == NULL) {
+    return publish(data, length);
+  }
+
+  if (framed > this->capacity ||
+      (framing == GCIOT_BATCH_LENGTH && length > 0xffff)) {
+    // too big to batch at all, keep the order and send it on its own
+    if (!flush()) {
+      return false;
+    }
+    return publish(data, length);
+  }
+  if (this->length + framed > this->capacity && !flush()) {
+    return false;
+  }
+
+  if (this->samples == 0) {
+    this->first_sample_millis = millis();
+  }
+  if (framing == GCIOT_BATCH_LENGTH) {
+    this->buf[this->length++] = (char)(length >> 8);
+    this->buf[this->length++] = (char)length;
+  } else if (this->samples > 0) {
+    this->buf[this->length++] = '\n';
+  }
+  memcpy(this->buf + this->length, data, length);
+  this->length += length;
+  this->samples++;
+
+  if (this->max_samples > 0 && this->samples >= this->max_samples) {
+    flush();
+  }
+  return true;
+}
+
+bool TelemetryBatcher::add(String data) {
+  return add(data.c_str(), data.length());
+}
+
+// Publishes the queued samples, or hands them to the offline queue of
+// GCloudIoTMqtt while disconnected. On failure they stay queued.
+bool TelemetryBatcher::flush() {
+  if (this->samples == 0) {
+    return true;
+  }
+  if (!publish(this->buf, this->length)) {
+    return false;
+  }
+  this->length = 0;
+  this->samples = 0;
+  return true;
+}
+
+// Sends the batch once its oldest sample is max_latency_ms old. Call this
+// along with GCloudIoTMqtt::loop().
+void TelemetryBatcher::loop() {
+  if (this->samples > 0 && this->max_latency_ms > 0 &&
+      (millis() - this->first_sample_millis) >= this->max_latency_ms) {
+    flush();
+  }
+}
+
+int TelemetryBatcher::getSampleCount() {
+  return this->samples;
+}
+
+int TelemetryBatcher::getLength() {
+  return this->length;
+}
+
+int TelemetryBatcher::getCapacity() {
+  return this->capacity;
+}
+
+// Goes through publishTelemetry() even while offline, so that a batch taken
+// by the offline queue counts as flushed.
+bool TelemetryBatcher::publish(const char* data, int length) {
+  if (this->subtopic != NULL) {
+    return mqtt->publishTelemetry(this->subtopic, data, length);
+  }
+  return mqtt->publishTelemetry(data, length);
+}
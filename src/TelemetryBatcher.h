@@ -0,0 +1,68 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#ifndef TELEMETRY_BATCHER_H
+#define TELEMETRY_BATCHER_H
+
+#include <Arduino.h>
+
+#include "GCloudIoTMqtt.h"
+
+// Sample framing inside a batch
+#define GCIOT_BATCH_NEWLINE 0 // samples separated by '\n'
+#define GCIOT_BATCH_LENGTH  1 // each sample prefixed by a 2 byte big endian length
+
+// Bytes lwmqtt needs around the payload: fixed header, topic length and
+// packet id.
+#define GCIOT_PUBLISH_OVERHEAD 9
+
+// Packs telemetry samples into one payload so a single PUBLISH (and TLS
+// record) carries many of them. A batch is sent when the next sample would
+// not fit the MQTT buffer, when max_samples are queued, or from loop() once
+// the oldest sample is max_latency_ms old.
+class TelemetryBatcher {
+  public:
+    TelemetryBatcher(GCloudIoTMqtt *mqtt);
+    virtual ~TelemetryBatcher();
+
+    // Call after GCloudIoTMqtt::setup(); the batch is sized to its bufsize.
+    // subtopic is optional and must stay valid while the batcher is used.
+    bool setup(int framing = GCIOT_BATCH_NEWLINE, int max_samples = 0,
+               unsigned long max_latency_ms = 1000, const char* subtopic = NULL);
+    void cleanup();
+
+    bool add(const char* data, int length);
+    bool add(String data);
+    bool flush();
+    void loop();
+
+    int getSampleCount();
+    int getLength();
+    int getCapacity();
+
+  private:
+    GCloudIoTMqtt *mqtt = NULL;
+    const char *subtopic = NULL;
+    char *buf = NULL;
+    int capacity = 0;
+    int length = 0;
+    int samples = 0;
+    int framing = GCIOT_BATCH_NEWLINE;
+    int max_samples = 0; // 0 = only limited by capacity
+    unsigned long max_latency_ms = 0; // 0 = no time based flush
+    unsigned long first_sample_millis = 0;
+
+    bool publish(const char* data, int length);
+};
+#endif // TELEMETRY_BATCHER_H
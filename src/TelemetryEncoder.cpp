@@ -0,0 +1,275 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#include "TelemetryEncoder.h"
+
+// Bounded writer over the output buffer; once a byte does not fit the
+// frame is abandoned.
+struct FrameWriter {
+  uint8_t *out;
+  int cap;
+  int len;
+  bool overflow;
+};
+
+static void frame_put(FrameWriter *w, uint8_t b) {
+  if (w->len >= w->cap) {
+    w->overflow = true;
+    return;
+  }
+  w->out[w->len++] = b;
+}
+
+static void frame_put_be(FrameWriter *w, uint32_t v, int n) {
+  while (n--) {
+    frame_put(w, (uint8_t)(v >> (8 * n)));
+  }
+}
+
+static void frame_put_varint(FrameWriter *w, uint32_t v) {
+  while (v >= 0x80) {
+    frame_put(w, (uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  frame_put(w, (uint8_t)v);
+}
+
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+// CBOR head: major type and argument in the shortest form.
+static void cbor_put_head(FrameWriter *w, uint8_t major, uint32_t v) {
+  major <<= 5;
+  if (v < 24) {
+    frame_put(w, major | (uint8_t)v);
+  } else if (v <= 0xff) {
+    frame_put(w, major | 24);
+    frame_put(w, (uint8_t)v);
+  } else if (v <= 0xffff) {
+    frame_put(w, major | 25);
+    frame_put_be(w, v, 2);
+  } else {
+    frame_put(w, major | 26);
+    frame_put_be(w, v, 4);
+  }
+}
+
+static bool is_signed(uint8_t type) {
+  return type == GCIOT_FIELD_I8 || type == GCIOT_FIELD_I16 ||
+         type == GCIOT_FIELD_I32;
+}
+
+// Loads an integer field widened to 32 bits; unsigned values keep their bit
+// pattern. memcpy keeps packed structs safe on cores that fault on
+// unaligned loads.
+static int32_t load_int(const uint8_t *p, uint8_t type) {
+  switch (type) {
+    case GCIOT_FIELD_BOOL:
+      return *p ? 1 : 0;
+    case GCIOT_FIELD_U8:
+      return *p;
+    case GCIOT_FIELD_I8:
+      return (int8_t)*p;
+    case GCIOT_FIELD_U16: {
+      uint16_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    case GCIOT_FIELD_I16: {
+      int16_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+    default: {
+      int32_t v;
+      memcpy(&v, p, sizeof(v));
+      return v;
+    }
+  }
+}
+
+static uint32_t load_float_bits(const uint8_t *p) {
+  float f;
+  uint32_t bits;
+  memcpy(&f, p, sizeof(f));
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+TelemetryEncoder::TelemetryEncoder(const GCloudIoTField *fields, int count,
+                                   int format, uint8_t schema_id) {
+  if (count > GCIOT_ENCODE_MAX_FIELDS) {
+    GCIOT_DEBUG_LOG("encoder: schema truncated to %d fields\n",
+                    GCIOT_ENCODE_MAX_FIELDS);
+    count = GCIOT_ENCODE_MAX_FIELDS;
+  }
+  this->fields = fields;
+  this->count = count;
+  this->format = format;
+  this->schema_id = schema_id;
+  memset(this->last, 0, sizeof(this->last));
+}
+
+TelemetryEncoder::~TelemetryEncoder() {}
+
+void TelemetryEncoder::setKeyframeInterval(int frames) {
+  this->keyframe_interval = frames;
+}
+
+void TelemetryEncoder::reset() {
+  this->need_key = true;
+}
+
+int TelemetryEncoder::encode(const void *sample, uint8_t *out, int cap) {
+  if (format == GCIOT_ENCODE_BINARY) {
+    return encodeBinary(sample, out, cap);
+  }
+  return encodeCbor(sample, out, cap);
+}
+
+// Worst case frame size, e.g. for sizing a buffer or checking the schema
+// against the MQTT buffer once at startup.
+int TelemetryEncoder::getMaxLength() {
+  int len;
+  if (format == GCIOT_ENCODE_BINARY) {
+    len = 2;
+    for (int i = 0; i < count; i++) {
+      uint8_t type = fields[i].type;
+      if (type == GCIOT_FIELD_BOOL) {
+        len += 1;
+      } else if (type == GCIOT_FIELD_FLOAT) {
+        len += 4;
+      } else if (fields[i].flags & GCIOT_FLAG_DELTA) {
+        len += 5; // a wrapped delta may need the full 32 bit range
+      } else if (type == GCIOT_FIELD_U8 || type == GCIOT_FIELD_I8) {
+        len += 2;
+      } else if (type == GCIOT_FIELD_U16 || type == GCIOT_FIELD_I16) {
+        len += 3;
+      } else {
+        len += 5;
+      }
+    }
+  } else {
+    len = count < 24 ? 1 : 2;
+    for (int i = 0; i < count; i++) {
+      int klen = strlen(fields[i].name);
+      len += klen + (klen < 24 ? 1 : klen <= 0xff ? 2 : 3);
+      switch (fields[i].type) {
+        case GCIOT_FIELD_BOOL: len += 1; break;
+        case GCIOT_FIELD_U8: case GCIOT_FIELD_I8: len += 2; break;
+        case GCIOT_FIELD_U16: case GCIOT_FIELD_I16: len += 3; break;
+        default: len += 5; break;
+      }
+    }
+  }
+  return len;
+}
+
+int TelemetryEncoder::encodeCbor(const void *sample, uint8_t *out, int cap) {
+  const uint8_t *base = (const uint8_t *)sample;
+  FrameWriter w = { out, cap, 0, false };
+
+  cbor_put_head(&w, 5, count); // map
+  for (int i = 0; i < count; i++) {
+    const GCloudIoTField *f = &fields[i];
+    const uint8_t *p = base + f->offset;
+    size_t klen = strlen(f->name);
+
+    cbor_put_head(&w, 3, klen); // text string key
+    for (size_t j = 0; j < klen; j++) {
+      frame_put(&w, (uint8_t)f->name[j]);
+    }
+
+    if (f->type == GCIOT_FIELD_FLOAT) {
+      frame_put(&w, 0xfa); // single precision float
+      frame_put_be(&w, load_float_bits(p), 4);
+    } else if (f->type == GCIOT_FIELD_BOOL) {
+      frame_put(&w, *p ? 0xf5 : 0xf4);
+    } else {
+      int32_t v = load_int(p, f->type);
+      if (is_signed(f->type) && v < 0) {
+        cbor_put_head(&w, 1, (uint32_t)(-1 - v)); // negative integer
+      } else {
+        cbor_put_head(&w, 0, (uint32_t)v);
+      }
+    }
+  }
+  return w.overflow ? 0 : w.len;
+}
+
+int TelemetryEncoder::encodeBinary(const void *sample, uint8_t *out, int cap) {
+  const uint8_t *base = (const uint8_t *)sample;
+  FrameWriter w = { out, cap, 0, false };
+  bool key = need_key || (keyframe_interval > 0 && since_key >= keyframe_interval);
+  int32_t next[GCIOT_ENCODE_MAX_FIELDS];
+
+  frame_put(&w, schema_id);
+  frame_put(&w, (key ? GCIOT_FRAME_KEY : 0) | (seq & 0x7f));
+  for (int i = 0; i < count; i++) {
+    const GCloudIoTField *f = &fields[i];
+    const uint8_t *p = base + f->offset;
+
+    next[i] = 0; // floats and bools are always sent whole
+    if (f->type == GCIOT_FIELD_FLOAT) {
+      frame_put_be(&w, load_float_bits(p), 4);
+      continue;
+    }
+    if (f->type == GCIOT_FIELD_BOOL) {
+      frame_put(&w, *p ? 1 : 0);
+      continue;
+    }
+
+    int32_t v = load_int(p, f->type);
+    next[i] = v;
+    if (!key && (f->flags & GCIOT_FLAG_DELTA)) {
+      // wraps modulo 2^32 so unsigned counters roll over cleanly
+      frame_put_varint(&w, zigzag((int32_t)((uint32_t)v - (uint32_t)last[i])));
+    } else if (is_signed(f->type)) {
+      frame_put_varint(&w, zigzag(v));
+    } else {
+      frame_put_varint(&w, (uint32_t)v);
+    }
+  }
+
+  if (w.overflow) {
+    return 0;
+  }
+  // only a frame that was produced moves the delta reference forward
+  for (int i = 0; i < count; i++) {
+    if (fields[i].flags & GCIOT_FLAG_DELTA) {
+      last[i] = next[i];
+    }
+  }
+  seq++;
+  since_key = key ? 1 : since_key + 1;
+  need_key = false;
+  return w.len;
+}
+
+bool TelemetryEncoder::publish(GCloudIoTMqtt *mqtt, const void *sample,
+                               const char *subtopic) {
+  uint8_t buf[GCIOT_ENCODE_MAX_LEN];
+  int len = encode(sample, buf, sizeof(buf));
+  if (len == 0) {
+    GCIOT_DEBUG_LOG("encoder: frame larger than %d bytes\n", GCIOT_ENCODE_MAX_LEN);
+    return false;
+  }
+  if (!mqtt->publishTelemetry(subtopic, (const char *)buf, len)) {
+    // the receiver never saw this frame, so restart from absolute values
+    reset();
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,120 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#ifndef TELEMETRY_ENCODER_H
+#define TELEMETRY_ENCODER_H
+
+#include <Arduino.h>
+#include <stddef.h>
+
+#include "GCloudIoTMqtt.h"
+
+// Field types a schema can describe
+#define GCIOT_FIELD_BOOL   0
+#define GCIOT_FIELD_U8     1
+#define GCIOT_FIELD_I8     2
+#define GCIOT_FIELD_U16    3
+#define GCIOT_FIELD_I16    4
+#define GCIOT_FIELD_U32    5
+#define GCIOT_FIELD_I32    6
+#define GCIOT_FIELD_FLOAT  7
+
+// Field flags
+#define GCIOT_FLAG_DELTA   0x01 // binary frames send the change since the last sample
+
+// Frame formats
+#define GCIOT_ENCODE_CBOR   0 // self describing CBOR map keyed by field name
+#define GCIOT_ENCODE_BINARY 1 // schema id, header and values in schema order
+
+// Binary frame header byte: set on frames that carry absolute values.
+#define GCIOT_FRAME_KEY 0x80
+
+// Upper bound on the stack buffer publish() encodes into.
+#ifndef GCIOT_ENCODE_MAX_LEN
+#define GCIOT_ENCODE_MAX_LEN 256
+#endif
+
+#define GCIOT_ENCODE_MAX_FIELDS 32
+
+// One member of a fixed sample struct. Schemas are static const arrays, so
+// they live in flash and cost nothing per sample:
+//
+//   struct Sample { float temp; uint16_t lux; uint32_t uptime; };
+//   static const GCloudIoTField sample_schema[] = {
+//     GCIOT_FIELD(Sample, temp, GCIOT_FIELD_FLOAT),
+//     GCIOT_FIELD(Sample, lux, GCIOT_FIELD_U16),
+//     GCIOT_DELTA_FIELD(Sample, uptime, GCIOT_FIELD_U32),
+//   };
+//   TelemetryEncoder enc(sample_schema, 3, GCIOT_ENCODE_BINARY, 1);
+//   enc.publish(&mqtt, &sample);
+struct GCloudIoTField {
+  const char *name;
+  uint16_t offset;
+  uint8_t type;
+  uint8_t flags;
+};
+
+#define GCIOT_FIELD(S, member, type) \
+  { #member, (uint16_t)offsetof(S, member), type, 0 }
+#define GCIOT_DELTA_FIELD(S, member, type) \
+  { #member, (uint16_t)offsetof(S, member), type, GCIOT_FLAG_DELTA }
+
+// Serialises a sample struct described by a schema (at most
+// GCIOT_ENCODE_MAX_FIELDS fields) straight into a caller buffer, without
+// building any String.
+//
+// CBOR frames are a map of field name to value and need no schema on the
+// receiving side. Binary frames are a schema id byte, a header byte (the
+// GCIOT_FRAME_KEY bit and a 7 bit sequence number) and then every field in
+// schema order: integers as LEB128 varints (zigzag for signed types), floats
+// as 4 byte big endian IEEE 754 and bools as one byte. On frames without
+// GCIOT_FRAME_KEY, GCIOT_FLAG_DELTA fields hold the zigzag varint of the
+// change since the previous frame instead. A key frame is sent first, every
+// keyframe_interval frames and after reset(), so a lost QoS 0 message only
+// corrupts deltas until the next one; the sequence number shows the gap.
+class TelemetryEncoder {
+  public:
+    TelemetryEncoder(const GCloudIoTField *fields, int count,
+                     int format = GCIOT_ENCODE_CBOR, uint8_t schema_id = 0);
+    virtual ~TelemetryEncoder();
+
+    // 0 disables periodic key frames.
+    void setKeyframeInterval(int frames);
+    // Makes the next binary frame a key frame.
+    void reset();
+
+    // Returns the frame length, or 0 if it does not fit in cap. A frame that
+    // does not fit leaves the delta state untouched.
+    int encode(const void *sample, uint8_t *out, int cap);
+    int getMaxLength();
+
+    // Encodes into a stack buffer and sends it with publishTelemetry().
+    bool publish(GCloudIoTMqtt *mqtt, const void *sample,
+                 const char *subtopic = NULL);
+
+  private:
+    const GCloudIoTField *fields;
+    int count;
+    int format;
+    uint8_t schema_id;
+    uint8_t seq = 0;
+    int keyframe_interval = 16;
+    int since_key = 0;
+    bool need_key = true;
+    int32_t last[GCIOT_ENCODE_MAX_FIELDS];
+
+    int encodeCbor(const void *sample, uint8_t *out, int cap);
+    int encodeBinary(const void *sample, uint8_t *out, int cap);
+};
+#endif // TELEMETRY_ENCODER_H
@@ -0,0 +1,314 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#include "TelemetryQueue.h"
+#include "CloudIoTCore.h"
+
+#define QUEUE_PATH_LEN    48
+#define QUEUE_SEG_HEADER  4 // sequence number
+#define QUEUE_REC_HEADER  3 // subtopic length, data length
+
+TelemetryQueue::TelemetryQueue(fs::FS &fs, const char *dir, int segments,
+                               int segment_size) {
+  this->fs = &fs;
+  this->dir = dir;
+  this->segments = segments;
+  this->segment_size = segment_size;
+}
+
+TelemetryQueue::~TelemetryQueue() {
+  if (this->record != NULL) {
+    delete[] this->record;
+    this->record = NULL;
+  }
+}
+
+void TelemetryQueue::segmentPath(char *path, uint32_t seq) {
+  snprintf(path, QUEUE_PATH_LEN, "%s/%u", dir, (unsigned)(seq % segments));
+}
+
+bool TelemetryQueue::begin(int max_record) {
+  char path[QUEUE_PATH_LEN];
+  bool found = false;
+  bool torn = false;
+
+  if (this->record != NULL) {
+    delete[] this->record;
+  }
+  this->max_record = max_record;
+  this->record = new char[max_record + 1]; // room for the subtopic's zero
+  this->peeked = false;
+  fs->mkdir(dir);
+
+  // the oldest and newest segment left over become head and tail
+  for (int i = 0; i < segments; i++) {
+    snprintf(path, QUEUE_PATH_LEN, "%s/%d", dir, i);
+    if (!fs->exists(path)) {
+      continue;
+    }
+    fs::File f = fs->open(path, "r");
+    uint32_t seq;
+    if (!f || f.read((uint8_t *)&seq, sizeof(seq)) != sizeof(seq) ||
+        seq % segments != (uint32_t)i) {
+      if (f) {
+        f.close();
+      }
+      fs->remove(path);
+      continue;
+    }
+    if (!found || seq < head_seq) {
+      head_seq = seq;
+    }
+    if (!found || seq >= tail_seq) {
+      tail_seq = seq;
+      tail_size = recordsEnd(f);
+      torn = tail_size < (int)f.size();
+    }
+    found = true;
+    f.close();
+  }
+  head_off = QUEUE_SEG_HEADER;
+  if (torn) {
+    // a reset cut the last push() short. fs::File cannot truncate, so the
+    // partial record stays behind, where peek() skips it, and appending
+    // continues in a new segment.
+    GCIOT_DEBUG_LOG("queue: partial record in segment %u\n", (unsigned)tail_seq);
+    tail_seq++;
+    tail_size = 0;
+  }
+
+  // the read position saved by the last sync()
+  uint32_t cursor[2];
+  bool has_cursor = false;
+  snprintf(path, QUEUE_PATH_LEN, "%s/c", dir);
+  fs::File c = fs->open(path, "r");
+  if (c) {
+    has_cursor = c.read((uint8_t *)cursor, sizeof(cursor)) == sizeof(cursor);
+    c.close();
+  }
+
+  if (!found) {
+    // drained; number on past the cursor so it can never match a new
+    // segment, and drop it
+    head_seq = tail_seq = has_cursor ? cursor[0] + 1 : 0;
+    tail_size = 0;
+    fs->remove(path);
+    return true;
+  }
+
+  // resume where the last sync() left off
+  if (has_cursor && cursor[0] >= head_seq && cursor[0] <= tail_seq) {
+    while (head_seq < cursor[0]) {
+      dropHead();
+    }
+    if (cursor[1] > QUEUE_SEG_HEADER && headHasSeq(cursor[0])) {
+      head_off = cursor[1];
+    }
+  }
+  GCIOT_DEBUG_LOG("queue: recovered segments %u..%u\n", (unsigned)head_seq,
+                  (unsigned)tail_seq);
+  return true;
+}
+
+// End of the last complete record in segment f, past which nothing may be
+// appended.
+int TelemetryQueue::recordsEnd(fs::File &f) {
+  uint8_t header[QUEUE_REC_HEADER];
+  int size = f.size();
+  int off = QUEUE_SEG_HEADER;
+
+  while (off + QUEUE_REC_HEADER <= size) {
+    f.seek(off);
+    if (f.read(header, sizeof(header)) != sizeof(header)) {
+      break;
+    }
+    int rec = QUEUE_REC_HEADER + header[0] + (header[1] | (header[2] << 8));
+    if (off + rec > size) {
+      break;
+    }
+    off += rec;
+  }
+  return off;
+}
+
+// Appends a record. When the ring is full the oldest segment is dropped to
+// make room.
+bool TelemetryQueue::push(const char *subtopic, const char *data, int length) {
+  char path[QUEUE_PATH_LEN];
+  int sub_len = subtopic != NULL ? strlen(subtopic) : 0;
+  int rec = QUEUE_REC_HEADER + sub_len + length;
+  uint8_t header[QUEUE_REC_HEADER];
+
+  if (sub_len > 0xff || length > 0xffff || rec > max_record ||
+      rec > segment_size - QUEUE_SEG_HEADER) {
+    return false;
+  }
+
+  if (tail_size > 0 && tail_size + rec > segment_size) {
+    tail_seq++;
+    tail_size = 0;
+  }
+  segmentPath(path, tail_seq);
+  if (tail_size == 0) {
+    if (tail_seq - head_seq >= (uint32_t)segments) {
+      GCIOT_DEBUG_LOG("queue: full, dropping oldest segment\n");
+      dropHead();
+    }
+    fs::File f = fs->open(path, "w");
+    if (!f || f.write((const uint8_t *)&tail_seq, sizeof(tail_seq)) != sizeof(tail_seq)) {
+      return false;
+    }
+    f.close();
+    tail_size = QUEUE_SEG_HEADER;
+  }
+
+  fs::File f = fs->open(path, "a");
+  if (!f) {
+    return false;
+  }
+  header[0] = (uint8_t)sub_len;
+  header[1] = (uint8_t)length;
+  header[2] = (uint8_t)(length >> 8);
+  bool ok = f.write(header, sizeof(header)) == sizeof(header) &&
+            f.write((const uint8_t *)subtopic, sub_len) == (size_t)sub_len &&
+            f.write((const uint8_t *)data, length) == (size_t)length;
+  f.close();
+  if (ok) {
+    tail_size += rec;
+  }
+  return ok;
+}
+
+// Reads the oldest record into RAM. subtopic is zero terminated, data is
+// not. Both stay valid until pop().
+bool TelemetryQueue::peek(const char **subtopic, const char **data, int *length) {
+  char path[QUEUE_PATH_LEN];
+  uint8_t header[QUEUE_REC_HEADER];
+
+  while (!peeked) {
+    if (isEmpty()) {
+      return false;
+    }
+    segmentPath(path, head_seq);
+    fs::File f = fs->open(path, "r");
+    int size = f ? (int)f.size() : 0;
+    if (head_seq == tail_seq) {
+      size = tail_size;
+    }
+    if (head_off + QUEUE_REC_HEADER > size) {
+      // finished, or cut short by a reset during a write
+      if (f) {
+        f.close();
+      }
+      if (head_seq == tail_seq) {
+        tail_size = head_off;
+        return false;
+      }
+      dropHead();
+      continue;
+    }
+
+    f.seek(head_off);
+    f.read(header, sizeof(header));
+    int sub_len = header[0];
+    int len = header[1] | (header[2] << 8);
+    int rec = QUEUE_REC_HEADER + sub_len + len;
+    if (rec > max_record || head_off + rec > size) {
+      // unreadable, skip the rest of the segment
+      f.close();
+      head_off = size;
+      continue;
+    }
+    f.read((uint8_t *)record, sub_len);
+    record[sub_len] = '\0';
+    f.read((uint8_t *)record + sub_len + 1, len);
+    f.close();
+
+    peeked = true;
+    peeked_size = rec;
+  }
+
+  *subtopic = record;
+  *data = record + strlen(record) + 1;
+  *length = peeked_size - QUEUE_REC_HEADER - strlen(record);
+  return true;
+}
+
+// Drops the record returned by peek().
+void TelemetryQueue::pop() {
+  char path[QUEUE_PATH_LEN];
+
+  if (!peeked) {
+    return;
+  }
+  peeked = false;
+  head_off += peeked_size;
+
+  if (head_seq == tail_seq && head_off >= tail_size) {
+    // drained, start over with a fresh segment
+    segmentPath(path, head_seq);
+    fs->remove(path);
+    head_seq = ++tail_seq;
+    head_off = QUEUE_SEG_HEADER;
+    tail_size = 0;
+  }
+}
+
+// Saves the read position. Called after each drained batch rather than per
+// record to keep flash writes down.
+void TelemetryQueue::sync() {
+  saveCursor();
+}
+
+bool TelemetryQueue::isEmpty() {
+  return head_seq == tail_seq && head_off >= tail_size;
+}
+
+void TelemetryQueue::dropHead() {
+  char path[QUEUE_PATH_LEN];
+
+  segmentPath(path, head_seq);
+  fs->remove(path);
+  head_seq++;
+  head_off = QUEUE_SEG_HEADER;
+  peeked = false;
+}
+
+// True if the head segment's header holds seq, so a saved offset is only
+// applied to the segment it was saved for.
+bool TelemetryQueue::headHasSeq(uint32_t seq) {
+  char path[QUEUE_PATH_LEN];
+  uint32_t head;
+
+  segmentPath(path, head_seq);
+  fs::File f = fs->open(path, "r");
+  if (!f) {
+    return false;
+  }
+  bool ok = f.read((uint8_t *)&head, sizeof(head)) == sizeof(head) && head == seq;
+  f.close();
+  return ok;
+}
+
+void TelemetryQueue::saveCursor() {
+  char path[QUEUE_PATH_LEN];
+  uint32_t cursor[2] = { head_seq, (uint32_t)head_off };
+
+  snprintf(path, QUEUE_PATH_LEN, "%s/c", dir);
+  fs::File c = fs->open(path, "w");
+  if (c) {
+    c.write((const uint8_t *)cursor, sizeof(cursor));
+    c.close();
+  }
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+#ifndef TELEMETRY_QUEUE_H
+#define TELEMETRY_QUEUE_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+// Flash backed store-and-forward queue for telemetry recorded while
+// offline. Records are appended to a ring of segment files on any fs::FS
+// (LittleFS, SPIFFS); when the ring is full the oldest segment is dropped.
+// Only one record is ever held in RAM.
+//
+// Segment file: 4 byte sequence number, then records of
+//   [u8 subtopic length][u16 data length][subtopic][data]
+// The read position is saved by sync(), so after a reset at most the
+// records sent since the last sync() are delivered again.
+class TelemetryQueue {
+  public:
+    TelemetryQueue(fs::FS &fs, const char *dir = "/gciotq",
+                   int segments = 8, int segment_size = 4096);
+    virtual ~TelemetryQueue();
+
+    // Recovers the queue left in dir. max_record is the largest record
+    // peek() can return, usually the MQTT bufsize.
+    bool begin(int max_record);
+
+    bool push(const char *subtopic, const char *data, int length);
+    bool peek(const char **subtopic, const char **data, int *length);
+    void pop();
+    void sync();
+    bool isEmpty();
+
+  private:
+    fs::FS *fs;
+    const char *dir;
+    int segments;
+    int segment_size;
+    char *record = NULL; // last record read by peek()
+    int max_record = 0;
+    bool peeked = false;
+    int peeked_size = 0;
+
+    uint32_t head_seq = 0; // oldest segment
+    uint32_t tail_seq = 0; // segment being appended to
+    int head_off = 0;      // read position in the head segment
+    int tail_size = 0;     // bytes in the tail segment, 0 = not created yet
+
+    void segmentPath(char *path, uint32_t seq);
+    int recordsEnd(fs::File &f);
+    void dropHead();
+    bool headHasSeq(uint32_t seq);
+    void saveCursor();
+};
+#endif // TELEMETRY_QUEUE_H
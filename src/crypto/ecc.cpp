@@ -198,6 +198,12 @@ c_add_mix(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1, point_t * P2)
 
   return;
 }
+/*---------------------------------------------------------------------------*/
+void
+ecc_add_mix(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1, point_t * P2)
+{
+  c_add_mix(P0, Z0, P1, Z1, P2);
+}
 
 /*---------------------------------------------------------------------------*/
 void
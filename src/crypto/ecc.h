@@ -122,6 +122,13 @@ void ecc_add(point_t * P0, point_t * P1, point_t * P2);
  */
 void ecc_add_proj(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1, point_t * P2, NN_DIGIT * Z2);
 
+/**
+ * \brief             Mixed point addition, (P0,Z0) = (P1,Z1) + P2
+ *                    with P2 in affine coordinates.
+ *                    P0 and P1 can be same pointer.
+ */
+void ecc_add_mix(point_t * P0, NN_DIGIT *Z0, point_t * P1, NN_DIGIT * Z1, point_t * P2);
+
 /**
  * \brief             Point doubleing, (P0,Z0) = 2*(P1,Z1)
  *                    using projective coordinates system.
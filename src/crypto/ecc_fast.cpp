@@ -0,0 +1,324 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "ecc_fast.h"
+#include "p256.h"
+#if ECC_FIXED_BASE_COMB
+#include <Arduino.h>
+#endif
+
+/*
+ * parameters loaded into ecc.cpp by ecc_fast_init
+ */
+static curve_params_t *param;
+#if !ECC_FIXED_BASE_COMB
+/*
+ * precomputed array for base point
+ */
+static point_t pBaseArray[NUM_POINTS];
+#endif
+
+/*---------------------------------------------------------------------------*/
+static void
+p_clear(point_t * P0)
+{
+  NN_AssignZero(P0->x, NUMWORDS);
+  NN_AssignZero(P0->y, NUMWORDS);
+}
+#if ECC_FIXED_BASE_COMB
+/*---------------------------------------------------------------------------*/
+static NN_DIGIT
+b_testbit(NN_DIGIT * a, int16_t i)
+{
+  return (*(a + (i / NN_DIGIT_BITS)) & ((NN_DIGIT)1 << (i % NN_DIGIT_BITS)));
+}
+#endif
+/*---------------------------------------------------------------------------*/
+void
+ecc_fast_init()
+{
+ param = ecc_get_param();
+
+ /* ecc_init() would also fill a base point array of its own */
+ get_curve_param(param);
+
+#if !ECC_FIXED_BASE_COMB
+ /* precompute array for base point */
+ ecc_win_precompute(&(param->G), pBaseArray);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+#if !ECC_FIXED_BASE_COMB
+void
+ecc_fast_init_table(const point_t * table)
+{
+ uint8_t i;
+
+ param = ecc_get_param();
+ get_curve_param(param);
+
+ for(i = 0; i < NUM_POINTS; i++) {
+   NN_Assign(pBaseArray[i].x, (NN_DIGIT *)table[i].x, NUMWORDS);
+   NN_Assign(pBaseArray[i].y, (NN_DIGIT *)table[i].y, NUMWORDS);
+ }
+}
+/*---------------------------------------------------------------------------*/
+const point_t *
+ecc_fast_get_base_table()
+{
+  return pBaseArray;
+}
+#endif
+/*---------------------------------------------------------------------------*/
+void
+ecc_fast_to_affine(point_t * P0, NN_DIGIT *Z0)
+{
+  NN_DIGIT Z1[NUMWORDS];
+
+  if(!NN_One(Z0, NUMWORDS)) {
+#if NN_P256_FIELD
+    p256_inv(Z1, Z0);
+    Z1[NUMWORDS - 1] = 0;
+#else
+    NN_ModInv(Z1, Z0, param->p, NUMWORDS);
+#endif
+    NN_ModMultOpt(Z0, Z1, Z1, param->p, param->omega, NUMWORDS);
+    NN_ModMultOpt(P0->x, P0->x, Z0, param->p, param->omega, NUMWORDS);
+    NN_ModMultOpt(Z0, Z0, Z1, param->p, param->omega, NUMWORDS);
+    NN_ModMultOpt(P0->y, P0->y, Z0, param->p, param->omega, NUMWORDS);
+  }
+}
+/*---------------------------------------------------------------------------*/
+#if !ECC_WNAF || !ECC_FIXED_BASE_COMB
+/**
+ * \brief             One window of the sliding window method, the j-th
+ *                    window of digit i of n: W_BITS doublings and at most
+ *                    one addition.
+ */
+static void
+win_window(point_t * P0, NN_DIGIT *Z0, NN_DIGIT * n, int16_t i, int8_t j, point_t * pointArray)
+{
+  NN_DIGIT windex;
+
+  ecc_m_dbl_projective(P0, Z0, W_BITS);
+
+  windex = ((NN_DIGIT)BASIC_MASK << (j*W_BITS)) & n[i];
+
+  if(windex) {
+    windex = windex >> (j*W_BITS);
+    ecc_add_mix(P0, Z0, P0, Z0, &(pointArray[windex-1]));
+  }
+}
+#endif
+/*---------------------------------------------------------------------------*/
+#if ECC_WNAF
+/*
+ * A digit spans -(2^W_BITS - 1) .. 2^W_BITS - 1, which only fits a byte up
+ * to W_BITS 6
+ */
+#if W_BITS > 6
+typedef int16_t wnaf_digit_t;
+#else
+typedef int8_t wnaf_digit_t;
+#endif
+
+/**
+ * \brief             Width-(W_BITS+1) NAF of n, least significant digit
+ *                    first. Every non-zero digit is odd and its absolute
+ *                    value is at most NUM_POINTS. Returns the number of
+ *                    digits.
+ */
+static int16_t
+wnaf_recode(wnaf_digit_t *naf, NN_DIGIT * n)
+{
+  NN_DIGIT k[NUMWORDS];
+  NN_DIGIT t[NUMWORDS];
+  int16_t len = 0;
+  wnaf_digit_t d;
+
+  NN_Assign(k, n, NUMWORDS);
+
+  while(!NN_Zero(k, NUMWORDS)) {
+    d = 0;
+    if(k[0] & 1) {
+      /* d = k mods 2^(W_BITS+1) */
+      d = (wnaf_digit_t)(k[0] & ((BASIC_MASK << 1) | 1));
+      if(d > NUM_POINTS) {
+        d -= (wnaf_digit_t)(1 << (W_BITS + 1));
+        NN_AssignDigit(t, (NN_DIGIT)(-d), NUMWORDS);
+        NN_Add(k, k, t, NUMWORDS);
+      } else {
+        NN_AssignDigit(t, (NN_DIGIT)d, NUMWORDS);
+        NN_Sub(k, k, t, NUMWORDS);
+      }
+    }
+    naf[len++] = d;
+    NN_RShift(k, k, 1, NUMWORDS);
+  }
+
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             P0 = P0 + d * pointArray[0], d a non-zero wNAF digit
+ */
+static void
+wnaf_add(point_t * P0, NN_DIGIT *Z0, wnaf_digit_t d, point_t * pointArray)
+{
+  point_t T;
+
+  if(d > 0) {
+    ecc_add_mix(P0, Z0, P0, Z0, &(pointArray[d-1]));
+  } else {
+    /* -(x, y) = (x, p - y) */
+    NN_Assign(T.x, pointArray[-d-1].x, NUMWORDS);
+    NN_Sub(T.y, param->p, pointArray[-d-1].y, NUMWORDS);
+    ecc_add_mix(P0, Z0, P0, Z0, &T);
+  }
+}
+#endif /* ECC_WNAF */
+/*---------------------------------------------------------------------------*/
+void
+ecc_fast_win_mul(point_t * P0, NN_DIGIT * n, point_t * pointArray)
+{
+  int16_t i, tmp;
+  NN_DIGIT Z0[NUMWORDS];
+#if ECC_WNAF
+  wnaf_digit_t naf[KEY_BIT_LEN + 1];
+  uint8_t dbl;
+#else
+  int8_t j;
+#endif
+
+  p_clear(P0);
+
+  /* Convert to Jprojective coordinate */
+  NN_AssignZero(Z0, NUMWORDS);
+
+#if ECC_WNAF
+  tmp = wnaf_recode(naf, n);
+
+  /* doublings are deferred and done in one run before each addition */
+  dbl = 0;
+  for(i = tmp - 1; i >= 0; i--) {
+    if(naf[i]) {
+      if(dbl) {
+        ecc_m_dbl_projective(P0, Z0, dbl);
+        dbl = 0;
+      }
+      wnaf_add(P0, Z0, naf[i], pointArray);
+    }
+    if(i > 0) {
+      dbl++;
+    }
+  }
+  if(dbl) {
+    ecc_m_dbl_projective(P0, Z0, dbl);
+  }
+#else
+  tmp = NN_Digits(n, NUMWORDS);
+
+  for(i = tmp - 1; i >= 0; i--) {
+    for(j = NUM_MASKS - 1; j >= 0; j--) {
+      win_window(P0, Z0, n, i, j, pointArray);
+    }
+  }
+#endif
+
+  /* Convert back to affine coordinate */
+  ecc_fast_to_affine(P0, Z0);
+}
+/*---------------------------------------------------------------------------*/
+#if ECC_FIXED_BASE_COMB
+/**
+ * \brief             Column i of the fixed-base comb method
+ *                    (Algorithm 3.44 in "Guide to ECC"): one doubling and
+ *                    at most one mixed addition.
+ */
+static void
+comb_column(point_t * P0, NN_DIGIT *Z0, NN_DIGIT * n, int16_t i)
+{
+  uint8_t j;
+  uint16_t windex;
+  int16_t bit;
+  point_t T;
+
+  ecc_dbl_proj(P0, Z0, P0, Z0);
+
+  /* bit j of windex is bit (i + j*spacing) of n */
+  windex = 0;
+  for(j = 0; j < ECC_COMB_TEETH; j++) {
+    bit = i + j * ECC_COMB_SPACING;
+    if(bit < KEY_BIT_LEN && b_testbit(n, bit)) {
+      windex |= (1 << j);
+    }
+  }
+
+  if(windex) {
+    p_clear(&T);
+    memcpy_P(T.x, ecc_comb_table[windex-1][0], KEYDIGITS * NN_DIGIT_LEN);
+    memcpy_P(T.y, ecc_comb_table[windex-1][1], KEYDIGITS * NN_DIGIT_LEN);
+    ecc_add_mix(P0, Z0, P0, Z0, &T);
+  }
+}
+#endif /* ECC_FIXED_BASE_COMB */
+/*---------------------------------------------------------------------------*/
+void
+ecc_fast_mul_base_begin(ecc_mul_state_t * state, NN_DIGIT * n)
+{
+  p_clear(&state->P0);
+
+  /* Convert to Jprojective coordinate */
+  NN_AssignZero(state->Z0, NUMWORDS);
+  NN_Assign(state->n, n, NUMWORDS);
+
+#if ECC_FIXED_BASE_COMB
+  state->step = ECC_COMB_SPACING - 1;
+#else
+  state->step = NN_Digits(n, NUMWORDS) * NUM_MASKS - 1;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+ecc_fast_mul_base_step(ecc_mul_state_t * state, uint8_t steps)
+{
+  for(; steps > 0 && state->step >= -1; steps--, state->step--) {
+    if(state->step == -1) {
+      /* Convert back to affine coordinate */
+      ecc_fast_to_affine(&state->P0, state->Z0);
+    } else {
+#if ECC_FIXED_BASE_COMB
+      comb_column(&state->P0, state->Z0, state->n, state->step);
+#else
+      win_window(&state->P0, state->Z0, state->n,
+                 state->step / NUM_MASKS, state->step % NUM_MASKS, pBaseArray);
+#endif
+    }
+  }
+
+  return state->step < -1;
+}
+/*---------------------------------------------------------------------------*/
+void
+ecc_fast_mul_base(point_t * P0, NN_DIGIT * n)
+{
+  ecc_mul_state_t state;
+
+  ecc_fast_mul_base_begin(&state, n);
+  while(!ecc_fast_mul_base_step(&state, 0xff)) {
+  }
+  NN_Assign(P0->x, state.P0.x, NUMWORDS);
+  NN_Assign(P0->y, state.P0.y, NUMWORDS);
+}
@@ -0,0 +1,150 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _ECC_FAST_H_
+#define _ECC_FAST_H_
+
+#include "ecc.h"
+
+/**
+ * Scalar multiplications on top of the point arithmetic in ecc.cpp: wNAF
+ * for arbitrary points, a fixed-base comb for the base point and a
+ * resumable base point multiplication. ecc.cpp is pulled by
+ * pull_crypto.sh and only gains ecc_add_mix from crypto_patches.
+ */
+
+/**
+ * Recode the scalar of ecc_fast_win_mul in width-(W_BITS+1) NAF. The odd
+ * multiples it needs are already in the ecc_win_precompute table, and
+ * negative digits cost only a negation of y, so the number of additions
+ * drops from about KEY_BIT_LEN/W_BITS to KEY_BIT_LEN/(W_BITS+2). Runs of
+ * zero digits go through ecc_m_dbl_projective. Define ECC_WNAF to 0 to
+ * keep the fixed window loop.
+ */
+#ifndef ECC_WNAF
+#define ECC_WNAF 1
+#endif
+
+/**
+ * Use a fixed-base comb for ecc_fast_mul_base. The table lives in flash
+ * (secp256r1_comb.cpp) and replaces the RAM base point array, taking
+ * 256/ECC_COMB_TEETH doublings per multiplication instead of 256.
+ * Enabled by default on ESP8266/ESP32, define ECC_FIXED_BASE_COMB to 0 to
+ * keep the small sliding window table.
+ */
+#ifndef ECC_FIXED_BASE_COMB
+#if defined(ESP8266) || defined(ESP32)
+#define ECC_FIXED_BASE_COMB 1
+#else
+#define ECC_FIXED_BASE_COMB 0
+#endif
+#endif
+
+/**
+ * Number of comb teeth. secp256r1_comb.cpp has to be regenerated with
+ * gen_comb_table.py when this changes.
+ */
+#define ECC_COMB_TEETH 8
+
+/**
+ * Distance in bits between two teeth of the comb.
+ */
+#define ECC_COMB_SPACING ((KEY_BIT_LEN + ECC_COMB_TEETH - 1) / ECC_COMB_TEETH)
+
+/**
+ * Number of precomputed points in the comb table, 2^ECC_COMB_TEETH - 1
+ */
+#define ECC_COMB_POINTS ((1 << ECC_COMB_TEETH) - 1)
+
+/**
+ * State of a resumable base point multiplication,
+ * see ecc_fast_mul_base_begin.
+ */
+typedef struct ecc_mul_state {
+    /** running result, affine once the multiplication is done */
+    point_t P0;
+    NN_DIGIT Z0[NUMWORDS];
+    /** scalar */
+    NN_DIGIT n[NUMWORDS];
+    /** next window (or comb column), -1 = affine conversion left */
+    int16_t step;
+} ecc_mul_state_t;
+
+#if ECC_FIXED_BASE_COMB
+/**
+ * Fixed-base comb table, entry i-1 is the affine x and y of
+ * sum(2^(j*ECC_COMB_SPACING) * basepoint) over the bits j set in i.
+ * Stored in flash, read it with memcpy_P.
+ */
+extern const NN_DIGIT ecc_comb_table[ECC_COMB_POINTS][2][KEYDIGITS];
+#endif
+
+/**
+ * \brief             Load the curve parameters and, without the comb, build
+ *                    the base point array. Replaces ecc_init() for the
+ *                    functions below.
+ */
+void ecc_fast_init();
+
+#if !ECC_FIXED_BASE_COMB
+/**
+ * \brief             Like ecc_fast_init(), but takes a base point array
+ *                    saved from ecc_fast_get_base_table() instead of
+ *                    computing it.
+ */
+void ecc_fast_init_table(const point_t * table);
+
+/**
+ * \brief             The NUM_POINTS entry base point array built by
+ *                    ecc_fast_init()
+ */
+const point_t *ecc_fast_get_base_table();
+#endif
+
+/**
+ * \brief             Scalar point multiplication P0 = n * Point, same
+ *                    contract as ecc_win_mul. pointArray is constructed by
+ *                    ecc_win_precompute(Point, pointArray).
+ */
+void ecc_fast_win_mul(point_t * P0, NN_DIGIT * n, point_t * pointArray);
+
+/**
+ * \brief             Scalar point multiplication on basepoint,
+ *                    P0 = n * basepoint.
+ */
+void ecc_fast_mul_base(point_t * P0, NN_DIGIT * n);
+
+/**
+ * \brief             Start a resumable P0 = n * basepoint. The work is done
+ *                    by ecc_fast_mul_base_step, so it can be spread over
+ *                    several calls.
+ */
+void ecc_fast_mul_base_begin(ecc_mul_state_t * state, NN_DIGIT * n);
+
+/**
+ * \brief             Run up to steps windows (comb columns) of a
+ *                    multiplication started with ecc_fast_mul_base_begin.
+ *                    The final affine conversion counts as one step.
+ * \return            1 once state->P0 holds the result.
+ */
+uint8_t ecc_fast_mul_base_step(ecc_mul_state_t * state, uint8_t steps);
+
+/**
+ * \brief             Convert (P0, Z0) from Jprojective back to affine
+ *                    coordinate, with p256_inv when NN_P256_FIELD is set.
+ */
+void ecc_fast_to_affine(point_t * P0, NN_DIGIT *Z0);
+
+#endif /* _ECC_FAST_H_ */
@@ -0,0 +1,211 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "ecdsa_fast.h"
+#include "p256.h"
+
+#define TRUE 1
+#define FALSE 0
+
+/*
+ * order of the curve, param->r
+ */
+static NN_DIGIT order[NUMWORDS];
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             digest = sha256sum reduced mod order, as in ecdsa.cpp
+ */
+static void
+digest_mod_order(NN_DIGIT *digest, uint8_t sha256sum[SHA256_DIGEST_LENGTH])
+{
+  NN_DIGIT sha256tmp[SHA256_DIGEST_LENGTH/NN_DIGIT_LEN];
+  NN_UINT result_bit_len;
+  NN_UINT order_bit_len;
+
+  NN_Decode(sha256tmp, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN, sha256sum, SHA256_DIGEST_LENGTH);
+
+  result_bit_len = NN_Bits(sha256tmp, SHA256_DIGEST_LENGTH / NN_DIGIT_LEN);
+  order_bit_len = NN_Bits(order, NUMWORDS);
+
+  if (result_bit_len > order_bit_len) {
+      NN_Mod(digest, sha256tmp, SHA256_DIGEST_LENGTH/NN_DIGIT_LEN, order, NUMWORDS);
+  } else {
+      memset(digest, 0, NUMBYTES);
+      NN_Assign(digest, sha256tmp, SHA256_DIGEST_LENGTH / NN_DIGIT_LEN);
+      if (result_bit_len == order_bit_len) {
+          NN_ModSmall(digest, order, NUMWORDS);
+      }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             a = b^-1 mod order, constant time with NN_P256_FIELD
+ */
+static void
+order_inv(NN_DIGIT *a, NN_DIGIT *b)
+{
+#if NN_P256_FIELD
+  p256_order_inv(a, b);
+  a[NUMWORDS - 1] = 0;
+#else
+  NN_ModInv(a, b, order, NUMWORDS);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+void
+ecdsa_fast_init()
+{
+  ecc_get_order(order);
+}
+/*---------------------------------------------------------------------------*/
+void
+ecdsa_gen_nonce_begin(ecdsa_nonce_state_t * state)
+{
+  /* k is never zero */
+  ecc_gen_private_key(state->k);
+
+  ecc_fast_mul_base_begin(&state->mul, state->k);
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+ecdsa_gen_nonce_step(ecdsa_nonce_state_t * state, ecdsa_nonce_t * nonce, uint8_t steps)
+{
+  if(!ecc_fast_mul_base_step(&state->mul, steps)) {
+    return FALSE;
+  }
+
+  NN_Mod(nonce->r, state->mul.P0.x, NUMWORDS, order, NUMWORDS);
+
+  if((NN_Zero(nonce->r, NUMWORDS)) == 1) {
+    /* start over with another k */
+    ecdsa_gen_nonce_begin(state);
+    return FALSE;
+  }
+
+  /* Fermat inversion runs in constant time, k must not leak */
+  order_inv(nonce->k_inv, state->k);
+  memset(state, 0, sizeof(ecdsa_nonce_state_t));
+
+  return TRUE;
+}
+/*---------------------------------------------------------------------------*/
+void
+ecdsa_gen_nonce(ecdsa_nonce_t * nonce)
+{
+  ecdsa_nonce_state_t state;
+
+  ecdsa_gen_nonce_begin(&state);
+  while(!ecdsa_gen_nonce_step(&state, nonce, 0xff)) {
+  }
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+ecdsa_sign_nonce(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT *d, ecdsa_nonce_t * nonce)
+{
+  NN_DIGIT tmp[NUMWORDS];
+  NN_DIGIT dr[NUMWORDS];
+  NN_DIGIT digest[NUMWORDS];
+
+  digest_mod_order(digest, sha256sum);
+
+  /* s = k^-1 * (e + d*r) */
+  NN_ModMult(dr, d, nonce->r, order, NUMWORDS);
+  NN_ModAdd(tmp, digest, dr, order, NUMWORDS);
+  NN_ModMult(s, nonce->k_inv, tmp, order, NUMWORDS);
+  NN_Assign(r, nonce->r, NUMWORDS);
+
+  /* a nonce must never sign twice */
+  memset(nonce, 0, sizeof(ecdsa_nonce_t));
+
+  return (NN_Zero(s, NUMWORDS)) != 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+ecdsa_fast_sign(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT *d)
+{
+  ecdsa_nonce_t nonce;
+
+  do {
+    ecdsa_gen_nonce(&nonce);
+  } while(!ecdsa_sign_nonce(sha256sum, r, s, d, &nonce));
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+ecdsa_fast_verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, point_t *pointArray)
+{
+  NN_DIGIT w[NUMWORDS];
+  NN_DIGIT u1[NUMWORDS];
+  NN_DIGIT u2[NUMWORDS];
+  NN_DIGIT digest[NUMWORDS];
+  NN_DIGIT Z0[NUMWORDS];
+  point_t u1P, u2Q;
+  point_t final;
+  NN_UINT result_bit_len;
+  NN_UINT order_bit_len;
+
+  /* r and s should be in [1, p-1] */
+  if((NN_Cmp(r, order, NUMWORDS)) >= 0) {
+    return 3;
+  }
+  if((NN_Zero(r, NUMWORDS)) == 1) {
+    return 4;
+  }
+  if((NN_Cmp(s, order, NUMWORDS)) >= 0) {
+    return 5;
+  }
+  if((NN_Zero(s, NUMWORDS)) == 1) {
+    return 6;
+  }
+
+  /* w = s^-1 mod p */
+  order_inv(w, s);
+
+  digest_mod_order(digest, sha256sum);
+
+  /* u1 = ew mod p */
+  NN_ModMult(u1, digest, w, order, NUMWORDS);
+  /* u2 = rw mod p */
+  NN_ModMult(u2, r, w, order, NUMWORDS);
+
+  /* u1P+u2Q, both affine, so one mixed addition and one inversion */
+  ecc_fast_mul_base(&u1P, u1);
+  ecc_fast_win_mul(&u2Q, u2, pointArray);
+  NN_AssignDigit(Z0, 1, NUMWORDS);
+  if(NN_Zero(u1P.x, NUMWORDS) && NN_Zero(u1P.y, NUMWORDS)) {
+    /* u1 = 0, u1P is the point at infinity */
+    NN_AssignZero(Z0, NUMWORDS);
+  }
+  ecc_add_mix(&final, Z0, &u1P, Z0, &u2Q);
+  ecc_fast_to_affine(&final, Z0);
+
+  result_bit_len = NN_Bits(final.x, NUMWORDS);
+  order_bit_len = NN_Bits(order, NUMWORDS);
+
+  if (result_bit_len > order_bit_len) {
+      NN_Mod(w, final.x, NUMWORDS, order, NUMWORDS);
+  } else {
+      NN_Assign(w, final.x, NUMWORDS);
+      if (result_bit_len == order_bit_len) {
+          NN_ModSmall(w, order, NUMWORDS);
+      }
+  }
+
+  if((NN_Cmp(w, r, NUMWORDS)) == 0) {
+    return 1;
+  } else {
+    return 2;
+  }
+}
@@ -0,0 +1,117 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _ECDSA_FAST_H_
+#define _ECDSA_FAST_H_
+
+#include "ecdsa.h"
+#include "ecc_fast.h"
+
+/**
+ * ECDSA signing with precomputed nonces and verification against caller
+ * owned public key tables, built on ecc_fast. Replaces ecdsa.cpp, which is
+ * pulled by pull_crypto.sh and left as it is upstream.
+ */
+
+/**
+ * A message independent signing nonce: r = (k*G).x mod n and k^-1 mod n.
+ * Each nonce must be used for one signature only.
+ */
+typedef struct ecdsa_nonce {
+    NN_DIGIT r[NUMWORDS];
+    NN_DIGIT k_inv[NUMWORDS];
+} ecdsa_nonce_t;
+
+/**
+ * State of a nonce that is being computed in steps, see
+ * ecdsa_gen_nonce_begin.
+ */
+typedef struct ecdsa_nonce_state {
+    NN_DIGIT k[NUMWORDS];
+    ecc_mul_state_t mul;
+} ecdsa_nonce_state_t;
+
+/**
+ * \brief             Initialize for signing and verification. Call after
+ *                    ecc_fast_init(). Unlike ecdsa_init no public key table
+ *                    is precomputed, so this is cheap enough to call once
+ *                    before any number of signatures.
+ */
+void ecdsa_fast_init();
+
+/**
+ * \brief             Sign a message using the private key, same contract
+ *                    as ecdsa_sign.
+ *
+ * \param sha256sum   Hash of the message to sign.
+ * \param r
+ * \param s           Signature of the message.
+ * \param pr_key      The private key that is used to sign the message.
+ */
+void ecdsa_fast_sign(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT * pr_key);
+
+/**
+ * \brief             Precompute a signing nonce. This is the expensive,
+ *                    message independent part of ecdsa_fast_sign (one base
+ *                    point multiplication and one inversion).
+ *
+ * \param nonce       Receives the nonce.
+ */
+void ecdsa_gen_nonce(ecdsa_nonce_t * nonce);
+
+/**
+ * \brief             Start computing a signing nonce in steps, so that it
+ *                    can run in the background without blocking.
+ */
+void ecdsa_gen_nonce_begin(ecdsa_nonce_state_t * state);
+
+/**
+ * \brief             Advance a nonce started with ecdsa_gen_nonce_begin by
+ *                    up to steps scalar multiplication steps.
+ *
+ * \param nonce       Receives the nonce once it is done.
+ * \return            1 when nonce holds the result.
+ */
+uint8_t ecdsa_gen_nonce_step(ecdsa_nonce_state_t * state, ecdsa_nonce_t * nonce, uint8_t steps);
+
+/**
+ * \brief             Sign a message using the private key and a nonce from
+ *                    ecdsa_gen_nonce. Costs a few modular multiplications.
+ *
+ * \param sha256sum   Hash of the message to sign.
+ * \param r
+ * \param s           Signature of the message.
+ * \param pr_key      The private key that is used to sign the message.
+ * \param nonce       Nonce to consume, it is cleared afterwards.
+ * \return            1 on success, 0 if the nonce gave s = 0 and a new
+ *                    one is needed.
+ */
+uint8_t ecdsa_sign_nonce(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, NN_DIGIT * pr_key, ecdsa_nonce_t * nonce);
+
+/**
+ * \brief             Verify a message against a public key table owned by
+ *                    the caller, so that several keys can be kept ready at
+ *                    once.
+ * \param sha256sum   Hash of the message to sign.
+ * \param r
+ * \param s           Signature of the message.
+ * \param pointArray  NUM_POINTS points built by ecc_win_precompute from the
+ *                    public key.
+ * \return            1 if the signature is verified, the other codes are
+ *                    those of ecdsa_verify.
+ */
+uint8_t ecdsa_fast_verify(uint8_t sha256sum[SHA256_DIGEST_LENGTH], NN_DIGIT *r, NN_DIGIT *s, point_t * pointArray);
+
+#endif /* _ECDSA_FAST_H_ */
@@ -6,6 +6,8 @@
  */
 
 #include "nn.h"
+#include "p256.h"
+#include "nn_asm.h"
 #if !defined(WITH_CONTIKI) && defined(HAVE_ASSERT_H)
 #include <assert.h>
 #else
@@ -428,6 +430,15 @@ NN_ModInv(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_UINT digits)
 void
 NN_ModMultOpt(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_DIGIT * omega, NN_UINT digits)
 {
+#if NN_P256_FIELD
+  /* d is the secp256r1 prime, use the dedicated field backend */
+  (void)d;
+  (void)omega;
+  p256_mult(a, b, c);
+  if(digits > KEYDIGITS) {
+    NN_AssignZero(a + KEYDIGITS, digits - KEYDIGITS);
+  }
+#else
   NN_DIGIT t1[2*MAX_NN_DIGITS];
   NN_DIGIT t2[2*MAX_NN_DIGITS];
   NN_DIGIT *pt1;
@@ -467,6 +478,7 @@ NN_ModMultOpt(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * c, NN_DIGIT * d, NN_DIGIT *
   }
 
   NN_Assign(a, t1, digits);
+#endif /* NN_P256_FIELD */
 
 }
 /*---------------------------------------------------------------------------*/
@@ -533,6 +545,15 @@ NN_ModDivOpt(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c, NN_DIGIT *d, NN_UINT digits)
 void
 NN_ModSqrOpt(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * d, NN_DIGIT * omega, NN_UINT digits)
 {
+#if NN_P256_FIELD
+  /* d is the secp256r1 prime, use the dedicated field backend */
+  (void)d;
+  (void)omega;
+  p256_sqr(a, b);
+  if(digits > KEYDIGITS) {
+    NN_AssignZero(a + KEYDIGITS, digits - KEYDIGITS);
+  }
+#else
   NN_DIGIT t1[2*MAX_NN_DIGITS];
   NN_DIGIT t2[2*MAX_NN_DIGITS];
   NN_DIGIT *pt1;
@@ -569,6 +590,7 @@ NN_ModSqrOpt(NN_DIGIT * a, NN_DIGIT * b, NN_DIGIT * d, NN_DIGIT * omega, NN_UINT
     NN_Sub(t1, t1, d, digits);
   }
   NN_Assign (a, t1, digits);
+#endif /* NN_P256_FIELD */
 
 }
 /*--------------------------- OTHER OPERATIONS -------------------------------*/
@@ -686,7 +708,7 @@ NN_AddDigitMult(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT c, NN_DIGIT *d, NN_UINT digit
 {
   NN_DIGIT carry;
   unsigned int i;
-  NN_DOUBLE_DIGIT t;
+  NN_DIGIT lo, hi, top;
 
   /* Should copy b to a */
   if(c == 0) {
@@ -696,16 +718,16 @@ NN_AddDigitMult(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT c, NN_DIGIT *d, NN_UINT digit
   carry = 0;
 
   for(i = 0; i < digits; i++) {
-    t = NN_DigitMult (c, d[i]);
-    if ((a[i] = b[i] + carry) < carry) {
-      carry = 1;
-    } else {
-      carry = 0;
-    }
-    if((a[i] += (t & MAX_NN_DIGIT)) < (t & MAX_NN_DIGIT)) {
-      carry++;
+    /* (hi:lo) = b[i] + carry + c * d[i], which cannot overflow two digits */
+    lo = b[i];
+    hi = 0;
+    top = 0;
+    NN_MULADD(lo, hi, top, c, d[i]);
+    if((lo += carry) < carry) {
+      hi++;
     }
-    carry += (NN_DIGIT)(t >> NN_DIGIT_BITS);
+    a[i] = lo;
+    carry = hi;
   }
 
   return carry;
@@ -0,0 +1,144 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _NN_ASM_H_
+#define _NN_ASM_H_
+
+#include "nn.h"
+
+/**
+ * NN_MULADD(c0, c1, c2, a, b) computes (c2:c1:c0) += a * b, the
+ * multiply-accumulate step under NN_AddDigitMult and the p256 field
+ * multiply. The kernel is picked per architecture at compile time, define
+ * NN_NO_ASM to force the portable C version.
+ *
+ *  - ARMv7-M (Cortex-M3/M4): UMULL and an ADDS/ADCS chain.
+ *  - ARMv6-M (Cortex-M0+, MKR1000): there is no 32x32->64 multiply, GCC
+ *    calls __aeabi_lmul; four 16x16 MULS are much cheaper.
+ *  - Xtensa with MUL32_HIGH (ESP32): MULL/MULUH. The ESP8266 core lacks
+ *    MULUH, so it keeps the C version (libgcc already uses MUL16U there).
+ */
+#if !defined(NN_NO_ASM) && defined(THIRTYTWO_BIT_PROCESSOR) && defined(__GNUC__)
+#if defined(__arm__) && (defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__))
+#define NN_ASM_ARM_UMULL
+#elif defined(__arm__) && defined(__ARM_ARCH_6M__)
+#define NN_ASM_ARM_V6M
+#elif defined(__XTENSA__) && defined(ESP32)
+#define NN_ASM_XTENSA_MULUH
+#endif
+#endif
+
+#if defined(NN_ASM_ARM_UMULL)
+
+#define NN_MULADD(c0, c1, c2, a, b) do {                       \
+    NN_DIGIT _lo, _hi;                                         \
+    __asm__ ("umull %[lo], %[hi], %[x], %[y] \n\t"             \
+             "adds  %[r0], %[r0], %[lo] \n\t"                  \
+             "adcs  %[r1], %[r1], %[hi] \n\t"                  \
+             "adc   %[r2], %[r2], #0 \n\t"                     \
+             : [r0] "+r" (c0), [r1] "+r" (c1), [r2] "+r" (c2), \
+               [lo] "=&r" (_lo), [hi] "=&r" (_hi)              \
+             : [x] "r" (a), [y] "r" (b)                        \
+             : "cc");                                          \
+  } while (0)
+
+#elif defined(NN_ASM_ARM_V6M)
+
+#if defined(__clang__)
+#define NN_ASM_RESUME_SYNTAX
+#else
+#define NN_ASM_RESUME_SYNTAX ".syntax divided \n\t"
+#endif
+
+/*
+ * Thumb-1 only has low registers for MULS/ADDS/ADCS, so the product and
+ * the accumulation are two statements of five registers each.
+ */
+#define NN_MULADD(c0, c1, c2, a, b) do {                       \
+    NN_DIGIT _x = (a), _y = (b), _t0, _t1, _t2;                \
+    __asm__ (".syntax unified \n\t"                            \
+             "lsrs  %[t0], %[x], #16 \n\t"     /* ah */        \
+             "uxth  %[x], %[x] \n\t"           /* al */        \
+             "lsrs  %[t1], %[y], #16 \n\t"     /* bh */        \
+             "uxth  %[y], %[y] \n\t"           /* bl */        \
+             "movs  %[t2], %[y] \n\t"                          \
+             "muls  %[t2], %[x], %[t2] \n\t"   /* al*bl */     \
+             "muls  %[y], %[t0], %[y] \n\t"    /* ah*bl */     \
+             "muls  %[x], %[t1], %[x] \n\t"    /* al*bh */     \
+             "muls  %[t0], %[t1], %[t0] \n\t"  /* ah*bh */     \
+             "movs  %[t1], #0 \n\t"                            \
+             "adds  %[x], %[x], %[y] \n\t"     /* mid */       \
+             "adcs  %[t1], %[t1], %[t1] \n\t"                  \
+             "lsls  %[t1], %[t1], #16 \n\t"                    \
+             "adds  %[t0], %[t0], %[t1] \n\t"                  \
+             "lsls  %[y], %[x], #16 \n\t"                      \
+             "lsrs  %[x], %[x], #16 \n\t"                      \
+             "adds  %[t2], %[t2], %[y] \n\t"   /* lo */        \
+             "adcs  %[t0], %[t0], %[x] \n\t"   /* hi */        \
+             NN_ASM_RESUME_SYNTAX                              \
+             : [x] "+l" (_x), [y] "+l" (_y), [t0] "=&l" (_t0), \
+               [t1] "=&l" (_t1), [t2] "=&l" (_t2)              \
+             :                                                 \
+             : "cc");                                          \
+    __asm__ (".syntax unified \n\t"                            \
+             "adds  %[r0], %[r0], %[lo] \n\t"                  \
+             "adcs  %[r1], %[r1], %[hi] \n\t"                  \
+             "movs  %[lo], #0 \n\t"                            \
+             "adcs  %[r2], %[r2], %[lo] \n\t"                  \
+             NN_ASM_RESUME_SYNTAX                              \
+             : [r0] "+l" (c0), [r1] "+l" (c1), [r2] "+l" (c2), \
+               [lo] "+l" (_t2)                                 \
+             : [hi] "l" (_t0)                                  \
+             : "cc");                                          \
+  } while (0)
+
+#elif defined(NN_ASM_XTENSA_MULUH)
+
+/*
+ * Xtensa has no carry flag, carries are detected by unsigned compare.
+ * The high word of a product is at most 2^32 - 2, so hi + 1 cannot wrap.
+ */
+#define NN_MULADD(c0, c1, c2, a, b) do {                       \
+    NN_DIGIT _lo, _hi;                                         \
+    __asm__ ("mull  %[lo], %[x], %[y] \n\t"                    \
+             "muluh %[hi], %[x], %[y] \n\t"                    \
+             "add   %[r0], %[r0], %[lo] \n\t"                  \
+             "bgeu  %[r0], %[lo], 1f \n\t"                     \
+             "addi  %[hi], %[hi], 1 \n"                        \
+             "1: \n\t"                                         \
+             "add   %[r1], %[r1], %[hi] \n\t"                  \
+             "bgeu  %[r1], %[hi], 2f \n\t"                     \
+             "addi  %[r2], %[r2], 1 \n"                        \
+             "2: \n\t"                                         \
+             : [r0] "+r" (c0), [r1] "+r" (c1), [r2] "+r" (c2), \
+               [lo] "=&r" (_lo), [hi] "=&r" (_hi)              \
+             : [x] "r" (a), [y] "r" (b));                      \
+  } while (0)
+
+#else
+
+#define NN_MULADD(c0, c1, c2, a, b) do {                       \
+    NN_DOUBLE_DIGIT _t = (NN_DOUBLE_DIGIT)(a) * (b);           \
+    NN_DIGIT _lo = (NN_DIGIT)_t;                               \
+    NN_DIGIT _hi = (NN_DIGIT)(_t >> NN_DIGIT_BITS);            \
+    (c0) += _lo;                                               \
+    _hi += ((c0) < _lo);                                       \
+    (c1) += _hi;                                               \
+    (c2) += ((c1) < _hi);                                      \
+  } while (0)
+
+#endif
+
+#endif /* _NN_ASM_H_ */
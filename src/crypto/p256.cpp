@@ -0,0 +1,544 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "p256.h"
+#include "nn_asm.h"
+
+#if NN_P256_FIELD
+
+/*
+ * Accumulate b * c into the 96-bit column accumulator (c2:c1:c0).
+ */
+#define MULADD(b, c) NN_MULADD(acc0, acc1, acc2, b, c)
+
+/*
+ * Accumulate 2 * b * c, used for the cross terms of a square.
+ */
+#define MULADD2(b, c) do {                                     \
+    NN_MULADD(acc0, acc1, acc2, b, c);                         \
+    NN_MULADD(acc0, acc1, acc2, b, c);                         \
+  } while (0)
+
+/*
+ * Store the low digit of the accumulator and shift it down one digit.
+ */
+#define COLUMN(out) do {                                       \
+    (out) = acc0;                                              \
+    acc0 = acc1;                                               \
+    acc1 = acc2;                                               \
+    acc2 = 0;                                                  \
+  } while (0)
+
+/*
+ * One step of a signed carry chain: r = low digit of t + carry.
+ */
+#define LIMB(r, t) do {                                        \
+    carry += (t);                                              \
+    (r) = (NN_DIGIT)carry;                                     \
+    carry >>= NN_DIGIT_BITS;                                   \
+  } while (0)
+
+static const NN_DIGIT p256_p[KEYDIGITS] = {
+  0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000,
+  0x00000000, 0x00000000, 0x00000001, 0xFFFFFFFF
+};
+
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             Folds a signed multiple of 2^256 back into r using
+ *                    2^256 = 2^224 - 2^192 - 2^96 + 1 mod p.
+ *                    Returns the new multiple of 2^256.
+ */
+static int64_t
+p256_fold(NN_DIGIT *r, int64_t top)
+{
+  int64_t carry = 0;
+
+  LIMB(r[0], (int64_t)r[0] + top);
+  LIMB(r[1], (int64_t)r[1]);
+  LIMB(r[2], (int64_t)r[2]);
+  LIMB(r[3], (int64_t)r[3] - top);
+  LIMB(r[4], (int64_t)r[4]);
+  LIMB(r[5], (int64_t)r[5]);
+  LIMB(r[6], (int64_t)r[6] - top);
+  LIMB(r[7], (int64_t)r[7] + top);
+
+  return carry;
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             r = r - m if r >= m, without branching on r.
+ *                    extra is a carry out of r (r is r + extra * 2^256).
+ */
+static void
+p256_cond_sub(NN_DIGIT *r, NN_DIGIT extra, const NN_DIGIT *m)
+{
+  NN_DIGIT t[KEYDIGITS];
+  NN_DIGIT mask;
+  NN_DOUBLE_DIGIT borrow = 0;
+  uint8_t i;
+
+  for(i = 0; i < KEYDIGITS; i++) {
+    NN_DOUBLE_DIGIT d = (NN_DOUBLE_DIGIT)r[i] - m[i] - borrow;
+    t[i] = (NN_DIGIT)d;
+    borrow = (d >> NN_DIGIT_BITS) & 1;
+  }
+
+  /* keep r - m unless it borrowed and there was no carry to absorb it */
+  mask = (NN_DIGIT)0 - (NN_DIGIT)((borrow & ~extra) & 1);
+  for(i = 0; i < KEYDIGITS; i++) {
+    r[i] = (r[i] & mask) | (t[i] & ~mask);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             r = r - p if r >= p, without branching on r.
+ */
+static void
+p256_final_sub(NN_DIGIT *r, NN_DIGIT extra)
+{
+  p256_cond_sub(r, extra, p256_p);
+}
+/*---------------------------------------------------------------------------*/
+void
+p256_reduce(NN_DIGIT *a, NN_DIGIT *c)
+{
+  int64_t carry = 0;
+  int64_t c0 = c[0], c1 = c[1], c2 = c[2], c3 = c[3],
+          c4 = c[4], c5 = c[5], c6 = c[6], c7 = c[7],
+          c8 = c[8], c9 = c[9], c10 = c[10], c11 = c[11],
+          c12 = c[12], c13 = c[13], c14 = c[14], c15 = c[15];
+
+  /*
+   * r = s1 + 2*s2 + 2*s3 + s4 + s5 - d1 - d2 - d3 - d4, summed per limb
+   */
+  LIMB(a[0], c0 + c8 + c9 - c11 - c12 - c13 - c14);
+  LIMB(a[1], c1 + c9 + c10 - c12 - c13 - c14 - c15);
+  LIMB(a[2], c2 + c10 + c11 - c13 - c14 - c15);
+  LIMB(a[3], c3 + 2*c11 + 2*c12 + c13 - c15 - c8 - c9);
+  LIMB(a[4], c4 + 2*c12 + 2*c13 + c14 - c9 - c10);
+  LIMB(a[5], c5 + 2*c13 + 2*c14 + c15 - c10 - c11);
+  LIMB(a[6], c6 + 3*c14 + 2*c15 + c13 - c8 - c9);
+  LIMB(a[7], c7 + 3*c15 + c8 - c10 - c11 - c12 - c13);
+
+  /* the carry is in [-4, 6], two folds always bring it to zero */
+  carry = p256_fold(a, carry);
+  p256_fold(a, carry);
+
+  p256_final_sub(a, 0);
+}
+/*---------------------------------------------------------------------------*/
+void
+p256_mult(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c)
+{
+  NN_DIGIT t[2 * KEYDIGITS];
+  NN_DIGIT acc0 = 0, acc1 = 0, acc2 = 0;
+
+  /* column 0 */
+  MULADD(b[0], c[0]);
+  COLUMN(t[0]);
+
+  /* column 1 */
+  MULADD(b[0], c[1]);
+  MULADD(b[1], c[0]);
+  COLUMN(t[1]);
+
+  /* column 2 */
+  MULADD(b[0], c[2]);
+  MULADD(b[1], c[1]);
+  MULADD(b[2], c[0]);
+  COLUMN(t[2]);
+
+  /* column 3 */
+  MULADD(b[0], c[3]);
+  MULADD(b[1], c[2]);
+  MULADD(b[2], c[1]);
+  MULADD(b[3], c[0]);
+  COLUMN(t[3]);
+
+  /* column 4 */
+  MULADD(b[0], c[4]);
+  MULADD(b[1], c[3]);
+  MULADD(b[2], c[2]);
+  MULADD(b[3], c[1]);
+  MULADD(b[4], c[0]);
+  COLUMN(t[4]);
+
+  /* column 5 */
+  MULADD(b[0], c[5]);
+  MULADD(b[1], c[4]);
+  MULADD(b[2], c[3]);
+  MULADD(b[3], c[2]);
+  MULADD(b[4], c[1]);
+  MULADD(b[5], c[0]);
+  COLUMN(t[5]);
+
+  /* column 6 */
+  MULADD(b[0], c[6]);
+  MULADD(b[1], c[5]);
+  MULADD(b[2], c[4]);
+  MULADD(b[3], c[3]);
+  MULADD(b[4], c[2]);
+  MULADD(b[5], c[1]);
+  MULADD(b[6], c[0]);
+  COLUMN(t[6]);
+
+  /* column 7 */
+  MULADD(b[0], c[7]);
+  MULADD(b[1], c[6]);
+  MULADD(b[2], c[5]);
+  MULADD(b[3], c[4]);
+  MULADD(b[4], c[3]);
+  MULADD(b[5], c[2]);
+  MULADD(b[6], c[1]);
+  MULADD(b[7], c[0]);
+  COLUMN(t[7]);
+
+  /* column 8 */
+  MULADD(b[1], c[7]);
+  MULADD(b[2], c[6]);
+  MULADD(b[3], c[5]);
+  MULADD(b[4], c[4]);
+  MULADD(b[5], c[3]);
+  MULADD(b[6], c[2]);
+  MULADD(b[7], c[1]);
+  COLUMN(t[8]);
+
+  /* column 9 */
+  MULADD(b[2], c[7]);
+  MULADD(b[3], c[6]);
+  MULADD(b[4], c[5]);
+  MULADD(b[5], c[4]);
+  MULADD(b[6], c[3]);
+  MULADD(b[7], c[2]);
+  COLUMN(t[9]);
+
+  /* column 10 */
+  MULADD(b[3], c[7]);
+  MULADD(b[4], c[6]);
+  MULADD(b[5], c[5]);
+  MULADD(b[6], c[4]);
+  MULADD(b[7], c[3]);
+  COLUMN(t[10]);
+
+  /* column 11 */
+  MULADD(b[4], c[7]);
+  MULADD(b[5], c[6]);
+  MULADD(b[6], c[5]);
+  MULADD(b[7], c[4]);
+  COLUMN(t[11]);
+
+  /* column 12 */
+  MULADD(b[5], c[7]);
+  MULADD(b[6], c[6]);
+  MULADD(b[7], c[5]);
+  COLUMN(t[12]);
+
+  /* column 13 */
+  MULADD(b[6], c[7]);
+  MULADD(b[7], c[6]);
+  COLUMN(t[13]);
+
+  /* column 14 */
+  MULADD(b[7], c[7]);
+  COLUMN(t[14]);
+  t[15] = acc0;
+
+  p256_reduce(a, t);
+}
+/*---------------------------------------------------------------------------*/
+void
+p256_sqr(NN_DIGIT *a, NN_DIGIT *b)
+{
+  NN_DIGIT t[2 * KEYDIGITS];
+  NN_DIGIT acc0 = 0, acc1 = 0, acc2 = 0;
+
+  /* column 0 */
+  MULADD(b[0], b[0]);
+  COLUMN(t[0]);
+
+  /* column 1 */
+  MULADD2(b[0], b[1]);
+  COLUMN(t[1]);
+
+  /* column 2 */
+  MULADD2(b[0], b[2]);
+  MULADD(b[1], b[1]);
+  COLUMN(t[2]);
+
+  /* column 3 */
+  MULADD2(b[0], b[3]);
+  MULADD2(b[1], b[2]);
+  COLUMN(t[3]);
+
+  /* column 4 */
+  MULADD2(b[0], b[4]);
+  MULADD2(b[1], b[3]);
+  MULADD(b[2], b[2]);
+  COLUMN(t[4]);
+
+  /* column 5 */
+  MULADD2(b[0], b[5]);
+  MULADD2(b[1], b[4]);
+  MULADD2(b[2], b[3]);
+  COLUMN(t[5]);
+
+  /* column 6 */
+  MULADD2(b[0], b[6]);
+  MULADD2(b[1], b[5]);
+  MULADD2(b[2], b[4]);
+  MULADD(b[3], b[3]);
+  COLUMN(t[6]);
+
+  /* column 7 */
+  MULADD2(b[0], b[7]);
+  MULADD2(b[1], b[6]);
+  MULADD2(b[2], b[5]);
+  MULADD2(b[3], b[4]);
+  COLUMN(t[7]);
+
+  /* column 8 */
+  MULADD2(b[1], b[7]);
+  MULADD2(b[2], b[6]);
+  MULADD2(b[3], b[5]);
+  MULADD(b[4], b[4]);
+  COLUMN(t[8]);
+
+  /* column 9 */
+  MULADD2(b[2], b[7]);
+  MULADD2(b[3], b[6]);
+  MULADD2(b[4], b[5]);
+  COLUMN(t[9]);
+
+  /* column 10 */
+  MULADD2(b[3], b[7]);
+  MULADD2(b[4], b[6]);
+  MULADD(b[5], b[5]);
+  COLUMN(t[10]);
+
+  /* column 11 */
+  MULADD2(b[4], b[7]);
+  MULADD2(b[5], b[6]);
+  COLUMN(t[11]);
+
+  /* column 12 */
+  MULADD2(b[5], b[7]);
+  MULADD(b[6], b[6]);
+  COLUMN(t[12]);
+
+  /* column 13 */
+  MULADD2(b[6], b[7]);
+  COLUMN(t[13]);
+
+  /* column 14 */
+  MULADD(b[7], b[7]);
+  COLUMN(t[14]);
+  t[15] = acc0;
+
+  p256_reduce(a, t);
+}
+/*---------------------------------------------------------------------------*/
+void
+p256_add(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c)
+{
+  NN_DOUBLE_DIGIT carry = 0;
+
+  carry += (NN_DOUBLE_DIGIT)b[0] + c[0]; a[0] = (NN_DIGIT)carry; carry >>= NN_DIGIT_BITS;
+  carry += (NN_DOUBLE_DIGIT)b[1] + c[1]; a[1] = (NN_DIGIT)carry; carry >>= NN_DIGIT_BITS;
+  carry += (NN_DOUBLE_DIGIT)b[2] + c[2]; a[2] = (NN_DIGIT)carry; carry >>= NN_DIGIT_BITS;
+  carry += (NN_DOUBLE_DIGIT)b[3] + c[3]; a[3] = (NN_DIGIT)carry; carry >>= NN_DIGIT_BITS;
+  carry += (NN_DOUBLE_DIGIT)b[4] + c[4]; a[4] = (NN_DIGIT)carry; carry >>= NN_DIGIT_BITS;
+  carry += (NN_DOUBLE_DIGIT)b[5] + c[5]; a[5] = (NN_DIGIT)carry; carry >>= NN_DIGIT_BITS;
+  carry += (NN_DOUBLE_DIGIT)b[6] + c[6]; a[6] = (NN_DIGIT)carry; carry >>= NN_DIGIT_BITS;
+  carry += (NN_DOUBLE_DIGIT)b[7] + c[7]; a[7] = (NN_DIGIT)carry; carry >>= NN_DIGIT_BITS;
+
+  p256_final_sub(a, (NN_DIGIT)carry);
+}
+/*---------------------------------------------------------------------------*/
+void
+p256_sub(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c)
+{
+  int64_t carry = 0;
+  NN_DIGIT mask;
+
+  LIMB(a[0], (int64_t)b[0] - c[0]);
+  LIMB(a[1], (int64_t)b[1] - c[1]);
+  LIMB(a[2], (int64_t)b[2] - c[2]);
+  LIMB(a[3], (int64_t)b[3] - c[3]);
+  LIMB(a[4], (int64_t)b[4] - c[4]);
+  LIMB(a[5], (int64_t)b[5] - c[5]);
+  LIMB(a[6], (int64_t)b[6] - c[6]);
+  LIMB(a[7], (int64_t)b[7] - c[7]);
+
+  /* add p back if the subtraction borrowed */
+  mask = (NN_DIGIT)carry;
+  carry = 0;
+  LIMB(a[0], (int64_t)a[0] + (p256_p[0] & mask));
+  LIMB(a[1], (int64_t)a[1] + (p256_p[1] & mask));
+  LIMB(a[2], (int64_t)a[2] + (p256_p[2] & mask));
+  LIMB(a[3], (int64_t)a[3] + (p256_p[3] & mask));
+  LIMB(a[4], (int64_t)a[4] + (p256_p[4] & mask));
+  LIMB(a[5], (int64_t)a[5] + (p256_p[5] & mask));
+  LIMB(a[6], (int64_t)a[6] + (p256_p[6] & mask));
+  LIMB(a[7], (int64_t)a[7] + (p256_p[7] & mask));
+}
+/*---------------------------------------------------------------------------*/
+/**
+ * \brief             a = b^(2^n) mod p.
+ */
+static void
+p256_sqr_n(NN_DIGIT *a, NN_DIGIT *b, uint8_t n)
+{
+  p256_sqr(a, b);
+  while(--n) {
+    p256_sqr(a, a);
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+p256_inv(NN_DIGIT *a, NN_DIGIT *b)
+{
+  NN_DIGIT x2[KEYDIGITS], x3[KEYDIGITS], x15[KEYDIGITS], x30[KEYDIGITS];
+  NN_DIGIT x32[KEYDIGITS], t[KEYDIGITS];
+
+  /* xk = b^(2^k - 1) */
+  p256_sqr(t, b);
+  p256_mult(x2, t, b);
+  p256_sqr(t, x2);
+  p256_mult(x3, t, b);
+  p256_sqr_n(t, x3, 3);
+  p256_mult(t, t, x3);          /* x6 */
+  p256_sqr_n(x15, t, 6);
+  p256_mult(x15, x15, t);       /* x12 */
+  p256_sqr_n(x15, x15, 3);
+  p256_mult(x15, x15, x3);
+  p256_sqr_n(x30, x15, 15);
+  p256_mult(x30, x30, x15);
+  p256_sqr_n(x32, x30, 2);
+  p256_mult(x32, x32, x2);
+
+  /*
+   * p - 2 = 1{32} 0{31} 1 0{96} 1{94} 0 1, from the top bit down
+   */
+  p256_sqr_n(t, x32, 32);
+  p256_mult(t, t, b);
+  p256_sqr_n(t, t, 128);
+  p256_mult(t, t, x32);
+  p256_sqr_n(t, t, 32);
+  p256_mult(t, t, x32);
+  p256_sqr_n(t, t, 30);
+  p256_mult(t, t, x30);
+  p256_sqr_n(t, t, 2);
+  p256_mult(a, t, b);
+}
+/*---------------------------------------------------------------------------*/
+/* group order n of secp256r1 */
+static const NN_DIGIT p256_n[KEYDIGITS] = {
+  0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD,
+  0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF
+};
+
+/* n - 2, the Fermat exponent */
+static const NN_DIGIT p256_n_minus_2[KEYDIGITS] = {
+  0xFC63254F, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD,
+  0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF
+};
+
+/* 2^512 mod n, converts into the Montgomery domain */
+static const NN_DIGIT p256_n_rr[KEYDIGITS] = {
+  0xBE79EEA2, 0x83244C95, 0x49BD6FA6, 0x4699799C,
+  0x2B6BEC59, 0x2845B239, 0xF3D95620, 0x66E12D94
+};
+
+/* -n^-1 mod 2^32 */
+#define P256_N0 0xEE00BC4F
+
+/**
+ * \brief             Montgomery multiplication a = b * c / 2^256 mod n
+ *                    (CIOS). a, b, c can be same.
+ */
+static void
+p256_mont_mult_n(NN_DIGIT *a, const NN_DIGIT *b, const NN_DIGIT *c)
+{
+  NN_DIGIT t[KEYDIGITS + 2];
+  NN_DOUBLE_DIGIT carry;
+  NN_DIGIT m;
+  uint8_t i, j;
+
+  memset(t, 0, sizeof(t));
+  for(i = 0; i < KEYDIGITS; i++) {
+    carry = 0;
+    for(j = 0; j < KEYDIGITS; j++) {
+      carry += (NN_DOUBLE_DIGIT)b[j] * c[i] + t[j];
+      t[j] = (NN_DIGIT)carry;
+      carry >>= NN_DIGIT_BITS;
+    }
+    carry += t[KEYDIGITS];
+    t[KEYDIGITS] = (NN_DIGIT)carry;
+    t[KEYDIGITS + 1] = (NN_DIGIT)(carry >> NN_DIGIT_BITS);
+
+    m = t[0] * (NN_DIGIT)P256_N0;
+    carry = (NN_DOUBLE_DIGIT)m * p256_n[0] + t[0];
+    carry >>= NN_DIGIT_BITS;
+    for(j = 1; j < KEYDIGITS; j++) {
+      carry += (NN_DOUBLE_DIGIT)m * p256_n[j] + t[j];
+      t[j - 1] = (NN_DIGIT)carry;
+      carry >>= NN_DIGIT_BITS;
+    }
+    carry += t[KEYDIGITS];
+    t[KEYDIGITS - 1] = (NN_DIGIT)carry;
+    t[KEYDIGITS] = t[KEYDIGITS + 1] + (NN_DIGIT)(carry >> NN_DIGIT_BITS);
+  }
+
+  p256_cond_sub(t, t[KEYDIGITS], p256_n);
+  memcpy(a, t, KEYDIGITS * NN_DIGIT_LEN);
+}
+/*---------------------------------------------------------------------------*/
+void
+p256_order_inv(NN_DIGIT *a, NN_DIGIT *b)
+{
+  NN_DIGIT table[16][KEYDIGITS];
+  NN_DIGIT t[KEYDIGITS];
+  NN_DIGIT one[KEYDIGITS];
+  uint8_t i, k;
+
+  /* table[i] = b^i in the Montgomery domain, table[0] = 1 */
+  memset(one, 0, sizeof(one));
+  one[0] = 1;
+  p256_mont_mult_n(table[1], b, p256_n_rr);
+  p256_mont_mult_n(table[0], one, p256_n_rr);
+  for(i = 2; i < 16; i++) {
+    p256_mont_mult_n(table[i], table[i - 1], table[1]);
+  }
+
+  /*
+   * Fixed 4-bit windows over the public exponent n - 2, so the sequence of
+   * operations does not depend on b.
+   */
+  memcpy(t, table[0], sizeof(t));
+  for(i = KEYDIGITS * NN_DIGIT_BITS / 4; i > 0; i--) {
+    uint8_t bit = (i - 1) * 4;
+    for(k = 0; k < 4; k++) {
+      p256_mont_mult_n(t, t, t);
+    }
+    p256_mont_mult_n(t, t,
+        table[(p256_n_minus_2[bit / NN_DIGIT_BITS] >> (bit % NN_DIGIT_BITS)) & 0xF]);
+  }
+
+  /* leave the Montgomery domain */
+  p256_mont_mult_n(a, t, one);
+}
+
+#endif /* NN_P256_FIELD */
@@ -0,0 +1,95 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef _P256_H_
+#define _P256_H_
+
+#include "nn.h"
+
+/**
+ * Dedicated field arithmetic modulo the secp256r1 prime
+ * p = 2^256 - 2^224 + 2^192 + 2^96 - 1, using fixed 8 x 32-bit limbs and
+ * the NIST fast reduction. When enabled NN_ModMultOpt and NN_ModSqrOpt use
+ * it instead of the generic omega reduction. Define NN_P256_FIELD to 0 to
+ * fall back to the generic code.
+ */
+#ifndef NN_P256_FIELD
+#if defined(SECP256R1) && defined(THIRTYTWO_BIT_PROCESSOR)
+#define NN_P256_FIELD 1
+#else
+#define NN_P256_FIELD 0
+#endif
+#endif
+
+#if NN_P256_FIELD
+
+/**
+ * \brief       Computes a = b * c mod p.
+ *              a, b, c can be same
+ *              Lengths: a[KEYDIGITS], b[KEYDIGITS], c[KEYDIGITS].
+ *              Result is fully reduced, in [0, p).
+ */
+void p256_mult(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c);
+
+/**
+ * \brief       Computes a = b^2 mod p.
+ *              a, b can be same
+ *              Lengths: a[KEYDIGITS], b[KEYDIGITS].
+ */
+void p256_sqr(NN_DIGIT *a, NN_DIGIT *b);
+
+/**
+ * \brief       Computes a = (b + c) mod p in constant time.
+ *              a, b, c can be same
+ *              Assumption: b, c are in [0, p)
+ */
+void p256_add(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c);
+
+/**
+ * \brief       Computes a = (b - c) mod p in constant time.
+ *              a, b, c can be same
+ *              Assumption: b, c are in [0, p)
+ */
+void p256_sub(NN_DIGIT *a, NN_DIGIT *b, NN_DIGIT *c);
+
+/**
+ * \brief       Computes a = c mod p with the NIST fast reduction
+ *              (FIPS 186-3, D.2.3).
+ *              Lengths: a[KEYDIGITS], c[2*KEYDIGITS].
+ */
+void p256_reduce(NN_DIGIT *a, NN_DIGIT *c);
+
+/**
+ * \brief       Computes a = b^-1 mod p as b^(p-2) with a fixed addition
+ *              chain (255 squares, 13 multiplies). Constant time.
+ *              a, b can be same
+ *              Lengths: a[KEYDIGITS], b[KEYDIGITS].
+ *              Assumption: b is in [1, p)
+ */
+void p256_inv(NN_DIGIT *a, NN_DIGIT *b);
+
+/**
+ * \brief       Computes a = b^-1 mod n, n the group order, as b^(n-2) with
+ *              Montgomery multiplication and fixed 4-bit windows. Constant
+ *              time.
+ *              a, b can be same
+ *              Lengths: a[KEYDIGITS], b[KEYDIGITS].
+ *              Assumption: b is in [1, n)
+ */
+void p256_order_inv(NN_DIGIT *a, NN_DIGIT *b);
+
+#endif /* NN_P256_FIELD */
+
+#endif /* _P256_H_ */
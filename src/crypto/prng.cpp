@@ -17,15 +17,22 @@
 
 #if defined(ESP8266)
 #include "esp8266_peri.h"  // Can use RANDOM_REG32
+#elif defined(ESP32)
+#include "esp_system.h"  // esp_fill_random
 #endif
 
 int prng(unsigned char *buf, size_t len) {
+  #if defined(ESP32)
+  // hardware RNG, mixed with RF noise while WiFi is up
+  esp_fill_random(buf, len);
+  #else
   while (len--) {
     #if defined(ESP8266)
-    *buf++ = RANDOM_REG32 % 255;
-    break;
+    *buf++ = (unsigned char)RANDOM_REG32;
+    #else
+    *buf++ = random(0, 256);
     #endif
-    *buf++ = random(0, 255);
   }
+  #endif
   return 1;
 }
@@ -0,0 +1,525 @@
+// AUTOGENERATED by gen_comb_table.py, DO NOT EDIT.
+// Fixed-base comb table for secp256r1, ECC_COMB_TEETH = 8.
+// Entry i-1 holds sum(2^(j*32) * G) over the bits j set in i.
+#include <Arduino.h>
+#include "ecc_fast.h"
+
+#if ECC_FIXED_BASE_COMB && defined(THIRTYTWO_BIT_PROCESSOR)
+#if ECC_COMB_TEETH != 8
+#error "secp256r1_comb.cpp was generated for a different ECC_COMB_TEETH"
+#endif
+
+const NN_DIGIT ecc_comb_table[ECC_COMB_POINTS][2][KEYDIGITS] PROGMEM = {
+  {{0xD898C296, 0xF4A13945, 0x2DEB33A0, 0x77037D81, 0x63A440F2, 0xF8BCE6E5, 0xE12C4247, 0x6B17D1F2},
+   {0x37BF51F5, 0xCBB64068, 0x6B315ECE, 0x2BCE3357, 0x7C0F9E16, 0x8EE7EB4A, 0xFE1A7F9B, 0x4FE342E2}},
+  {{0x185A5943, 0x3A5A9E22, 0x5C65DFB6, 0x1AB91936, 0x262C71DA, 0x21656B32, 0xAF22AF89, 0x7FE36B40},
+   {0x699CA101, 0xD50D152C, 0x7B8AF212, 0x74B3D586, 0x07DCA6F1, 0x9F09F404, 0x25B63624, 0xE697D458}},
+  {{0x8101E6E4, 0x16FC51FF, 0xFCCC3AC2, 0x830895E4, 0x4AA7358F, 0x608548C2, 0x0CEDC02A, 0xE3579822},
+   {0x52C392C3, 0xAAD2B998, 0xC523E6EF, 0xF0570BED, 0x768A3299, 0xF3E4B396, 0x1F433A2D, 0x700F948E}},
+  {{0x8E14DB63, 0x90E75CB4, 0xAD651F7E, 0x29493BAA, 0x326E25DE, 0x8492592E, 0x2811AAA5, 0x0FA822BC},
+   {0x5F462EE7, 0xE4112454, 0x50FE82F5, 0x34B1A650, 0xB3DF188B, 0x6F4AD4BC, 0xF5DBA80D, 0xBFF44AE8}},
+  {{0x097992AF, 0x93391CE2, 0x0D35F1FA, 0xE96C98FD, 0x95E02789, 0xB257C0DE, 0x89D6726F, 0x300A4BBC},
+   {0xC08127A0, 0xAA54A291, 0xA9D806A5, 0x5BB1EEAD, 0xFF1E3C6F, 0x7F1DDB25, 0xD09B4644, 0x72AAC7E0}},
+  {{0xEE4039A0, 0xD6E260F8, 0x6C224571, 0xE0D3EB33, 0x680A7DAA, 0xA9CAD33B, 0x606A4A62, 0x14CB5692},
+   {0x9D83BC01, 0xFE93D315, 0x8039927C, 0x5205EF8D, 0x997A9A3B, 0x878487ED, 0x3E1E4663, 0x53098CFA}},
+  {{0xD945111E, 0x30368CB6, 0xF5C4AD42, 0x585A137E, 0xFFEA17C1, 0xC22C48C5, 0x958F1608, 0xA5AB9E10},
+   {0x785B4ED9, 0xC34A47B8, 0x49A10F77, 0x46ED771C, 0xAD0648F4, 0x629E17EB, 0x8B1AA09A, 0xD3EBC611}},
+  {{0x7512218E, 0xA84AA939, 0x74CA0141, 0xE9A521B0, 0x18A2E902, 0x57880B3A, 0x12A677A6, 0x4A5B5066},
+   {0x4C4F3840, 0x0BEADA7A, 0x19E26D9D, 0x626DB154, 0xE1627D40, 0xC42604FB, 0xEAC089F1, 0xEB13461C}},
+  {{0xCC049786, 0xC761C1FE, 0x5E98C12D, 0x48F9C187, 0xFD208DFB, 0x00D1A0A5, 0xA0642197, 0x418D68DE},
+   {0x51B50759, 0x481EEF55, 0xC16CAAD0, 0x17429C50, 0x2EF8D320, 0x43563962, 0xA5BA6DD4, 0x5D7B26F6}},
+  {{0x27A43281, 0xF9FAED09, 0x4103ECBC, 0x5E52C414, 0xA815C857, 0xC342967A, 0x1C6A220A, 0x0781B829},
+   {0xEAC55F80, 0x5A8343CE, 0xE54A05E3, 0x88F80EEE, 0x12916434, 0x97B2A14F, 0xF0151593, 0x690CDE8D}},
+  {{0xE38E3820, 0xC52C00CA, 0xDD561BEC, 0x82D789A6, 0x74647EBE, 0x54A0FE52, 0xA7B5D4FB, 0x57F62EEC},
+   {0x48F81460, 0xAA60759D, 0xEC356DCE, 0x0D300594, 0xEFEA8F48, 0x60E9C067, 0x89BFE2AD, 0x5E5FF8BF}},
+  {{0xFA3289D5, 0x5920D7B0, 0x28994439, 0x54D5DAD9, 0x27CAA747, 0x27035D26, 0x88E9843C, 0x91C821D4},
+   {0x9AA8A566, 0xE130DEAD, 0x0408EBAD, 0x7B7DF6EA, 0x34938DAC, 0x919ADC37, 0x8F879F44, 0xDB7AECC7}},
+  {{0xC6FAE6D7, 0xBC499EE7, 0x7E1C792E, 0xEDDF9C6C, 0x5BF70C35, 0xC9C6F541, 0x90422D81, 0x06F0AFDB},
+   {0x4DBC747A, 0x214F0AD0, 0xAF7AE617, 0x41A7CF1A, 0xDDE64646, 0x7BAB8955, 0x3F9804C4, 0x77F9E8F7}},
+  {{0xC96900D8, 0x5D01A765, 0x5E4EC965, 0xF0698FF7, 0xBCDF6567, 0x92052D44, 0xD6536C02, 0xBC07BB82},
+   {0x83762C71, 0x5FE58CCF, 0xC2E7BA73, 0x635F210E, 0xC7B19A1E, 0xA17BF29F, 0x1D90902A, 0xEB165F9C}},
+  {{0xF2159928, 0xAF972B45, 0x4760C41E, 0xD86848C8, 0x6B47957B, 0x269843F1, 0x2086A46C, 0xE018AAA2},
+   {0x99698420, 0x21A03322, 0x4FED7BB9, 0xD36D88B3, 0xBA0DBC83, 0xF2FE8863, 0x7F10EE50, 0x383F4DB0}},
+  {{0xD789BD85, 0x57C84FC9, 0xC297EAC3, 0xFC35FF7D, 0x88C6766E, 0xFB982FD5, 0xEEDB5E67, 0x447D739B},
+   {0x72E25B32, 0x0C7E33C9, 0xA7FAE500, 0x3D349B95, 0x3A4AAFF7, 0xE12E9D95, 0x834131EE, 0x2D4825AB}},
+  {{0x2A1D367F, 0x13949C93, 0x1A0A11B7, 0xEF7FBD2B, 0xB91DFC60, 0xDDC6068B, 0x8A9C72FF, 0xEF951932},
+   {0x7376D8A8, 0x196035A7, 0x95CA1740, 0x23183B08, 0x022C219C, 0xC1EE9807, 0x7DBB2C9B, 0x611E9FC3}},
+  {{0x0AF44892, 0x9DDA03E1, 0xFFA77F1E, 0xDD78A219, 0x8AEE6CBA, 0x67AA472A, 0xA822A856, 0xE42C3142},
+   {0xF20DB957, 0xBEE346FE, 0xD00F7365, 0xBD464186, 0x032C4F8E, 0x21774E51, 0xC011817A, 0x8AD034D0}},
+  {{0xD94B1A05, 0x1F969276, 0xADF9E430, 0xCA9B1154, 0x4B3CF7FB, 0x8930DE36, 0xB9A7112B, 0x4EE298BB},
+   {0xCABA1C4A, 0xC7551F59, 0xFB972962, 0x79A86B84, 0xB38A628C, 0xE47C8AC6, 0x463A6A4C, 0x2CBBF338}},
+  {{0x0B57F4BC, 0xCAE2B192, 0xC6C9BC36, 0x2936DF5E, 0xE11238BF, 0x7DEA6482, 0x7B51F5D8, 0x55066379},
+   {0x348A964C, 0x44FFE216, 0xDBDEFBE1, 0x9FB3D576, 0x8D9D50E5, 0x0AFA4001, 0x8AECB851, 0x15716484}},
+  {{0xFC5CDE01, 0xE48ECAFF, 0x0D715F26, 0x7CCD84E7, 0xF43E4391, 0xA2E8F483, 0xB21141EA, 0xEB5D7745},
+   {0x731A3479, 0xCAC917E2, 0x2844B645, 0x85F22CFE, 0x58006CEE, 0x0990E6A1, 0xDBECC17B, 0xEAFD72EB}},
+  {{0xA7DDE09F, 0x9F95A5AB, 0x221AA522, 0xC1E70873, 0x724A8B0A, 0x3774353A, 0xF0FE9DFE, 0xB942B33F},
+   {0x34FC7653, 0xE9601AC3, 0xC2BEAA26, 0xAE3E0880, 0x4FAB6AE5, 0xD6C52E03, 0xA61E51EF, 0x0B909273}},
+  {{0x1A780592, 0x91BA25B5, 0x1500D337, 0xEE59A574, 0x9288E474, 0xE36F1C44, 0xD85F6D65, 0xD3E89ACC},
+   {0xD8871D87, 0x0F5590EC, 0x92E2F47A, 0x565C81CA, 0x841FB007, 0x55942307, 0xA5DC1163, 0xA4F12B40}},
+  {{0x471BD072, 0x298AD9C1, 0xF6D4B375, 0xB286A3B3, 0xDA5F8ABD, 0xB6CBD28C, 0x700BA968, 0x529DC0B0},
+   {0xAA8C414A, 0x44672963, 0xBC3089DA, 0x99685E9C, 0x1E39FCE6, 0x9AB4C983, 0xC49BC6A7, 0x9B5426C7}},
+  {{0xAB0C3E88, 0x1FE36FFC, 0xBA8303D2, 0xC2B3B386, 0xADC757CA, 0x72AABF6E, 0x5EEC7013, 0x1240B6FD},
+   {0x1A9310A3, 0x106308A8, 0x2C136832, 0xB9F4AB88, 0xF43CC68F, 0x48A48000, 0x214B70D9, 0xE54F16A7}},
+  {{0x0FEE06C8, 0xD9D5E5C8, 0x41D13F39, 0x8BF29817, 0xFDAA2B5F, 0x7F25BF81, 0x5EC68BBF, 0x0A70F85C},
+   {0xD5E4D954, 0xF2CFC922, 0x83421B3D, 0x5D404051, 0x20A2E32F, 0x383E025C, 0x848EF239, 0x63228D59}},
+  {{0x52FFCEF3, 0xBAF7D307, 0x9EEC8A3E, 0x46B57E18, 0xF7EA3BDB, 0x77A91D71, 0x2BC76AF7, 0x771F4575},
+   {0xFCE5C8B5, 0xD918B424, 0x53DF5F8F, 0xEF6A2851, 0x2615A6D0, 0xC375B434, 0x42161A6E, 0x32E41149}},
+  {{0x5543F33F, 0xFA268BC1, 0x79A1E862, 0x057848F6, 0xE778C5D5, 0x2ACC9E80, 0x1F24FB5C, 0x81CF6721},
+   {0x0F94BCE2, 0x87656E35, 0x9851BB7E, 0x9650C9C8, 0x92E85C53, 0x0D41954D, 0x45B0A71A, 0xEF55045A}},
+  {{0x9EF0F09E, 0xEA5D651D, 0xCAD74DC7, 0x2FE6A994, 0x8003A37E, 0xA6C44B75, 0x8579357A, 0xDB525471},
+   {0x2ED0F0B1, 0x8732A3E3, 0xB0BB5647, 0xBE207A55, 0x32D4ECEB, 0x4335FDE2, 0x72C4AD3E, 0x91B67E63}},
+  {{0xAB018C7E, 0xCDEDCB0D, 0xAD8CEE06, 0xF29E7E82, 0xC417B614, 0x7CE355B7, 0xF8BFF7EB, 0xCD20145A},
+   {0xE5457EB3, 0xAEC6A202, 0x75459F98, 0xEF934B95, 0xC00F55DE, 0x10475DF1, 0xCB510C09, 0xD4619F15}},
+  {{0x152B9A0E, 0x7FF55FC4, 0x8473875D, 0x3F68C71C, 0x57862556, 0xE52B3F50, 0x97B14C6E, 0xE3DDB10A},
+   {0x68DBA9F2, 0x36758574, 0xD269DE87, 0xD1D4F5DD, 0x41C3DEF2, 0x57392917, 0x72836177, 0xD3B0F1BF}},
+  {{0xF7F82F2A, 0xAEE9C75D, 0x4AFDF43A, 0x9E4C3587, 0x37371326, 0xF5622DF4, 0x6EC73617, 0x8A535F56},
+   {0x223094B7, 0xC5F9A0AC, 0x4C8C7669, 0xCDE53386, 0x085A92BF, 0x37E02819, 0x68B08BD7, 0x0455C084}},
+  {{0x374E4457, 0x9BF49908, 0x5EECB703, 0x40BF984B, 0x68F1F6F1, 0x9B6F997E, 0x9D565A0C, 0x47B54B04},
+   {0x69900111, 0x241301C3, 0x776F48BB, 0x4E2A6EA3, 0x0FEB1CC1, 0x77368E75, 0x15A4A7DF, 0xE7AFEA29}},
+  {{0x9477B5D9, 0x0C0A6E2C, 0x876DC444, 0xF9A4BF62, 0xB6CDC279, 0x5050A949, 0xB77F8276, 0x06BADA7A},
+   {0xEA48DAC9, 0xC8B4AED1, 0x7EA1070F, 0xDEBD8A4B, 0x1366EB70, 0x427D4910, 0x0E6CB18A, 0x5B476DFD}},
+  {{0xD961D446, 0x03220FB8, 0x0626C5D7, 0x176324E4, 0x722425CC, 0xD43B2EBC, 0x86DBC8F8, 0x29D6274E},
+   {0xC08D73DB, 0x58185A44, 0xE1239EA5, 0x9C8C1CBF, 0xBAC64731, 0x2B1CFE87, 0xA5816948, 0x6C16B472}},
+  {{0x23A81FFB, 0xE2753CB1, 0xB82A9F20, 0x22278FA5, 0xF09C4BE2, 0x4B032745, 0x059FFD23, 0x5F68C836},
+   {0x1DBF8F8D, 0xBF3AE369, 0xF9FB8D66, 0xB2B1552C, 0x34925367, 0x0C84BFB3, 0x9E109AF7, 0x0639E57E}},
+  {{0xC60C4684, 0xD8218845, 0x0859A19E, 0x66A66447, 0x3ED6DFCA, 0x9E18931E, 0x6FEA0609, 0x3B5B03E6},
+   {0xA9D7EDBB, 0xD8BC19B5, 0x64477877, 0x95FFD112, 0xF35C8263, 0x2CD1CA07, 0x38E14DDC, 0x76F1E0C8}},
+  {{0x611D1A41, 0xA3D21037, 0x4B11663F, 0x62B730A1, 0xEDF0F22E, 0x9EBD9FA2, 0xCB79EA5A, 0x2C1A2336},
+   {0xAC53B363, 0x294B5675, 0x729CB7FE, 0x2C2988BE, 0xB587C2E9, 0x146454FF, 0x1DFC32E7, 0x2E1C4770}},
+  {{0x67429E4D, 0x8722658C, 0x0561F51E, 0xBE9522AA, 0xD9D59F46, 0x3D622057, 0x89EF69A2, 0x76E96B46},
+   {0xB797FAED, 0x16AA0650, 0x15FF8993, 0x75B78E22, 0x27F9FB88, 0x1575C0CB, 0xF705E319, 0xCF218959}},
+  {{0x278C340A, 0x7C5C3E44, 0x12D66F3B, 0x4D546068, 0xAE23C5D8, 0x29A751B1, 0x8A2EC908, 0x3E29864E},
+   {0x26DBB850, 0x142D2A66, 0x765BD780, 0xAD1744C4, 0xE322D1ED, 0x1F150E68, 0x3DC31E7E, 0x239B90EA}},
+  {{0x87617F0E, 0xCF15DC9C, 0x6858D44B, 0x85B40DEE, 0x121421DE, 0xA96C9E4B, 0x05D45C5A, 0x191EB33A},
+   {0x199CF43B, 0xC9C16E10, 0x28EE6E02, 0xF245C57B, 0x45E9654F, 0xF3EB80DD, 0x592282A1, 0x8A9365FF}},
+  {{0x7A53322A, 0x78C41652, 0x09776F8E, 0x305DDE67, 0xF8862ED4, 0xDBCAB759, 0x49F72FF7, 0x820F4DD9},
+   {0x2B5DEBD4, 0x6CC544A6, 0x7B4E8CC4, 0x75BE5D93, 0x215C14D3, 0x1B481B1B, 0x783A05EC, 0x140406EC}},
+  {{0x7E0E3190, 0x44F65F50, 0xEA3F501A, 0x1370D12F, 0x8C6615B0, 0xB8635F9A, 0xB3CD1C0F, 0xFF29DC0F},
+   {0x738114F6, 0x07F8A15D, 0xEECC62E3, 0x14DEF0AB, 0x09B8E6B6, 0x24DD6595, 0x3439A422, 0xC43831F3}},
+  {{0x93501899, 0x42293CDF, 0x1CC1E2E5, 0xE7F0390C, 0xCBF28253, 0xE1EF732A, 0x1F2B6B79, 0xE21F15F3},
+   {0xD622619A, 0xCFC0F97C, 0x726B5A08, 0xC056B494, 0x4D24EE97, 0x38C94CB1, 0xBC052D44, 0x4A3FC23C}},
+  {{0x60D54267, 0xA30935F7, 0x652F6CD5, 0x5C5093BA, 0x0B854DA9, 0x8720D196, 0x2C10D86C, 0xF361D706},
+   {0x723B99E4, 0xD11A3D27, 0x2F7D40C8, 0x8A18CE4B, 0xC3D3516D, 0x44BDB2FA, 0x6B183CFB, 0x2C990DBB}},
+  {{0x96480CA6, 0xED303F4C, 0xCE200B86, 0xE2DBE559, 0x4CEB95A3, 0x87704E32, 0x21CD1C8D, 0x5991DAA2},
+   {0x75C04EE0, 0x20A4BDAD, 0xD3AB3659, 0x9FE5ED7D, 0x1DD427E8, 0x0EFB4BEA, 0x8CE1431A, 0xDE5D5896}},
+  {{0xA52342B3, 0xAF31D989, 0xC03EB194, 0x918E1FB4, 0x6B6CB7B9, 0x303E35F0, 0xE062A8C2, 0x33FEF524},
+   {0x512E5BC0, 0x692A4FBE, 0xF5162C74, 0x067CFB0D, 0x20859BD2, 0x519AD6FF, 0xD84DBD4E, 0x0A5B4CAA}},
+  {{0xFBB7F12D, 0x4193640B, 0xDFD6C3F3, 0xEF8BF285, 0x010729AC, 0x23FE7442, 0x2C214CD9, 0xFF25F55A},
+   {0xF30F0FC8, 0xD77BF411, 0x2AB82B74, 0x1A08EBC7, 0x74A58D77, 0x00C15BA7, 0x8A405100, 0x94F114D3}},
+  {{0xD0A62B2C, 0x1FD07AB7, 0x9F776819, 0x31C6F056, 0x8EDC0D13, 0xE0443B93, 0x63AE46A6, 0x1B9D594E},
+   {0xC14453E5, 0x5AB358FC, 0x9A58AB51, 0xFB52863B, 0x01683CEF, 0x473AB211, 0xED96C8E1, 0xED16BA54}},
+  {{0x29BA369A, 0x2641769D, 0xCD922263, 0xE498612F, 0x1898EAD9, 0x861B8E4C, 0x95BAF610, 0xC3948BD4},
+   {0x3FF24345, 0xB529A79B, 0xBE0A3DA8, 0xA2B8624A, 0x94743717, 0x2F5B7F80, 0x218A7B61, 0xBE92ADA7}},
+  {{0xFD943A71, 0xEF977470, 0xEF2D93E1, 0x2DBFBC52, 0x62B812A7, 0xFBE20B47, 0x3EF44B43, 0xA1547557},
+   {0x89BC18D0, 0xF18068CB, 0xB7E40A72, 0xD0702163, 0x92EFAF4F, 0xB5115AD4, 0x8C4B8A43, 0x384D5627}},
+  {{0xC0B0755E, 0x80D58211, 0xB4CACF23, 0xCA274A6D, 0xECF21B69, 0xAE21F1B4, 0x03B2B318, 0x8D84F419},
+   {0x9F10418F, 0xC518F894, 0xD91762A0, 0xC73B5FDF, 0xEC26C110, 0xC98ECBF6, 0x6953FD62, 0x15BCD7D0}},
+  {{0x061457FE, 0xC877DB08, 0xC6471595, 0x60EB5C88, 0x808EC0ED, 0x03CE1E41, 0xE27F462A, 0x4A014325},
+   {0xA4FBA4FC, 0x7961A1CD, 0x662743C7, 0x206D4BEB, 0x41CDA791, 0x47F12714, 0x2F381BB9, 0xB069F7E0}},
+  {{0xCB87DEA8, 0x6E6F4859, 0x39546374, 0x4787EC66, 0x6121B977, 0x1CBF27B3, 0x44E182AB, 0xCA7EE915},
+   {0x7F985B5B, 0x40BD566D, 0x6D5FDB9A, 0x4225339A, 0x2FC8C2A3, 0x4CD02584, 0x70F14A3D, 0x0D4C0016}},
+  {{0x9B6D8676, 0x9A89A4CC, 0xAD3055B9, 0xCBE46247, 0x6B4F6A92, 0x8A8C8B10, 0x570E8F0F, 0xD96633A7},
+   {0xE8B04CC1, 0xD1FDA6E8, 0x40BA4A72, 0x215D4CE6, 0xF64C3358, 0xD7533270, 0x9825B9FD, 0x4D144DEA}},
+  {{0x66FDC380, 0xA3BAAF1D, 0x4CD0C836, 0x1B08F73D, 0x9D67FF49, 0x563F9FBA, 0x5AF864EC, 0x1577ACA8},
+   {0x0C0B7B43, 0xE61A8C7E, 0xA8E5EC0A, 0xCDBE96B5, 0x8E1D9252, 0xE3061205, 0x138E5EF8, 0x78286CC9}},
+  {{0x253BCBF0, 0x0F8364C4, 0x03BB9180, 0xF26390C7, 0xAD1E3BB3, 0x4EBCCDA4, 0x85A5D1EB, 0xB08C91A3},
+   {0xB643475C, 0x60DC9158, 0x2BA0101B, 0x39BD97D6, 0xC502FBE0, 0x6FD29D96, 0x3158A73C, 0xB8FE20C1}},
+  {{0xE0106368, 0xFC0DDF3B, 0x93F52B68, 0xD3C72BA5, 0xA8787924, 0x7C6BDF85, 0x532189D3, 0x9645C64A},
+   {0x824E2771, 0x58D3CC9B, 0x6E82DC91, 0x9B7E75E1, 0xE0ED1CC0, 0xBF4EC9F6, 0x3260F488, 0xFFB683E6}},
+  {{0xA4F0C81B, 0x8821C701, 0x881D4342, 0xEAA11D49, 0x79A87EEF, 0x346FAB79, 0x39848086, 0xA9C3643E},
+   {0xF6C6E053, 0xE040A053, 0xE1F9D4BA, 0x0D287400, 0xBD4AA53C, 0xA48CF15D, 0x11E94CEF, 0x76CDF40C}},
+  {{0x7EF30E41, 0x3F023041, 0x4CE753C8, 0x9184493F, 0x2A7516CA, 0x5A228849, 0x660402F4, 0x97C0AF3A},
+   {0x8A23E934, 0xD0DB8CE7, 0xE707A0B2, 0x4F22360C, 0x2032D181, 0xB487DBB9, 0xCB5623FD, 0xC6D1B0F9}},
+  {{0x2BC5C755, 0x8746F483, 0x775A0FE2, 0x3DC6F57F, 0x0F21C2C9, 0x87BCCBE9, 0xEAE51818, 0xDB93A6B1},
+   {0xA87AA88A, 0xF5754A37, 0x73972E83, 0x2791BF54, 0xDEAC962D, 0x65FE92B6, 0x5DB3C2A5, 0x7675343A}},
+  {{0x1C77336E, 0x5C2CE444, 0xD14B1A55, 0x6FD6234A, 0x10C24E9E, 0x1E25C808, 0xD88C3194, 0x7E941CEF},
+   {0xE4B9453F, 0xBFA7A9BA, 0xDB055169, 0x6256B1BF, 0xD4956F06, 0x835E6CD4, 0x2948048D, 0x7D3BCF9D}},
+  {{0x18064104, 0x82480753, 0x0891878C, 0xF3C2F9C4, 0x29AF296D, 0x1D6CBEF1, 0x55B9ED41, 0xA57DDAA3},
+   {0x903A1CDF, 0x4F47C7F1, 0x197DB90D, 0x45057FCF, 0xCA13FA12, 0xC125BB25, 0xD7F746DF, 0x5BCFD6F3}},
+  {{0x313728BE, 0x6CF20FFB, 0xA3C6B94A, 0x96439591, 0x44315FC5, 0x2736FF83, 0xA7849276, 0xA6D39677},
+   {0xC357F5F4, 0xF2BAB833, 0x2284059B, 0x824A920C, 0x2D27ECDF, 0x66B8BABD, 0x9B0B8816, 0x674F8474}},
+  {{0x677C8A3E, 0x2DF48C04, 0x0203A56B, 0x74E02F08, 0xB8C7FEDB, 0x31855F7D, 0x72C9DDAD, 0x4E769E76},
+   {0xB824BBB0, 0xA4C36165, 0x3B9122A5, 0xFB9AE16F, 0x06947281, 0x1EC00572, 0xDE830663, 0x42B99082}},
+  {{0xBB162B85, 0x40B11C79, 0x5A890653, 0x426E2F71, 0x7586E3C3, 0xE9E180A6, 0x65DBB34A, 0x507B542A},
+   {0xE489B8AD, 0x225F912A, 0x301369C1, 0x33520333, 0xD338ECDE, 0xCA383CE7, 0xD11A51D6, 0x5EB5701E}},
+  {{0xFBCBC0C3, 0x490E66BC, 0x15065B98, 0xE8D7B164, 0x3E1A841C, 0xF2F80E3E, 0x7696FCF5, 0x62D4A49F},
+   {0xF521F731, 0x86EDDEE7, 0x77305B14, 0x90337684, 0xF36FA83E, 0x56193ECB, 0xD347D332, 0xD18B33EB}},
+  {{0xDDA868B9, 0x6EF95150, 0x9C0CE131, 0xD1F89E79, 0x08A1C478, 0x7FDC1CA0, 0x1C6CE04D, 0x78878EF6},
+   {0x1FE0D976, 0x9C62B912, 0xBDE08D4F, 0x6ACE570E, 0x12309DEF, 0xDE53142C, 0x7B72C321, 0xB6CB3F5D}},
+  {{0xC31A3573, 0x7F991ED2, 0xD54FB496, 0x5B82DD5B, 0x812FFCAE, 0x595C5220, 0x716B1287, 0x0C88BC4D},
+   {0x5F48ACA8, 0x3A57BF63, 0xDF2564F3, 0x7C8181F4, 0x9C04E6AA, 0x18D1B5B3, 0xF3901DC6, 0xDD5DDEA3}},
+  {{0xFB696D7B, 0x8B030FEA, 0x400CFA69, 0x9D11BDCA, 0x8FA8A597, 0x3BCFB88D, 0xFF476EF0, 0xAA59E783},
+   {0x88F5A016, 0xFBAD3413, 0x5C0ABA02, 0x2A4147FA, 0xD831450E, 0xDA2C96D0, 0x30E77DD1, 0x30A12AAD}},
+  {{0x30076ED0, 0xDFA412E5, 0xECE43EFE, 0x90E7EFC3, 0xE9C9C2A2, 0x7D021B57, 0xB498993D, 0xE3DDF1B7},
+   {0x846B4D7E, 0x5B955C48, 0xAE7C855E, 0x959131AD, 0x77227A7B, 0x8490E467, 0xA60CE85F, 0x283833A8}},
+  {{0x2FB3062C, 0xFB5A3D22, 0xB65437EC, 0x5682157E, 0x76FD0872, 0x7657711B, 0x4AD70BCC, 0xCE6D933A},
+   {0xFC3E65C1, 0xA9CEBBA1, 0xD4111C9D, 0x0FDA9930, 0x9A834DD3, 0xD1EDB57B, 0x5D2C8BB7, 0xA8839960}},
+  {{0x8C4150CC, 0x88BC6C8D, 0xAD6C3923, 0x73758B21, 0x29928820, 0xD43A7503, 0x95EA9FEB, 0x790ECF86},
+   {0x1BFB5292, 0x59A580F7, 0x9F51DE15, 0x0F7A900F, 0x9D6239F6, 0xF444C49A, 0xD87DECF6, 0xE340D641}},
+  {{0x1026B033, 0x1EBB28AC, 0x3A50D3AC, 0xFF199A09, 0xE869A58E, 0xA2C053E4, 0x414DD6BE, 0xB05E35AA},
+   {0x6754449F, 0xFBCB4C4A, 0xF8427D60, 0xC25C0899, 0xC5AE69DE, 0xD7E45688, 0x6646039A, 0x47270F9C}},
+  {{0xE872889A, 0x0DFAB50A, 0x703913A8, 0xFAB939D7, 0x16B20242, 0x4EBC7144, 0xD2F8BAE8, 0x22BC5020},
+   {0x9D713946, 0xABEAAAE6, 0x3EF21012, 0x3C2CD39E, 0xAEF98A9B, 0xAC67692C, 0x78E64C2E, 0x616222E4}},
+  {{0xB6A8A95D, 0xFFCDCC28, 0xF068C865, 0x61948CC6, 0x48A3FBB6, 0x02790B8C, 0x93239BC6, 0xFAA43BED},
+   {0x77A8FE3D, 0x97747046, 0x3E4708BD, 0x5F83CA7A, 0x43482E7D, 0x1388E9E2, 0x026921CA, 0xD21A75F1}},
+  {{0xA15BBAE6, 0x7549F1B1, 0x8BA6BBCF, 0xA9C4EBBC, 0x3AB26D77, 0xF3DEB351, 0x7F94BBB6, 0xFD3BCF2D},
+   {0x46FE3DDC, 0xFA8344D7, 0xD2F4FDAB, 0xBAD3E545, 0xF8DE5D37, 0xBA4CCB8E, 0xD97112DB, 0xADA514FE}},
+  {{0x8BCF4DBF, 0x017FA5E2, 0x80217643, 0xABCAEADA, 0x4BBF5A9F, 0xEFB61274, 0x5144598E, 0xF28DC88B},
+   {0xB384A585, 0x2FD4905E, 0x73DF56D7, 0x30987256, 0x671DD081, 0xE1913CA6, 0x8249B59B, 0x1A242940}},
+  {{0x1F70723F, 0xDA398393, 0xB21AC825, 0x6CFE750A, 0xF4EB6E64, 0x92C6A768, 0x47C9E925, 0x4290DB0B},
+   {0x413464C5, 0xF9D2FB88, 0xC8971F1A, 0x64AA8AD3, 0xF2EBCD3C, 0x263BEAD1, 0x3374C163, 0xB5D01E33}},
+  {{0x3E72AD0C, 0xE96A79FB, 0x42BA792F, 0x43A0A28C, 0x083E49F3, 0xEFE0A423, 0x6B317466, 0x68F344AF},
+   {0x3FB24D4A, 0xCDFE17DB, 0x71F5C626, 0x668BFC22, 0x24D67FF3, 0x604ED93C, 0xF8540A20, 0x31B9C405}},
+  {{0xA2582E7F, 0xD36B4789, 0x4EC39C28, 0x0D1A1014, 0xEDBAD7A0, 0x663C62C3, 0x6F461DB9, 0x4052BF4B},
+   {0x188D25EB, 0x235A27C3, 0x99BFCC5B, 0xE724F339, 0x71D70CC8, 0x862BE6BD, 0x90B0FC61, 0xFECF4D51}},
+  {{0x15A27295, 0x63FEC45F, 0x74D2B111, 0xA41A773E, 0x12DDE90D, 0x9341BC09, 0xAA83C35C, 0x5583DAFA},
+   {0x05F406F4, 0xBC93AE0B, 0xC427F2EC, 0xCF73A836, 0x2C6E92A6, 0x0AF26BE5, 0x49B67CD6, 0xE096722B}},
+  {{0x00AEF6E0, 0xF4B1AD53, 0x92448EC8, 0x51D353E9, 0x4F5F7050, 0xBDA23624, 0x5172DDF2, 0x38641E4C},
+   {0x0DAFE306, 0xD076B5AE, 0x042F9B7F, 0xBAF02E13, 0x7BB9888D, 0xEFB76553, 0xEEE3A756, 0x28AC3017}},
+  {{0xA1D4CFAC, 0x74346C10, 0x8526A7A4, 0xAFDF5CC0, 0xF62BFF7A, 0x123202A8, 0xC802E41A, 0x1EDDBAE2},
+   {0xD603F844, 0x8FA0AF2D, 0x4C701917, 0x36E06B7E, 0x73DB33A0, 0x0C45F452, 0x560EBCFC, 0x43104D86}},
+  {{0x0D1D78E5, 0x9615B511, 0x25C4744B, 0x66B0DE32, 0x6AAF363A, 0x0A4A46FB, 0x84F7A21C, 0xB48E26B4},
+   {0x21A01B2D, 0x06EBB0F6, 0x8B7B0F98, 0xC004E404, 0xFED6F668, 0x64131BCD, 0x4D4D3DAB, 0xFAC01540}},
+  {{0x72600E54, 0xFF8D09C0, 0x10203D11, 0x1960EDAF, 0x377756FC, 0x429DD48F, 0x884D880E, 0x4FA4A1EA},
+   {0x8D24AD69, 0x7FA9EAF1, 0xAE16E60F, 0x4B9A578C, 0x35364B6A, 0x7E8849F3, 0x426F03FE, 0x3A6681DB}},
+  {{0x8FA9F0A4, 0x62427D34, 0xA7621AA3, 0xEF92AAC0, 0x6BC20D7F, 0x9A3BFB57, 0x57ADD1CF, 0xE00F53AF},
+   {0x9A8E182B, 0xAA091420, 0x65870ACD, 0x6DBADF70, 0x9E7FA3D9, 0x1873E2CB, 0xAE5822E9, 0x15B8C5B7}},
+  {{0x593D097F, 0x6B53BF21, 0x84D5959A, 0xBF667BEA, 0xEEB4BEAC, 0xD1609F4F, 0xCAC8251D, 0x69A5B074},
+   {0x5318ECB3, 0x612D6531, 0xD420D3E0, 0x66A6AEBC, 0x685D7231, 0x6840955E, 0x1DAA4128, 0x454F241C}},
+  {{0xA5D67E8A, 0x8D3E6D40, 0xA18B743B, 0xE139639F, 0x948E7DC2, 0x63749EA0, 0x526BDE8F, 0xABD4C85F},
+   {0x2D812DFE, 0x731DA794, 0x67ED8673, 0x9A9C0DDD, 0xA83F2506, 0x63FEBA54, 0xF64A622E, 0x475BAED2}},
+  {{0xB40AAB96, 0x1AA70AD1, 0xF911EC64, 0xF7ACCAED, 0x70FA959C, 0x637899CE, 0x109A2589, 0xE9BC4FE4},
+   {0x1BF979E4, 0x7BCCE0D0, 0xBB65D9BE, 0x2941C273, 0xBAE3365E, 0x4997CC24, 0x8B08213E, 0x20EFCFBB}},
+  {{0xBDD6FA57, 0xDDE6C1B0, 0x6877584C, 0x64DA38DC, 0x88A2EA3B, 0x5EFD04D6, 0x8DE94787, 0x5E12F389},
+   {0x4C229E61, 0x822DC6F3, 0x32C58CE1, 0x0220A965, 0x12104D90, 0xBFF58F54, 0x6F430C30, 0xCC9C71A8}},
+  {{0x146A91DD, 0x69A3F7AF, 0x77603291, 0x66FB0376, 0x34331450, 0xF8BA5650, 0x5D12FC47, 0x4D88F26E},
+   {0xDE1D8482, 0x52E87A6F, 0xD84F6DC4, 0x71FC3D27, 0x1C1BFC10, 0x80660EB4, 0x39AD0A51, 0x2F4241DD}},
+  {{0x5DA65E89, 0xCEA18FED, 0xB6030005, 0x89D02E3A, 0x16B45EAB, 0x593303DB, 0x40B36824, 0xF5D40404},
+   {0xB6E6CA16, 0x8E62C398, 0xA0F8DB73, 0xB6680F4A, 0x3735F704, 0xE2CB53AB, 0x005E4955, 0x90EAF4B0}},
+  {{0xD030702A, 0x4EA9BF09, 0xCE4824BB, 0xE8E44EA4, 0x821E5B58, 0x0AAA6A0A, 0x117DA962, 0x2090FA8E},
+   {0x80902901, 0x1B68C306, 0x0B4E7472, 0xAF0A7E97, 0x0393F96B, 0xEBB4408C, 0xEC32F258, 0x984BD632}},
+  {{0x1159F10E, 0x807D9AF8, 0xB42511BC, 0xE05EFF00, 0x61B05022, 0x2EE9F026, 0x29FB81A6, 0x3D45853A},
+   {0xF75BC3A9, 0xA6B9C16E, 0x515A90E0, 0x82111A06, 0xEDFC125E, 0x87211449, 0xA80A8311, 0x4E4DE334}},
+  {{0x637D797D, 0x270A098D, 0xFF736545, 0x60FF39ED, 0x9D6B4A9B, 0xEB3DF8BF, 0x0E6155FA, 0x0AC9835F},
+   {0x640BC0E9, 0x50C04B69, 0x3FE89B08, 0xFA24F733, 0x5C6872B2, 0xD8AC7B19, 0x3D00D534, 0xD6882B26}},
+  {{0x0236A83D, 0xE0052323, 0xCD9A2912, 0x1FB825A3, 0x3F92D724, 0x69479CBC, 0x38EC3DDD, 0x389EFF26},
+   {0x1EB367C1, 0xE9FFEA6C, 0x91F3A0DE, 0x113A50C5, 0xB7B0AF9E, 0xCFD0310C, 0x31EA1AC9, 0x5E1B21C9}},
+  {{0x48ACEFF5, 0xDA6E2F06, 0xEA0DFE34, 0x78DDC159, 0x14DB328C, 0xB5F5FB47, 0xE6F3BA6A, 0x9419ACF5},
+   {0xC66C1B27, 0xB19CD157, 0xF91BDB7B, 0x473BE3D3, 0xEE3174A1, 0x08A1F515, 0x1B427E86, 0x565A9071}},
+  {{0x863DEF2F, 0x71DB5C74, 0x86DB595A, 0x46FC6CC6, 0xB0578F7C, 0x41A41F2A, 0x00C9BC26, 0x3AF24209},
+   {0xB3C9AB1A, 0x134233FD, 0xB6070F59, 0x7870F3A9, 0xDF2AF343, 0x39B1F3B2, 0x4AB472AB, 0x6013DA0E}},
+  {{0xF319CA96, 0xA4AB1856, 0xF8F15FAC, 0xFAD93FE2, 0xA833145E, 0x9A143FF7, 0xF19E3798, 0xB7F41BBE},
+   {0x88FBA40D, 0xE71B2D47, 0xFD3B7782, 0xFBE87B9F, 0xDEF04692, 0x51BED9BE, 0x0A92FE70, 0x9D86B0CC}},
+  {{0x901D3434, 0xE4269DBE, 0xFE90A0F6, 0x93B1C84F, 0xC4383C70, 0x9E0AB0CF, 0x9EF8F7F3, 0x94A875B9},
+   {0x7BD07E21, 0x7C54E527, 0x24C1F8A1, 0x4426E751, 0xA59E4156, 0x88D04FF3, 0x2E3F9185, 0xCA552076}},
+  {{0x3F32BEF2, 0xC6C3BAAE, 0xCCBF8EB6, 0x130EE8F7, 0x8E7E89C3, 0x09EC2B46, 0xBC2625F9, 0x3FBFBD74},
+   {0xB27173D1, 0x88502A08, 0x3CF0D529, 0xBB3271FF, 0xEB6FC065, 0x1409DF32, 0x75196790, 0x21531773}},
+  {{0x0DA1427C, 0x93EB1D71, 0x410E3F28, 0xB5F1A270, 0xA9325717, 0x7E9D484B, 0x576B2B28, 0xF883C4AB},
+   {0x15B0CC94, 0x8471E075, 0x560FAB54, 0xAEE70132, 0xDD9DEC7A, 0xB461EFE8, 0x488AB1D0, 0x6086F208}},
+  {{0xD41345EB, 0x8A9B3774, 0x4320BEC3, 0xE42D2EA2, 0xD72435FF, 0xEBB176E7, 0xCA2C0E18, 0x3841166E},
+   {0xD372BE35, 0x9C27A301, 0xE329D0DF, 0x7518195C, 0xCA99FE01, 0x203C98CB, 0x89F4CED9, 0x84D9C1A6}},
+  {{0xB789034E, 0xA7F47395, 0xE3ACD77C, 0x5378515C, 0xA20BCD3F, 0x29D692E0, 0x59E44B71, 0xBFD07180},
+   {0x6733F199, 0x92CD3E15, 0x99F9141A, 0x43428C81, 0x07E9C6E8, 0x47E891EC, 0x75DEAF04, 0x47103963}},
+  {{0x07888C81, 0xE2403426, 0x87490006, 0x03547365, 0x1FCA7F34, 0x48369A11, 0x6E2F531D, 0x383707D0},
+   {0x9F7D10DC, 0xDC6A8214, 0xC9D5EF32, 0xCA0B8578, 0xCDB6F94D, 0x8A4A5B65, 0x9B236F7A, 0x287FF192}},
+  {{0x48C1555E, 0x886878CA, 0xAF70DB2D, 0x5FB1FBC9, 0xB15FDA95, 0xDFFFF48F, 0x8FB2FA61, 0xFD98525D},
+   {0x57F0C9A8, 0x9A481E75, 0x27069783, 0x9BAB3B2A, 0xA223C95E, 0x9569DFFB, 0x0F6B2D61, 0x93840D78}},
+  {{0x23BAEB04, 0xEAAAA5D8, 0x3A4708FA, 0xB7ADCA0C, 0x17B23442, 0x1394CBDC, 0x1D926D0F, 0xB241AA94},
+   {0x1DE2521D, 0xDA7549F5, 0xE4B48A02, 0xEE7534C9, 0x46BA6568, 0x1DDE0DEE, 0x21B920E4, 0x85AA7EED}},
+  {{0xBAF91228, 0x348857EA, 0x4ECB2AF2, 0x892D0A81, 0x91E8B82B, 0x06136E7F, 0x495431AD, 0x0869EC0D},
+   {0x2E051CDF, 0x54FA49C4, 0x823C9B51, 0xCB47ADCA, 0x265EB81A, 0x70A00076, 0x9B7675A0, 0x5572895C}},
+  {{0x96C14E8F, 0x9D1ADF60, 0x2C06A25A, 0x06597793, 0x58D5A91A, 0xB2DCBD1F, 0xDE733F89, 0x1283033B},
+   {0x9BBD6A2D, 0xB4020E0E, 0x7D383846, 0xE8B07157, 0xA635C7BE, 0x84AF4665, 0x34DD7D5F, 0x549C0EAA}},
+  {{0xE86E02AB, 0xF29FB08F, 0x0D5C06CA, 0xA8266DC1, 0x2F48F49F, 0x25D5E27D, 0xE6F31BB3, 0xA2EBF469},
+   {0x0382A8EB, 0x86AE97D9, 0x363F04F7, 0xCB92F44B, 0x002D76F6, 0x391B9654, 0x4432235D, 0x27BEBD8C}},
+  {{0x3765581E, 0x7B3068D0, 0x1DC2D82E, 0x561D30F5, 0xB1F23D69, 0x8A404541, 0x1B4084CE, 0x6A25FB20},
+   {0x60206329, 0x50180E1B, 0x5CF443D5, 0x1E15941A, 0xD06A4007, 0xF5763393, 0x19CFB424, 0x5A0AEBFC}},
+  {{0xE529A049, 0xA2D545DA, 0xC73A541A, 0xA581A768, 0xE0950A67, 0xAFE88B1E, 0x52B8FCCA, 0x62778F74},
+   {0x0B8483FC, 0x44BB1BFA, 0x6E882C24, 0x5D727F5A, 0x553A776C, 0x4E4CBE60, 0x1AE91088, 0xE155B2F8}},
+  {{0x1B207A93, 0x5D84A3A3, 0xB71B2F04, 0xFBAE3D63, 0x6013B8BA, 0xAA9CEBC1, 0xD1C608D1, 0xFC9AA3CF},
+   {0xCF8CD72D, 0x1E3F596C, 0xDA16B20C, 0x26152558, 0x85AC096C, 0x6DB0B1CD, 0x2BB637DA, 0x34AB0E43}},
+  {{0x12C953E4, 0xA9F4F5C1, 0x2A6A470A, 0xFE518080, 0x0B17775B, 0x5455FBCB, 0xC1752BB7, 0x4F117894},
+   {0x544A3BE7, 0x5B5E49DE, 0x22C3EC1C, 0x0DDE356F, 0x01DA56C9, 0xE26AE66A, 0x35FFD9DC, 0xAB3B6155}},
+  {{0xC94F4326, 0x21AD037B, 0x01F60A81, 0xDD3C9AAD, 0xA3106421, 0x4F11EE65, 0xADBACC80, 0x4751FE00},
+   {0xD3C2917E, 0xE4683589, 0x71D43F65, 0xFA8BD144, 0x11A422F6, 0x200697F3, 0x1FA0772B, 0xE83D7D4F}},
+  {{0x59B21469, 0xCA907BFF, 0xC44627DE, 0xECFDA9FD, 0x5AF99278, 0x8B32C8BB, 0x51C0A6FC, 0x2298506C},
+   {0x9D7BFC5F, 0x2227244E, 0xBC8DCDBC, 0xD903A0C9, 0xA5809F67, 0x8916ACEC, 0x4C45BBD7, 0xFEF3434A}},
+  {{0xC5332D4D, 0x12749619, 0x076108B7, 0x78346549, 0x52F84FDE, 0x44F0646E, 0x9B855F0E, 0xACA1B2FA},
+   {0xBB5ACC3E, 0x9F40EDD1, 0x5CB0077A, 0x341DD551, 0x7731C386, 0x4162BF6F, 0x7D37F6E4, 0x30FC315C}},
+  {{0xBE224934, 0x07C6577E, 0x133B52F5, 0x0BD79C64, 0x26EA9A30, 0x6D440B9B, 0x8AF95AF2, 0xDC9823E4},
+   {0x951A08EB, 0xF3DCB38A, 0xCD6F6B4F, 0xCAEDC3A2, 0x55572EFD, 0xB648EFDB, 0x043C56DD, 0xB2656A22}},
+  {{0x7CAB3106, 0x24C2E7A2, 0x45DDCBCC, 0xE70143A5, 0xE23C4D47, 0x121738AA, 0xC9729043, 0xD3559359},
+   {0x5F6E4215, 0xD0ABCEDD, 0xD8C94522, 0xF09EF638, 0xFBF9AB22, 0x7BDDE51F, 0x95EDB586, 0x7AA22698}},
+  {{0x530E8727, 0xC7E05F58, 0x88A132F3, 0xD41592D9, 0x4835F583, 0x7CB9B486, 0x8F603959, 0x0D5CABA2},
+   {0x7D850A76, 0xB97C361D, 0x0751FEDF, 0x75D0638A, 0xEB862FBE, 0xAD213D44, 0x597D997B, 0xCB814263}},
+  {{0x85FBA82B, 0x5E2A21F5, 0xEE80D718, 0xE2B23452, 0x8F8D3AD4, 0x61CD936D, 0xAEA80A6B, 0x537E0FAA},
+   {0x65C03360, 0xE8A1913B, 0xE9A48461, 0xAD915586, 0xC9E7C92D, 0x197C7BE0, 0x0476E6DB, 0x98FF32E1}},
+  {{0xF8D734CA, 0x56131598, 0x32AB6115, 0xA90C803B, 0x294F6172, 0xF20B6904, 0x29BB4956, 0x9C4C8C6B},
+   {0xA3443E3C, 0x72523CBC, 0x1AAF4A8F, 0x403FC2D5, 0xF99A6339, 0x264BCAA0, 0x6437CEC7, 0xF837CA9F}},
+  {{0x15685448, 0x3BB78084, 0x1186BDE2, 0x0FC3A28F, 0xCF4EEBDF, 0xD41F0CFA, 0xAE3A0DDC, 0x8384F799},
+   {0x10B4F451, 0xF4EE653F, 0x833D3476, 0xC2F5D30F, 0x38E0E1CE, 0x6C3BCEB3, 0xAA489E30, 0x76570D52}},
+  {{0xA38218CF, 0xB7AEAB38, 0xA9E0D3C4, 0x2B07AEB1, 0x47A4C94D, 0xF0D16BE2, 0x91FD763C, 0x5AF88695},
+   {0x2A9DA273, 0x053AB914, 0x61EBE016, 0x10D130AB, 0xD34E284A, 0x5099B9C8, 0x6ED4DE65, 0xB21A4103}},
+  {{0xF8E85A02, 0x940F3648, 0x555E9CA4, 0x014FF0A9, 0x2EBFF5CE, 0x656E0598, 0x7CD3977C, 0x7104DED9},
+   {0x6385DFE7, 0x9A4C0512, 0x0830E76D, 0x0627BE3C, 0xB14A50BF, 0xF8C14705, 0x8C3FAA7E, 0x3B4A1D7F}},
+  {{0xE6A868A0, 0x84B1E14B, 0x47BC1E4F, 0x7B98A2BB, 0xCC803733, 0x0E6DF4E4, 0x7958E14D, 0xB751A536},
+   {0x5B9871B7, 0xF925771B, 0xE16ED05E, 0xEFFA615A, 0xC695DDD6, 0x3141411A, 0x61468D10, 0x91EB562A}},
+  {{0xE895DF07, 0x6A703F10, 0x01876BD8, 0xFD75F3FA, 0x0CE08FFE, 0xEB5B06E7, 0x2783DFEE, 0x68F6B854},
+   {0x78712655, 0x90C76F8A, 0xF310BF7F, 0xCF5293D2, 0xFDA45028, 0xFBC8044D, 0x92E40CE6, 0xCBE1FEBA}},
+  {{0xC0C1CE9F, 0xFD4C1473, 0x7EDA11D3, 0x27F187B9, 0xD9845057, 0x024CD871, 0xA174D4D3, 0xCF6B116F},
+   {0xD279352F, 0xD300B23F, 0x23F12526, 0x364BC658, 0x2AB7B709, 0xC7908819, 0xB6BFC532, 0xC2DE1FA1}},
+  {{0x4396E4C1, 0xE998CEEA, 0x6ACEA274, 0xFC82EF0B, 0x2250E927, 0x230F729F, 0x2F420109, 0xD0B2F94D},
+   {0xB38D4966, 0x4305ADDD, 0x624C3B45, 0x10B838F8, 0x58954E7A, 0x7DB26366, 0x8B0719E5, 0x97145982}},
+  {{0xD93F535C, 0x64549B3D, 0xA76E5BF3, 0x93978B4D, 0x5A01C10E, 0xE2B1F3EE, 0xA9D19EA8, 0x76F210AF},
+   {0xC4264D57, 0xF04ACA7A, 0x483487BA, 0x9F989031, 0xE6280F91, 0x84132D01, 0xB3A040CF, 0xF34B31CE}},
+  {{0xEEE8CB7E, 0x75CEC1FF, 0xF8735FB1, 0x566BF7FA, 0x5975D2FD, 0xC360C19A, 0xF075EC6C, 0x93B3CE8D},
+   {0x815D65CE, 0x718B6E47, 0xD1C39345, 0x17EC17C1, 0x6DAC86B0, 0x4A1D862F, 0xE6DFAB8E, 0x268C55B1}},
+  {{0xCFFCAF2D, 0xB535FD34, 0xA23B8B1B, 0x9C8838DF, 0xE178F644, 0xB2FB47FD, 0xF5D8BE2C, 0x201173F5},
+   {0x9968EEEE, 0x485E1C8D, 0xF856B514, 0x165D69EA, 0x756B5779, 0x17B6206C, 0xAFE2AE9A, 0x8DAC7611}},
+  {{0xDBDF389D, 0x0C55F223, 0x61EDA89E, 0x76030246, 0xA1150650, 0x18975AE2, 0xC911375C, 0x77AAEBAB},
+   {0x2FE056E6, 0xEDAE9AD1, 0x2DDE44E4, 0x8AA8F740, 0xE2873522, 0x9D288103, 0xFB60CD48, 0xF34AACA7}},
+  {{0x08BDF594, 0xBC7BCC73, 0xA9178A0B, 0x8FEC77F2, 0x949EDFB7, 0x7BB27826, 0xF137D62F, 0x77B0D0C5},
+   {0x88F8A9EA, 0x5ADD7B4B, 0x966CDA49, 0x133EDFBD, 0xEAB66F18, 0x0189CA26, 0x55F452B1, 0x40C07B47}},
+  {{0x23369FC9, 0x4BD6B726, 0x53D0B876, 0x57F2929E, 0xF2340687, 0xC2D5CBA4, 0x4A866ABA, 0x96161000},
+   {0x2E407A5E, 0x49997BCD, 0x92DDCB24, 0x69AB197D, 0x8FE5131C, 0x2CF1F243, 0xCEE75E44, 0x7ACB9FAD}},
+  {{0xB34983B1, 0xFB5F7E26, 0xD3FBB145, 0x7E38E207, 0xAF71ED7F, 0xF608EE91, 0x686E5AEA, 0x6D78F612},
+   {0x607E751E, 0x2F9D2E63, 0x2748BA3B, 0x8607CB37, 0xF4FE56A9, 0x006F6D32, 0x6D242B89, 0x2980BD5A}},
+  {{0x23D2D4C0, 0x254E8394, 0x7AEA685B, 0xF57F0C91, 0x6F75AAEA, 0xA60D880F, 0xA333BF5B, 0x24EB9ACC},
+   {0x1CDA5DEA, 0xE3DE4CCB, 0xC51A6B4F, 0xFEEF9341, 0x8BAC4C4D, 0x743125F8, 0xACD079CC, 0x69F891C5}},
+  {{0x3DBA87E7, 0x6384AB74, 0xB78A63AC, 0xE8F20516, 0x03FA5C24, 0xC6D198DE, 0xB50C2893, 0x7AFB3D4F},
+   {0x3A4CF320, 0xE4D418B9, 0x4FAA9ACC, 0xAAC22A0E, 0x552C1F31, 0x08A7CC67, 0xD6668BEB, 0x36009A3A}},
+  {{0xB34D794F, 0x09A16E3B, 0x4E743813, 0x8C3F4A31, 0x651C9834, 0xE8A7B747, 0xD2C76536, 0x4667EBB9},
+   {0xB8A887AB, 0x1F6884FA, 0xA08DF843, 0xD021BC8D, 0x55F59432, 0xFC2D4609, 0x38D06677, 0x2D5C1AC7}},
+  {{0xFAECB3E4, 0x1D348841, 0x0406E1CE, 0xE2E6D3B5, 0x87679B85, 0x504B9726, 0x78812B43, 0x25279D03},
+   {0x56676779, 0x7E329009, 0xB002BCF5, 0xF0184A5B, 0xD630DA82, 0x49E88336, 0xF08564A7, 0x92D01B0B}},
+  {{0x36CFA9E8, 0x9460F46A, 0x84A462F7, 0x6800B8A8, 0xC06A6673, 0x9F5D99A2, 0xB101B4F6, 0x1AB172C7},
+   {0x5321C59C, 0xF699C703, 0xED13BC1F, 0x0B9ACA14, 0xDFAA5EAA, 0x91C6EEBB, 0x4F346816, 0x885AE502}},
+  {{0xC9757170, 0xDBDEB29D, 0xCBF1B409, 0x55B5A898, 0xA4C0CBD2, 0x01B3DFD4, 0xD97E4324, 0x38611618},
+   {0x57BEE79E, 0xF3EA3774, 0xBC20E2C6, 0x60941F4E, 0x53C47B89, 0x21D8F508, 0xB8F41362, 0x7E7D03D3}},
+  {{0xF202481A, 0xCC38452E, 0xABC96FED, 0x50D19D86, 0xC62CD055, 0x83FB2D63, 0x7B81568E, 0xBD6058B0},
+   {0x70737BB6, 0x628271F1, 0x83F257D4, 0xC51419ED, 0x09EF7DD9, 0x9EE514E4, 0xF8467E37, 0xF78E1FBE}},
+  {{0x339FE5CE, 0x045EF431, 0xD24C26D1, 0xEF414A60, 0x661F3BBE, 0xC4151215, 0xA31D0A51, 0xCA270C0B},
+   {0x89D02271, 0x0BDDC41D, 0x55B9AE92, 0x5DA2412A, 0x1B6552CC, 0xE2A468E2, 0x29CBEEE5, 0x0920500E}},
+  {{0x92873D50, 0x8272EF36, 0x79CC84D1, 0xE6325D26, 0x38675522, 0xD634F48D, 0xE4D5882C, 0x1D96882C},
+   {0x5C7604C9, 0x7F0B5356, 0xD43110A3, 0x3C33B393, 0x96DE3985, 0x4BCB6430, 0x9F50539E, 0x35C125A1}},
+  {{0x8C720A67, 0xBAD5F61F, 0x16BFC3DD, 0x2C3C19BC, 0x65D64E56, 0x997D4265, 0x49504379, 0xAB25034F},
+   {0x1410392E, 0x1F6297F6, 0x12E86D68, 0xBEF8D14A, 0x1DFBD10B, 0xD6405555, 0x0D44FBAA, 0x53CAD2BD}},
+  {{0x0D25CA56, 0x60D14D0E, 0xBCF946FF, 0x31CCE9A5, 0xBEF23766, 0x7F2E2C69, 0x0D8E4B51, 0x4E3C677A},
+   {0x6BB0D0CE, 0xA7C52ECA, 0xD0391CA8, 0x1A2389C8, 0x7E8B1D46, 0x41165173, 0xA70684B1, 0x71094B90}},
+  {{0x66554187, 0x76F6C646, 0xD3BAC858, 0xDE2A1E0E, 0xCA976E8B, 0xA81F6685, 0xF60C851C, 0x48A9D631},
+   {0x336936E6, 0x95A81B38, 0xF7934CBD, 0x588C234F, 0x68DB8031, 0x5603885C, 0x5C1A48C7, 0x9C777837}},
+  {{0x8709B816, 0xFC9C7AFB, 0xD4AB7632, 0xF0190802, 0x4C80BD1E, 0x609275B0, 0x3680A202, 0x791851E2},
+   {0x5899EF09, 0x0B4FD3FB, 0xACB207B3, 0x53B13F9C, 0x7C507F60, 0x3C993D16, 0x8D9E3B7C, 0xF1EF5083}},
+  {{0x0AD2FE5C, 0xF426FE06, 0x9022C4CB, 0xB8746069, 0x403EFCE0, 0xA1F27672, 0x53E2CC9A, 0xC34B4A30},
+   {0xD0E57D9F, 0x7E49B3AB, 0x13463806, 0x9906218B, 0x8BFF74A6, 0x91A140B9, 0xE37C6EA3, 0x52DE5611}},
+  {{0xE28B1B92, 0xAD1E58C9, 0x77A11D29, 0xBFC3EAD0, 0xBA1DE923, 0x9F5D367A, 0xAFB30E89, 0xC1EE712F},
+   {0x75876AC6, 0x04886F34, 0x54B5C1C3, 0xB1D36D27, 0x18CBA903, 0xB36B5FD0, 0x696A7139, 0x9B4A54BC}},
+  {{0x519E0427, 0xDB84065D, 0xB863AF57, 0xD69DDA22, 0x6AD4BC18, 0x71BB07B4, 0xC29564F8, 0x41CDAD11},
+   {0x503CC09B, 0x7272B74C, 0x46BA501D, 0x72E4D2B6, 0x5033CCA7, 0xF477717D, 0xF3DF9D57, 0xFEEEC42C}},
+  {{0x57186AC4, 0x435B40EE, 0x97B24F3D, 0xA16130EA, 0x453C442E, 0xF2B8C361, 0x647E46E4, 0x532DE1CF},
+   {0x64CCD9EF, 0xFAF3C94F, 0x182EB339, 0x4E7192EC, 0xF2DFEA04, 0x45CBEDA8, 0x539889DC, 0xCB652C2D}},
+  {{0xD34C847E, 0x8E6576BB, 0xD5DE9A09, 0xCCAEB5EE, 0xBF91842D, 0x604CA87D, 0x7DE9E9ED, 0x363B9C74},
+   {0x84919F51, 0x20E28AF4, 0x7279A592, 0x8EA65E9C, 0xADEC5331, 0x1DF4B333, 0x0B1573DF, 0x1B42A7C7}},
+  {{0x55EF6C3C, 0xE9EE350D, 0x058A3BA9, 0xF84A8CAD, 0xE079D281, 0x5316A4FB, 0x11A280E5, 0xC9BF6F15},
+   {0x860E512E, 0x77414A7A, 0xD9430464, 0xB5722BCF, 0xFCD817BA, 0x631D68D7, 0x20F282F6, 0xCB8DE2D9}},
+  {{0x86AF53CA, 0xE3CC6151, 0x609C485F, 0x3CBBE8D7, 0x2024DE09, 0xED635088, 0x3ED70F65, 0x3B9B4F1C},
+   {0x4E292129, 0x9C0B92E3, 0x137DF53D, 0x4ADD5ADC, 0xECDB4D15, 0x74BAD233, 0x1A3D8634, 0x90610274}},
+  {{0x2374F412, 0x12022915, 0x162247D9, 0xC1C05129, 0x04B21320, 0x4A49989B, 0xCB478149, 0xDA65930F},
+   {0x69FB4789, 0xED96215F, 0xAD7FCCB6, 0x3CFCE1CF, 0x00687BBD, 0xE454254F, 0xB30413B9, 0x5D96FDDD}},
+  {{0x5DEE2192, 0x20F89C80, 0x5CFB0642, 0x6919A925, 0xE8E3E133, 0x94A30525, 0x68585ED2, 0x66209C61},
+   {0x6DE12C85, 0x0C904364, 0xF0248824, 0xDAC80D74, 0xF320F71F, 0x7B7FA943, 0xD5882C26, 0x0A244A2A}},
+  {{0x702476B5, 0xEEE44B35, 0xE45C2258, 0x7ED031A0, 0xBD6F8514, 0xB422D1E7, 0x5972A107, 0xE51F547C},
+   {0xC9CF343D, 0xA25BCD6F, 0x097C184E, 0x8CA922EE, 0xA9FE9A06, 0xA62F98B3, 0x25BB1387, 0x1C309A2B}},
+  {{0xC6EE75B0, 0xA352A845, 0x4AFAFBAB, 0x0D667013, 0x824A9C3F, 0xF2C9F8CC, 0x6671EA61, 0x1123CED9},
+   {0xC4C0426B, 0xE2064C2B, 0x5DDA8F0C, 0xAE8A4AC7, 0x8B03F8D0, 0x4789D01E, 0x2FD8BEC7, 0x6D8A6838}},
+  {{0x1967C459, 0x9295DBEB, 0x3472C98E, 0xB0014883, 0x08011828, 0xC5049777, 0xA2C4E503, 0x20B87B8A},
+   {0xE057C277, 0x3063175D, 0x8FE582DD, 0x1BD53933, 0x5F69A044, 0x0D11ADEF, 0x919776BE, 0xF5C6FA49}},
+  {{0xE418DAAD, 0x27326510, 0x625C8DDA, 0x31C73944, 0x43030723, 0x32B46D0D, 0xCFD15D0C, 0x39A10292},
+   {0x99961DEA, 0x1EF74176, 0x175F71EE, 0xA0BA92F0, 0x08F50113, 0x33F788B2, 0x71A8271D, 0xFB83754A}},
+  {{0x16898779, 0x60FFEE0C, 0xF624C894, 0x07F24F18, 0x0ADC727D, 0xA3B4C6E6, 0x68229401, 0xBE61FBAE},
+   {0x634FE770, 0xE7C012BF, 0xBC5336ED, 0x1B4108E0, 0x34E57C7E, 0x68A1116B, 0xCD615837, 0x39012BA1}},
+  {{0xBD26C6AE, 0x2C8CA159, 0xCCCFC5A6, 0x843D7F20, 0x81FBACAD, 0x03349CE1, 0x656B250F, 0xEB34EF6F},
+   {0x0C299BCE, 0x66E79036, 0x4FF14D30, 0xF50639F6, 0x1E49DD7A, 0x9B887542, 0xF0B88704, 0xA64BFF59}},
+  {{0xB7F335BB, 0x00A5A2C3, 0x48AF3A1A, 0x0DFAF15D, 0xAAE1AE3A, 0x3C0A7831, 0x8CDCA788, 0x4832590D},
+   {0xECF2985C, 0x9937352D, 0x18129BFB, 0x069199D7, 0xD9875FCC, 0xD747E700, 0xBFEC3698, 0x0707E099}},
+  {{0x03541F94, 0xB1A8E69A, 0x3DFED107, 0xCE50F2C0, 0xEDD8D48C, 0xE235CB04, 0xD14FF204, 0x06DE6B81},
+   {0xC4600A5E, 0x5CA05CA3, 0xDD87634B, 0x00AA7AA4, 0x4817FB86, 0xC00F85A4, 0xC3977369, 0xDAD5C91C}},
+  {{0x0FD59E11, 0x8C944E76, 0x102FAD5F, 0x3876CBA1, 0xD83FAA56, 0xA454C3FA, 0x332010B9, 0x1ED7D1B9},
+   {0x0024B889, 0xA1011A27, 0xAC0CD344, 0x05E4D0DC, 0xEB6A2A24, 0x52B520F0, 0x3217257A, 0x3A2B03F0}},
+  {{0xB315365B, 0x0B25C598, 0xA33802F1, 0x4F9FBBF4, 0xDF1000B7, 0xF17BBAF7, 0x92ED176A, 0xD7F06111},
+   {0xE9AED821, 0xE6D03F9E, 0xC3C2C608, 0x6479A7FB, 0x833FE7D0, 0x4D4AD114, 0x5DC730B9, 0x0633F165}},
+  {{0xDF1D043D, 0xF20FC2AF, 0xB58D5A62, 0xF330240D, 0xA0058C3B, 0xFC7D229C, 0xC78DD9F6, 0x15FEE545},
+   {0x5BC98CDA, 0x501E8288, 0xD046AC04, 0x41EF80E5, 0x461210FB, 0x557D9F49, 0xB8753F81, 0x4AB5B6B2}},
+  {{0x8618EDF1, 0x9CDA05E2, 0xDBF91167, 0xD9BBBDF1, 0x5B3F7F24, 0x210E5999, 0x3290E994, 0x5556C6A3},
+   {0xFD9D9264, 0xDFA4617F, 0xA4034316, 0x35F67E2C, 0xA6F5D2C1, 0xE732B3C2, 0xB6D666F1, 0x6384A08E}},
+  {{0x2DC58892, 0xB2D37DA4, 0x03BDEB8D, 0xED936A9C, 0x1F8ED30F, 0x13CA866A, 0xE07DE033, 0xCEEDB9C0},
+   {0x3E5135B4, 0x88F742D4, 0x0EC7D64C, 0xF329DAA7, 0x9A484A31, 0x0D463E11, 0x70CDDDCF, 0x978E9348}},
+  {{0x8939CA0B, 0xC5D60AB4, 0x9378F406, 0x95ADEBE4, 0x9718F642, 0x097B65A7, 0x8EA4A221, 0x93CB902B},
+   {0x7B6D5FDB, 0xF072428C, 0xE51424D6, 0x7C4E4DBB, 0x2DB584DF, 0xEEEA7C18, 0xE8141B67, 0xD3B0DC0A}},
+  {{0x8E33832B, 0xC42BB0BD, 0x82B2725C, 0x3B6D0EF3, 0x8CFC624B, 0x85918AF4, 0x8EE47C9B, 0xDF895BD3},
+   {0xC15185F0, 0x8BB5D0BB, 0x585C96B0, 0x819D351A, 0x154BE8DD, 0x6A83828D, 0xC36963D6, 0x299C4DA5}},
+  {{0x289149A5, 0xEA4C1463, 0xAC879905, 0xF3FCCCF2, 0xE13A9610, 0x2185DC73, 0xF3CF0208, 0xCD651AA7},
+   {0x46927D66, 0xA481D874, 0x28198BBA, 0x6A9A3C39, 0x3F54042D, 0xFC590FAA, 0xB0EE6067, 0x10DD490F}},
+  {{0xAAC4170A, 0x9BAF4D7A, 0x0D75821E, 0x6DA147F0, 0x3879D7D8, 0x58E0A73C, 0xA60BCD77, 0x86699898},
+   {0x598A46EB, 0xAE7CD4DA, 0x0187F877, 0x428DEDE8, 0x2AF12355, 0x32CA235D, 0xA4B075F4, 0xC0D84AEC}},
+  {{0xD35D8953, 0x48CED071, 0x7E1EEDBE, 0x867C3459, 0x1A074661, 0x36DC5AD7, 0x9E6861CB, 0x939EE1B7},
+   {0x5B609C5B, 0x0E5E70EB, 0x28282282, 0xA8796969, 0x7BA8BB79, 0xC617BAC6, 0x152DAE15, 0x194A24F2}},
+  {{0xDED33571, 0x39F582C5, 0x91F4FB95, 0x2B9A8ED7, 0x82A3EF27, 0x0442464E, 0x87B3FAC1, 0xA7E35647},
+   {0xA367DEA6, 0x005BAD87, 0x019DA0DD, 0x0F3CDD60, 0xA59305FF, 0x306F746A, 0xB2909721, 0x971F1ED8}},
+  {{0xB852CDD7, 0x4511C44C, 0x975B995D, 0xEB6BF1DD, 0x572ADD8D, 0x2601F683, 0xD054B296, 0x21121447},
+   {0x42CF0265, 0xF4F62401, 0xE3A79A2A, 0x6467317B, 0xAF927B35, 0xF04ED2D1, 0x6534B5A1, 0x8E96E1CF}},
+  {{0xAF4247B2, 0x58ADB933, 0x0537352E, 0x48CEBF9B, 0x966FF1FA, 0x8DF30A42, 0xE788E9C4, 0x239E0726},
+   {0xD79B48B0, 0x5C6958A2, 0x4E914E8E, 0x22272E55, 0x7E106A1F, 0x191CBB75, 0x5F71C539, 0x4F8A6029}},
+  {{0xF7158BEA, 0x25B336A3, 0x27774720, 0x2C80A110, 0x0A0B4413, 0x14D2F6A4, 0x43D8D04A, 0x13A5BEE3},
+   {0xE4A44502, 0x93B68C5F, 0x364957B2, 0x5DA5D14C, 0x26D8258C, 0x75168F8A, 0xEB43C098, 0xB455E8A4}},
+  {{0xB1EBE50C, 0x640614A3, 0x76ACAA65, 0x3F805476, 0x8B4D91FF, 0x69530604, 0x519859D3, 0x903BB9EA},
+   {0x9F5FAC7F, 0x93A59E69, 0x390D8900, 0x1DF54929, 0x8CE5FA33, 0x823DBA18, 0x2350281B, 0x5574F271}},
+  {{0x0309488A, 0xF111B200, 0xED2E78BE, 0x6DBA1852, 0xC5F6A056, 0xA848D319, 0x8C4B59C2, 0xF1AE1709},
+   {0x881BD57F, 0x757D507B, 0xED484551, 0xD7DB6879, 0x8529CC2B, 0x0CE00C9C, 0xEBD18AC3, 0xFB339802}},
+  {{0x1FC78E0C, 0x250C5AF3, 0x04F7FDA9, 0x84EEB8E9, 0x9FFE80E6, 0xA5A17E06, 0x703285CF, 0xDE96F184},
+   {0x3FE41E6F, 0xCCEABB01, 0x8724D28E, 0x2F674547, 0xB8BD6D72, 0x7BABF7E2, 0xFCBEF7CB, 0x0D6B8AB0}},
+  {{0x19ABCAF5, 0x9BE634CC, 0x02919487, 0xC0EEBAC0, 0x3BD130B6, 0x9F1BFEDD, 0x22D625C1, 0x24DAB3A1},
+   {0xB4206E3A, 0x46AB327C, 0x555042A3, 0x232D3373, 0x0EB9EA81, 0x8DDAE1B5, 0xCB9F9E6D, 0xBE1CF505}},
+  {{0xCBCDAFE6, 0xE854E0A5, 0x43534D5A, 0xF1E98103, 0x340F393C, 0xA7273058, 0x8CFD2794, 0x7329508C},
+   {0x538E99CD, 0xE715886A, 0x651E2938, 0x494D5A8F, 0x694B2061, 0xE8E08261, 0xC40BE3CA, 0x0971A6FF}},
+  {{0x455D0D81, 0x56643934, 0x73F8FCEF, 0x10C24D59, 0xBB38A630, 0xA612C437, 0x92F1445E, 0x4EF9A80E},
+   {0x1EE44719, 0xA9A648E2, 0x0D1DC166, 0x2F62FECA, 0x97178BA3, 0x69C3D990, 0x9FF67325, 0xEC8A3AD8}},
+  {{0x90828F9A, 0x7CE0D6AC, 0x5C9531CE, 0xB2BD1A02, 0xBB10AB9D, 0x5C1B4412, 0xAEEE4C0E, 0x387518CD},
+   {0x98F368AA, 0x87DE57CE, 0xBB92BE7A, 0x21F57922, 0xF1744809, 0x65D54499, 0xD9E3102D, 0x777B407C}},
+  {{0xE746EAA6, 0x09D92A8E, 0x5C0B2593, 0xFE861385, 0x658B8EAF, 0x2696F3FF, 0x1A3C51E1, 0x896FCF1C},
+   {0xFC538F16, 0x8D8E617E, 0x610922E6, 0x1CD3C38F, 0xD6EAC1C9, 0x84C50345, 0xA4205D21, 0x61FF42C1}},
+  {{0x8230A9A6, 0x7B741B5D, 0x8BF29BB9, 0xF579DEB9, 0x98FFD997, 0x39671277, 0xF4FCB1E1, 0x6DE16859},
+   {0xEA723B7F, 0xC6B7A38D, 0xF4FB138F, 0x77D3E0F2, 0xA150FA04, 0x9B478F3A, 0x69B0BEED, 0x5B961787}},
+  {{0x1D842031, 0x66D0EECB, 0xA5AEDBC6, 0xAFA9C66E, 0xFAAD16D1, 0x67515B87, 0x15840989, 0xD827C8B4},
+   {0xC8A420ED, 0x5E1B7BB1, 0xDC28E5BD, 0x8EA03CAB, 0xD45188D7, 0xFC4D874F, 0xC22ECF90, 0x2F661C17}},
+  {{0x328FB9EF, 0xDCEAFEB7, 0x311CB1F3, 0x3478E062, 0x03E042EA, 0xB7FBE79E, 0x28A8A8FB, 0xFB0249AA},
+   {0xB8EE1B8B, 0x50B4BB44, 0x3D152813, 0x0E540E9F, 0x09AA13A2, 0x48E514E1, 0x9C5FBC3E, 0x172F4633}},
+  {{0xA37CFBFE, 0xDD8D54F8, 0xF8FFB4A9, 0x7B03CDFE, 0x24070DF5, 0xCA347052, 0x99BF4616, 0x0B659251},
+   {0xEE44254B, 0xCE2E30D8, 0x415BA4F1, 0xA45C28FD, 0x5E8366AA, 0xCC31D2BF, 0x59B2F313, 0x8E249AEB}},
+  {{0x56F93781, 0x8874151D, 0x22891225, 0x3B208CDA, 0x53F5B5AF, 0x9F9F4B01, 0x457C10BC, 0x60AAA403},
+   {0x0300CD5E, 0x52A2BDA0, 0xA7436841, 0xE4503BB0, 0x7C7158C1, 0xE34045FE, 0x15AC62A9, 0xDCA8E0D7}},
+  {{0x9361CF42, 0xA423DC88, 0xCA111DD0, 0x25953391, 0x4509733E, 0xCD1BF722, 0x5E552EAE, 0x62A8F8A7},
+   {0x4DFB5704, 0xA6A1A79C, 0xA2ABC546, 0x215F2DE4, 0x4DCCA7D6, 0xEE3EDE74, 0x493ED75F, 0xBBD935CD}},
+  {{0xAD8FBF6A, 0x228B7867, 0x49F109D0, 0x2B4DCCBA, 0x6CEA145C, 0x2EDEDDA5, 0x052D7980, 0x33AE4C04},
+   {0xDF1203AF, 0x487E1051, 0x30C418F9, 0x343ED3D8, 0x0495EA86, 0x715AD94E, 0xE945824B, 0xC78A5AC5}},
+  {{0x8C935E5F, 0x3680071A, 0xF58543C1, 0x7D764E91, 0xEE52DF5E, 0x4DB687F0, 0xFECF1D1D, 0x7EAD1E20},
+   {0x5FE9A684, 0x453CB994, 0xB65BB00A, 0x1CA6C43F, 0xD51630D5, 0x99039A8A, 0x97C7D645, 0x0CA741ED}},
+  {{0xF45BE76B, 0x614E1441, 0x177D8E3D, 0xA5EF3EC0, 0x45E70812, 0xE3662065, 0xA25EBC68, 0x05D525AC},
+   {0x916E827A, 0x11C3041B, 0x868BC04C, 0x7D5AB00A, 0x1E80EA45, 0x129F80B1, 0x82AB5457, 0x663C8854}},
+  {{0xC4268106, 0x0EA0EF30, 0x9827ED70, 0x9037B2F3, 0x583F6310, 0xC3DB4E2F, 0x2AB10678, 0x10A3F54B},
+   {0x706E16C5, 0x7097DD2B, 0xAF165242, 0xD4770A89, 0x370E1411, 0x9514515E, 0x0DA518EF, 0xAD237305}},
+  {{0x1C86789A, 0x1F5BA028, 0xA557050D, 0x53C33FAB, 0x401788B3, 0x41D49663, 0xA1636F3B, 0x37FBF41E},
+   {0x0F7B0609, 0x07763B95, 0xACAA8D51, 0xBF50BC02, 0x6E61B1C6, 0xC2A5C173, 0xF46A6605, 0xA9116C70}},
+  {{0x336F30C4, 0x5999001A, 0x504B641A, 0x4D8B3C3B, 0x31696B82, 0x3A1A5507, 0xE650FE2B, 0x605A5FD0},
+   {0x4624AD94, 0xE45BCF34, 0x42FF1BCF, 0x360522E1, 0x0583B20B, 0x0EC6913B, 0xA3E4A361, 0x87004DDC}},
+  {{0xB029D3D7, 0x94B476BC, 0x8883A492, 0x355100CB, 0x82E9A1DB, 0x1C540464, 0xDB0836B1, 0xE35DF7EB},
+   {0x6BA5DDB7, 0x2DB5A7F5, 0x72EF8A86, 0x921BC05B, 0x8DDCD14F, 0xD697F63E, 0x19352CE1, 0x0646FE17}},
+  {{0x18AC6F86, 0x63DFC0B7, 0xD0531DE8, 0xE2FB9537, 0xD0136AE3, 0x481EAF13, 0x8E4BD2F7, 0xE01AF14A},
+   {0x88F974EC, 0x49EE4F9F, 0x92AEF323, 0xD764A4C6, 0x1E03AFA9, 0x443CB43F, 0x736E1021, 0xC0C7BF9E}},
+  {{0x9BB57932, 0x72F792D1, 0x0514514C, 0x1BED9845, 0x44C50CB7, 0xA4EB06A6, 0x4EFDCEDD, 0x8254B868},
+   {0xC9DADADE, 0x47BB74D9, 0xB3D95615, 0x2D48E4EC, 0xC15AA29F, 0xADFC9CF1, 0x78462B89, 0x0CBA2046}},
+  {{0x479F4BFE, 0x9B0D9ABB, 0x5E3C4768, 0x3E790D21, 0x375C643C, 0xA3AD44CD, 0x6AC0DC43, 0x9DFBBB65},
+   {0x55C762EC, 0xDA6FFB79, 0xDE78A5E1, 0x12294F31, 0x4D704863, 0x0AE22C68, 0x6C18C02E, 0x61114035}},
+  {{0xD96DD1ED, 0x2360D888, 0x0A936C6B, 0x1B99CC55, 0x8609F93F, 0x4372A3F5, 0x4DC993C4, 0x0AFC214A},
+   {0xA6BF396F, 0xBA08D6C7, 0xAF2235E2, 0xA6D44568, 0xBDEC43ED, 0xE3E1C378, 0xD9CA7E1D, 0x00B80A92}},
+  {{0xC7AB8183, 0x06750A2A, 0x97F4EB7B, 0x042DD3D6, 0x3D0EFA7A, 0x4CC4D792, 0xD9793753, 0xFF36E487},
+   {0x4E06E132, 0x104DFF63, 0x6D1706FE, 0x9773AE26, 0x3FFEBB01, 0x97299181, 0xDFC694FF, 0x59006DC6}},
+  {{0xDC0B1061, 0x2FFBCF19, 0x139AD48C, 0x846730AD, 0x12CA3C26, 0xCBBD5F20, 0x8855A59A, 0xEBC3D35E},
+   {0x5B93E742, 0x18644A97, 0xF8F4BE3A, 0x0DA658F5, 0x3FE32589, 0x4B3C3785, 0x61CE3030, 0x5290BEC1}},
+  {{0x3DF40F6F, 0xE6FAD49D, 0xCCA526F5, 0x885DD6DF, 0x4A1807A1, 0xC0B00E7C, 0x3404D5A1, 0x3FECD70B},
+   {0x6782D8D7, 0xE77BFE48, 0x7155EC7D, 0x54AB18C9, 0xB3202407, 0x77CDB71F, 0x67BA5604, 0x8441556C}},
+  {{0xE9D78DD4, 0x38694E01, 0xB58C2F9B, 0xF84FBBFB, 0xA234C73F, 0x3BD303D3, 0xFF16883F, 0x82396BE5},
+   {0xE886DF4E, 0x56ECF3FD, 0x817255A6, 0xCAD118BD, 0x1AA338DB, 0xBA6926BA, 0xAA1981FF, 0x2A677961}},
+  {{0x05F4CC58, 0x75A1590C, 0xA69F58C8, 0x43F076BC, 0x79786C3A, 0x8ADA939B, 0x95A50C0A, 0x3A758D61},
+   {0xBA2155EF, 0x22348461, 0xEBFE41AD, 0x5985F593, 0x91FB5CF7, 0xADFFAD55, 0xE54E241C, 0xB8891ADC}},
+  {{0x24FC05CD, 0x18115178, 0x092D97BE, 0x2C73FD44, 0x2BEBB106, 0x5B5A8CBA, 0xEE17D82A, 0x017CC283},
+   {0x42EE8FDB, 0x19974730, 0x89433E44, 0xF16121E8, 0xA2FF19E7, 0x760EAAD5, 0xA1EC8CAA, 0xD71A2864}},
+  {{0x7F42A1BF, 0x26F1CAF3, 0x82F27586, 0xCABD266E, 0x6AF484F4, 0x0971375B, 0x0A43E6FA, 0xABF356CC},
+   {0x91C5E0F8, 0xC7B50396, 0x3A8EFAC5, 0xBAF618FE, 0x15A2316F, 0xCB21FE99, 0x0F2635D3, 0x1565CA3B}},
+  {{0x79FB664D, 0x01BABF6D, 0xB9659AA1, 0xA14B4AB5, 0xB64DAA60, 0x6FE4C1BD, 0x938EDB85, 0xEA4B209D},
+   {0x3290B2F4, 0xE322AF73, 0x292AF72E, 0x4BACDED7, 0xB1E09D85, 0xF01824E4, 0xCAA001B1, 0x485C0038}},
+  {{0x7C092020, 0x954E5FA8, 0x99A7318D, 0x06591EC9, 0x6FC3EA5B, 0xC3506151, 0xDA3E40C7, 0xCFB13598},
+   {0x826F6EB1, 0xB447CC06, 0xCC4B15BB, 0xB9176BE6, 0xC61599EC, 0x0204E321, 0x4E9FCE6B, 0x66512CBD}},
+  {{0x6891EA5A, 0xF59CA041, 0x5A12F3C8, 0xAC0D2CC0, 0xEFADECB4, 0x2F827232, 0xC3A86505, 0x743A048F},
+   {0xF9AA9765, 0xD0154838, 0x11FEDB76, 0xA548E7EC, 0x61E77C87, 0x10A67ED6, 0x5E165BE4, 0xA4394D9E}},
+  {{0x012DDF9F, 0x2798852B, 0xBF4FCB96, 0xD5539BE9, 0xB08C6B69, 0x198A79B9, 0xA37060D9, 0xE23BD3CB},
+   {0x68A6A401, 0xCC7F52C9, 0x57091704, 0xDF697F4B, 0x7514ABBE, 0xC429B0B8, 0x3212CA5B, 0x9DFD8B3F}},
+  {{0x84A74D26, 0x4C82A438, 0xDC49FEEE, 0x94FC7759, 0x73AF33A7, 0xA604D0CA, 0x99993F69, 0xA2028CC5},
+   {0x733D26C8, 0x06D21477, 0x3704942E, 0x97EA2867, 0xF123FE2D, 0x26FD5FB5, 0x62C4C70E, 0x19D166CC}},
+  {{0xABBFE286, 0x4AF25CE1, 0xFCDEED1A, 0xA53341C7, 0xCD20E76D, 0xCB1D3464, 0x4AB23D35, 0x56DECF3E},
+   {0xE524AAFB, 0xDD832027, 0x05A43863, 0xEE102BE5, 0xD463F935, 0xF9A6BFFA, 0x44F43B95, 0xC49EAE38}},
+  {{0x8B894F9B, 0x59E60BD8, 0xB510A245, 0x77C0A893, 0xAC45E9F3, 0xF6133DED, 0x7E0A7BBA, 0x7F88FC4E},
+   {0x751BB0FD, 0x8C615DAA, 0x5623E6E8, 0x64BA7615, 0x4BD8DEAC, 0xF6BF0161, 0x3997B513, 0x68C635F0}},
+  {{0xE7753698, 0x8D15F49D, 0x166245DD, 0xB1D6F20C, 0x92EEA7B3, 0x998AC40B, 0x0C3C0922, 0xE5C81E0B},
+   {0x85A9E76A, 0xF65CA633, 0x88A56ACD, 0x2779B4B3, 0xEEFB0C07, 0x405BA189, 0xA7D62D55, 0x6591E281}},
+  {{0x6BD408B4, 0x48C896D1, 0x9C6BAF95, 0x47CE08A1, 0xA887EEBC, 0x4F4DDCE9, 0xAE7398D9, 0x0447F868},
+   {0x9CBAA537, 0xB70895FE, 0xE15EFF33, 0xDC935601, 0xA2A7C433, 0x035C1D08, 0xF0FB4CAC, 0x5F37CCEF}},
+  {{0xA47C229B, 0xF5A4AA87, 0x1136EE1B, 0x19DC19B9, 0x51E08C26, 0x1D5DED4C, 0x4F85D804, 0x41AB4614},
+   {0x738106CA, 0xF02DD1D4, 0x2AB68AFF, 0x20CC8FF4, 0x3C3CE367, 0xC1C053E7, 0x33F9E08D, 0x48517644}},
+  {{0xB7F6BE1F, 0x1E3081AB, 0x0D8A6FB0, 0xD7768C94, 0x31905283, 0x70E00C75, 0xAE64D738, 0xA176C395},
+   {0x1FA3578C, 0x9E5850BC, 0x611FE506, 0x087565CE, 0x9FEEEA5C, 0x51AB984B, 0x947B45F1, 0x9EBDEC88}},
+  {{0xB792FBEC, 0x587C5DA0, 0xEE9E8ACB, 0x5986356B, 0x24E55C73, 0xFAA63B4D, 0x4C985649, 0xCEFB8440},
+   {0x540926DF, 0x1C20FE34, 0x79C38DE9, 0x6204487E, 0x5881270E, 0x7B5348A9, 0x0767A863, 0xA40C8BAF}},
+  {{0xDC53717D, 0x4F0EC8F0, 0xEBB3B85E, 0x42FC6006, 0x067977FF, 0x95F962D2, 0xD50AE583, 0x6194BDD5},
+   {0x2C4FA8AA, 0x76C2178C, 0x3ABF1768, 0x35277D4F, 0xE5E8D851, 0x4A22DB58, 0xBF903362, 0xAF64998D}},
+  {{0x7FBEF628, 0xC3C2B412, 0x0008ABB4, 0xA69C7756, 0xDD3A1376, 0x3F52438E, 0x7688A086, 0x3A6F4C49},
+   {0x126F5476, 0x8DCA1641, 0x5E790B59, 0x7DE645CE, 0x45125197, 0x5B51A327, 0xF79973FB, 0x796ABA23}},
+  {{0xB78A0575, 0x06129252, 0x031E9F63, 0x6CB9019D, 0x01F22992, 0x03928544, 0x6ECA6194, 0xDA7FA95F},
+   {0x6346268C, 0x5ABF16BB, 0x8EC5DCA6, 0xAC24E560, 0xBC92BC35, 0x72889D45, 0xBBD19859, 0x2C2EFEDB}},
+  {{0xD347FECA, 0x89EB1B96, 0xCDA31E4A, 0xC8C78F4F, 0x9B5EBEE5, 0x9948CC8C, 0x6F69B457, 0x56952543},
+   {0xDAA7367A, 0x6A3B3EF7, 0x3EAE86CD, 0x2BECF2D4, 0x8A9BCB17, 0x663509A6, 0xBBBBC36E, 0xC670543E}},
+  {{0x28BC89E8, 0x7B292496, 0x376DE4AD, 0xB1AC125E, 0xF591522E, 0x4736603B, 0x7C775B6B, 0x9C2C6267},
+   {0x8E2A143B, 0xCA91DE65, 0xDC7AB49B, 0x2A626E93, 0xE7FBC78F, 0x86320365, 0x6DF16F90, 0x9DDCADC5}},
+  {{0x9099B9C9, 0x4131BFD0, 0xEB850DDA, 0x3BF11E70, 0xB34F5321, 0x422705C3, 0x082E4D79, 0x21BA3C52},
+   {0xE427EBE9, 0x76A27C83, 0x5EEB87B8, 0x2E1D8CD4, 0x72955119, 0xECFAA6E5, 0x077CBC91, 0xA2D7916C}},
+  {{0x3581C6CD, 0x8CBE4D6E, 0xFD43F5EC, 0x5F07093E, 0xB1571512, 0x2FFF27F8, 0x976D2D4B, 0x3D5929B3},
+   {0x00B64B81, 0x171DC0C2, 0xF03FCD1E, 0x36F4B114, 0x97A014F4, 0x11451B78, 0xB73F2090, 0x277FA77B}},
+  {{0xAF5CAB24, 0x6FCDE854, 0x467A04B7, 0xD4E8AA74, 0x7BCF3D2C, 0x14D14D59, 0xA0ABCAAE, 0xC56D84F7},
+   {0xE9EC1DD7, 0x937608B1, 0x867114F6, 0xDF5054EB, 0x6DDF93A6, 0x6B013BC5, 0xDD3E48FC, 0x5BFF4F05}},
+  {{0xE8EB9FA6, 0xA6874DA5, 0x5D53D5D9, 0x8717F1D9, 0xE775420A, 0x7255DC15, 0xD119777E, 0x71CD2638},
+   {0xACA9FC16, 0xED636262, 0x6937763B, 0x5171C1F7, 0x037EC77B, 0x1BF18C1D, 0xBF3B8213, 0x63B482DE}},
+  {{0x7D6DE321, 0x0BC91E66, 0x7469772E, 0xFAE8DD8F, 0x4EF060B6, 0x61EAA825, 0xDDB31399, 0xF46BAD95},
+   {0xC21213C9, 0x92708587, 0x7D09EB1C, 0x11D287D0, 0x6EA52F68, 0xA79815D8, 0xEDDB10A7, 0xB54BB792}},
+  {{0x636D0AE6, 0x2D7C4576, 0x7FCBEEEC, 0x4B387E0B, 0x103707CB, 0xA3F9A9D0, 0x1398A20C, 0xD20DA011},
+   {0x77BB0455, 0xFD1FAC78, 0x8AFBE9CE, 0x5CC544D7, 0x78BACA74, 0x15846D91, 0x4901DD7D, 0x30271D42}},
+  {{0x4B037401, 0xEE0AF6DF, 0xF4B85D2D, 0x55CD3618, 0x493FB0DC, 0x4EA35646, 0x81BD0405, 0xADFCEAF6},
+   {0x5B1DDF0D, 0x342DF99F, 0x605D3BB9, 0x2FE483A7, 0x639E33D9, 0xDAADD46A, 0x91623D28, 0x9B4DAAB1}},
+  {{0x03C5178A, 0xE7980BD9, 0x72F35B9C, 0x4A5ED035, 0x32ED344C, 0x5C0945C0, 0x92A40B28, 0xDCD9F5EB},
+   {0x51E6C89A, 0x58D2FB9B, 0x75DDBBBA, 0x3F2BBAF8, 0xFFB0A284, 0x4AB9791C, 0x7BAD9A46, 0xE12EC09A}},
+  {{0x0B89D4BD, 0x048DF69B, 0xB70FBA85, 0x222888EF, 0xCCE017F6, 0x44A0C5F6, 0xC264855C, 0xEBC469D8},
+   {0xD7CB56BB, 0xB6420B9D, 0xEA5F6AEC, 0x24F72349, 0x86EFE6A9, 0xE35956D8, 0x4B12634F, 0xBAE5FB78}},
+  {{0x7BCA0BC1, 0x1BCB36A5, 0xC6AD55F1, 0xDADF6DCE, 0x6080E0F8, 0x9DE1E8E7, 0xB2567AC5, 0x681D6BE2},
+   {0x763F4FCB, 0xDEB1EDD4, 0xE58790F1, 0x2A6A766E, 0xCF14E1B0, 0x263F2166, 0xC48087F3, 0x1DFCAB92}},
+  {{0x778189C5, 0xC0C38D52, 0xA201226F, 0x68F81BC5, 0x35E974BA, 0x890E8BA3, 0x9B23A1D3, 0xB6634418},
+   {0xDA3B7AF3, 0x7CDE9E81, 0x6CA457E4, 0xD7E854A2, 0x8E7A3D5E, 0x6D2992BC, 0xD1DA4558, 0xC85B3262}},
+  {{0xEE5DF4EB, 0x32FB658A, 0x75A1AEA2, 0x9C82E929, 0x90638F38, 0x5079DA88, 0x5A2CC1F6, 0xAC9D5B23},
+   {0xA4B6436B, 0x4C315413, 0xE22C0B32, 0x183B4444, 0x81769921, 0xFFD20056, 0x8DBB9503, 0x6CBB0B44}},
+  {{0xDE1300A9, 0x61F97D99, 0x83953873, 0x41841225, 0xDB0C465C, 0x9F249E32, 0xDC2447BE, 0xEFA5CEED},
+   {0x6C191D51, 0x9AB30D9A, 0x9005B6A4, 0xDBF4DDED, 0x00E670FE, 0x90BD6B03, 0xC8EFD72E, 0x2B961781}},
+  {{0x96409EB3, 0x02AC3618, 0x4AC5731B, 0xA9040E46, 0x80E8987A, 0x00744FB8, 0xC571FB67, 0x37B726D8},
+   {0x7D57D0F1, 0x2AD96A5A, 0x0A8EF52A, 0xDC59D323, 0x751B6BEB, 0xA9E01754, 0x49E1C809, 0xBF0DF92F}},
+  {{0x39F81C9E, 0xE86E9A3D, 0x7783946A, 0xB47A9004, 0x541CB355, 0x72BA430F, 0xAC3FDF37, 0x5B8EE3FA},
+   {0x635AE687, 0xDF371FDA, 0xD30BC7D3, 0x75429F37, 0x0A90FB23, 0xC0D58D9B, 0xAC1D5E95, 0x59575436}},
+  {{0x0C6CE683, 0xB5D21D64, 0x08076B0A, 0xEAA6F725, 0x8646FBEC, 0x081D887C, 0x5AF13FF5, 0x9CBA423E},
+   {0xF54FC3C0, 0x9BB2FC49, 0x26C5C719, 0x79F37273, 0x15CDF0AE, 0x05AF002F, 0x2AA017E0, 0x7562190A}},
+  {{0x05A0AF19, 0x64777EFC, 0x6292AC20, 0xC3CDA2ED, 0x640D9419, 0xF25592E5, 0xB4BB2E1F, 0x5308B91D},
+   {0xBF1444CE, 0xBC5D3721, 0xED42874A, 0xE4B6BD8C, 0xABAE0290, 0x2D50B9AF, 0x47C018AB, 0x6B64BF26}},
+  {{0xB376CE56, 0x580E9C32, 0x9FD6E193, 0x7D700EE2, 0x1EEC566B, 0x12BD427A, 0x61EA45A6, 0xE9F73A45},
+   {0x08490971, 0x55617AA8, 0xDBCA1AD2, 0x4A5AA3AB, 0x8384B6AC, 0x58BEB1A6, 0x07E4444C, 0x76323EE2}},
+  {{0x0C4A3B64, 0xE88F54D3, 0xCE1C832D, 0xF7615B0D, 0x973D58FE, 0x2F67ADB0, 0xC3CEF173, 0xB2871E1C},
+   {0x7A97569E, 0xED83D2A2, 0xAB59D53A, 0xD11912B4, 0xA435918D, 0x10764C79, 0xEF2764C3, 0xCA537A69}},
+  {{0x90125DEE, 0x94D56BC8, 0xE778A787, 0xB531F3B8, 0xAF58F361, 0x3BD55133, 0xE15C70E5, 0xFE17E49F},
+   {0xC6F1D920, 0xDD93B546, 0x36CCB9F9, 0x0C5FF33B, 0x28F1575F, 0x43ACA5E6, 0x5C274AD0, 0xA55B4F60}},
+  {{0x06589232, 0x5A6FDA9D, 0x560E6363, 0x967F03D6, 0x6176FE56, 0x8913E989, 0x543DB0EF, 0xACB44D40},
+   {0x8E895B40, 0xAB0E252A, 0xD42959E6, 0xAB32C974, 0x44A05AD1, 0xBC3F7E15, 0x6511572E, 0x65271BA1}},
+  {{0xBCD91C45, 0xFCF99E08, 0xACA75397, 0xEF84F18B, 0x6E525D1F, 0x15464F30, 0x425D091F, 0x0D216A15},
+   {0x0AC21D69, 0x1F87DCAF, 0x67416519, 0xAAB24306, 0x7F5D18F8, 0x1768A8B8, 0xC40A8C75, 0xCE3E7C99}},
+  {{0x37B6D3EE, 0x4F31F586, 0x74AC2BE8, 0x4F6A0343, 0xC47589CC, 0x6CB479F4, 0xC8DEA1B6, 0x34F06E15},
+   {0x053E171B, 0xE091B4DD, 0x240FDD1F, 0x6989FD6D, 0x9FF2123F, 0xDE25A063, 0x513A6DA1, 0x0E04BCC9}},
+  {{0xE9343616, 0x64981B01, 0xCB86E631, 0x90502CBC, 0x86A5DEFC, 0x44E595EC, 0xC5F1C69E, 0x5684A676},
+   {0xC2D85A87, 0xE4B9D8CF, 0x5CCD436B, 0xA9CD9009, 0x3D913783, 0x33195343, 0x0AC25661, 0x949349C5}},
+  {{0x564EFA22, 0x2BE3F5F5, 0x1EE27DEB, 0xC5F4CEF5, 0x0E25BD0D, 0x3B239E56, 0x9BF10706, 0xDAF3F4F1},
+   {0x5B919A7D, 0x788294B5, 0xBF83CB15, 0x1BC79C9E, 0x1E312DCB, 0xE0642403, 0x051194CD, 0x7FFA38DF}},
+};
+
+#endif /* ECC_FIXED_BASE_COMB */
@@ -0,0 +1,231 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#include "sha256_fast.h"
+
+#if SHA256_HW
+/*********************** HARDWARE IMPLEMENTATION *********************/
+// mbedTLS 3 dropped the _ret suffix once these calls all returned int
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+#define SHA256_STARTS mbedtls_sha256_starts
+#define SHA256_UPDATE mbedtls_sha256_update
+#define SHA256_FINISH mbedtls_sha256_finish
+#else
+#define SHA256_STARTS mbedtls_sha256_starts_ret
+#define SHA256_UPDATE mbedtls_sha256_update_ret
+#define SHA256_FINISH mbedtls_sha256_finish_ret
+#endif
+
+Sha256Fast::Sha256Fast() {
+    mbedtls_sha256_init(&this->ctx);
+    SHA256_STARTS(&this->ctx, 0);
+}
+
+Sha256Fast::~Sha256Fast() {
+    mbedtls_sha256_free(&this->ctx);
+}
+
+void Sha256Fast::update(const BYTE data[], size_t len) {
+    SHA256_UPDATE(&this->ctx, data, len);
+}
+
+void Sha256Fast::final(BYTE hash[]) {
+    SHA256_FINISH(&this->ctx, hash);
+}
+
+#else
+
+/****************************** MACROS ******************************/
+#define ROTLEFT(a,b) (((a) << (b)) | ((a) >> (32-(b))))
+#define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32-(b))))
+
+#define CH(x,y,z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x,y,z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x) (ROTRIGHT(x,2) ^ ROTRIGHT(x,13) ^ ROTRIGHT(x,22))
+#define EP1(x) (ROTRIGHT(x,6) ^ ROTRIGHT(x,11) ^ ROTRIGHT(x,25))
+#define SIG0(x) (ROTRIGHT(x,7) ^ ROTRIGHT(x,18) ^ ((x) >> 3))
+#define SIG1(x) (ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
+
+// Keep the transform in IRAM on ESP8266 so bulk hashing is not stalled by
+// flash cache misses, at the cost of about 3KB of IRAM.
+#if SHA256_IRAM && defined(ESP8266)
+#include <c_types.h>
+#ifdef IRAM_ATTR
+#define SHA256_TRANSFORM_ATTR IRAM_ATTR
+#else
+#define SHA256_TRANSFORM_ATTR ICACHE_RAM_ATTR
+#endif
+#else
+#define SHA256_TRANSFORM_ATTR
+#endif
+
+/**************************** VARIABLES *****************************/
+static const WORD k[64] = {
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+/*********************** ACTUAL IMPLEMENTATION ***********************/
+Sha256Fast::Sha256Fast() {
+    this->datalen = 0;
+    this->bitlen = 0;
+    this->state[0] = 0x6a09e667;
+    this->state[1] = 0xbb67ae85;
+    this->state[2] = 0x3c6ef372;
+    this->state[3] = 0xa54ff53a;
+    this->state[4] = 0x510e527f;
+    this->state[5] = 0x9b05688c;
+    this->state[6] = 0x1f83d9ab;
+    this->state[7] = 0x5be0cd19;
+}
+
+void Sha256Fast::update(const BYTE data[], size_t len) {
+    WORD n;
+
+    // Top up a partially filled block first.
+    if (this->datalen > 0) {
+	n = 64 - this->datalen;
+	if (n > len)
+	    n = len;
+	memcpy(this->data + this->datalen, data, n);
+	this->datalen += n;
+	data += n;
+	len -= n;
+	if (this->datalen < 64)
+	    return;
+	this->transform(this->data);
+	this->bitlen += 512;
+	this->datalen = 0;
+    }
+
+    // Whole blocks are hashed straight from the input, without staging.
+    while (len >= 64) {
+	this->transform(data);
+	this->bitlen += 512;
+	data += 64;
+	len -= 64;
+    }
+
+    memcpy(this->data, data, len);
+    this->datalen = len;
+}
+
+void Sha256Fast::final(BYTE hash[]) {
+    WORD i;
+
+    i = this->datalen;
+
+    // Pad whatever data is left in the buffer.
+    if (this->datalen < 56) {
+	this->data[i++] = 0x80;
+	while (i < 56) //@@@ optimize with memset
+	    this->data[i++] = 0x00;
+    } else {
+	this->data[i++] = 0x80;
+	while (i < 64) //@@@ optimize with memset
+	    this->data[i++] = 0x00;
+	this->transform(this->data);
+	memset(this->data, 0, 56);
+    }
+
+    // Append to the padding the total message's length in bits and transform.
+    this->bitlen += this->datalen * 8;
+    this->data[63] = this->bitlen;
+    this->data[62] = this->bitlen >> 8;
+    this->data[61] = this->bitlen >> 16;
+    this->data[60] = this->bitlen >> 24;
+    this->data[59] = this->bitlen >> 32;
+    this->data[58] = this->bitlen >> 40;
+    this->data[57] = this->bitlen >> 48;
+    this->data[56] = this->bitlen >> 56;
+    this->transform(this->data);
+
+    // Since this implementation uses little endian byte ordering and SHA uses big endian,
+    // reverse all the bytes when copying the final state to the output hash.
+    for (i = 0; i < 4; ++i) {
+	hash[i]      = (this->state[0] >> (24 - i * 8)) & 0x000000ff;
+	hash[i + 4]  = (this->state[1] >> (24 - i * 8)) & 0x000000ff;
+	hash[i + 8]  = (this->state[2] >> (24 - i * 8)) & 0x000000ff;
+	hash[i + 12] = (this->state[3] >> (24 - i * 8)) & 0x000000ff;
+	hash[i + 16] = (this->state[4] >> (24 - i * 8)) & 0x000000ff;
+	hash[i + 20] = (this->state[5] >> (24 - i * 8)) & 0x000000ff;
+	hash[i + 24] = (this->state[6] >> (24 - i * 8)) & 0x000000ff;
+	hash[i + 28] = (this->state[7] >> (24 - i * 8)) & 0x000000ff;
+    }
+}
+
+// One round, the caller rotates the roles of a..h instead of moving them.
+#define ROUND(a,b,c,d,e,f,g,h,i,w) do { \
+	WORD _t1 = h + EP1(e) + CH(e,f,g) + k[i] + (w); \
+	d += _t1; \
+	h = _t1 + EP0(a) + MAJ(a,b,c); \
+    } while (0)
+
+// Message word i >= 16, computed in place over a 16 word window.
+#define SCHED(i) (m[(i) & 15] += SIG1(m[((i) - 2) & 15]) + m[((i) - 7) & 15] + \
+	SIG0(m[((i) - 15) & 15]))
+
+#define LOAD(j) (m[j] = ((WORD)block[(j) * 4] << 24) | ((WORD)block[(j) * 4 + 1] << 16) | \
+	((WORD)block[(j) * 4 + 2] << 8) | ((WORD)block[(j) * 4 + 3]))
+
+#define ROUNDS8(i, W) do { \
+	ROUND(a,b,c,d,e,f,g,h,(i) + 0,W((i) + 0)); \
+	ROUND(h,a,b,c,d,e,f,g,(i) + 1,W((i) + 1)); \
+	ROUND(g,h,a,b,c,d,e,f,(i) + 2,W((i) + 2)); \
+	ROUND(f,g,h,a,b,c,d,e,(i) + 3,W((i) + 3)); \
+	ROUND(e,f,g,h,a,b,c,d,(i) + 4,W((i) + 4)); \
+	ROUND(d,e,f,g,h,a,b,c,(i) + 5,W((i) + 5)); \
+	ROUND(c,d,e,f,g,h,a,b,(i) + 6,W((i) + 6)); \
+	ROUND(b,c,d,e,f,g,h,a,(i) + 7,W((i) + 7)); \
+    } while (0)
+
+SHA256_TRANSFORM_ATTR void Sha256Fast::transform(const BYTE block[]) {
+    WORD a, b, c, d, e, f, g, h, m[16];
+
+    a = this->state[0];
+    b = this->state[1];
+    c = this->state[2];
+    d = this->state[3];
+    e = this->state[4];
+    f = this->state[5];
+    g = this->state[6];
+    h = this->state[7];
+
+    ROUNDS8(0, LOAD);
+    ROUNDS8(8, LOAD);
+    ROUNDS8(16, SCHED);
+    ROUNDS8(24, SCHED);
+    ROUNDS8(32, SCHED);
+    ROUNDS8(40, SCHED);
+    ROUNDS8(48, SCHED);
+    ROUNDS8(56, SCHED);
+
+    this->state[0] += a;
+    this->state[1] += b;
+    this->state[2] += c;
+    this->state[3] += d;
+    this->state[4] += e;
+    this->state[5] += f;
+    this->state[6] += g;
+    this->state[7] += h;
+}
+
+#endif  // SHA256_HW
@@ -0,0 +1,70 @@
+/******************************************************************************
+ * Copyright 2019 Google
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+#ifndef SHA256_FAST_H
+#define SHA256_FAST_H
+
+#include "sha256.h"
+
+// SHA-256 with the same interface as Sha256 from sha256.cpp, which is
+// pulled by pull_crypto.sh and left as it is upstream. The portable code
+// hashes whole blocks straight from the input and unrolls the rounds.
+
+// On ESP32 hash with the SHA engine through the core's mbedTLS, which is
+// built with MBEDTLS_HARDWARE_SHA and falls back to software by itself
+// while the engine is busy (e.g. with a TLS handshake). Define SHA256_HW
+// to 0 to use the portable code everywhere.
+#ifndef SHA256_HW
+#if defined(ESP32)
+#define SHA256_HW 1
+#else
+#define SHA256_HW 0
+#endif
+#endif
+
+// Place the block transform in IRAM on ESP8266.
+#ifndef SHA256_IRAM
+#define SHA256_IRAM 0
+#endif
+
+#if SHA256_HW
+#include "mbedtls/sha256.h"
+#include "mbedtls/version.h"
+#endif
+
+class Sha256Fast {
+    public:
+	Sha256Fast();
+	void update(const BYTE data[], size_t len);
+	void final(BYTE hash[]);
+#if SHA256_HW
+	~Sha256Fast();
+#endif
+    private:
+#if SHA256_HW
+	mbedtls_sha256_context ctx;
+	// the context may own the hardware engine, so no copies
+	Sha256Fast(const Sha256Fast &);
+	Sha256Fast &operator=(const Sha256Fast &);
+#else
+	BYTE data[64];
+	WORD datalen;
+	unsigned long long bitlen;
+	WORD state[8];
+	void transform(const BYTE block[]);
+#endif
+};
+
+#endif   // SHA256_FAST_H
@@ -15,69 +15,88 @@
 
 #include <stdio.h>
 
-#include "crypto/ecdsa.h"
+#include "crypto/ecdsa_fast.h"
 #include "crypto/nn.h"
-#include "crypto/sha256.h"
+#include "crypto/sha256_fast.h"
 #include "jwt.h"
 
-// base64_encode copied from https://github.com/ReneNyffenegger/cpp-base64
-static const String base64_chars =
+// base64url alphabet, encoding adapted from
+// https://github.com/ReneNyffenegger/cpp-base64
+static const char base64_chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
     "abcdefghijklmnopqrstuvwxyz"
     "0123456789-_";
 
-String base64_encode(const unsigned char *bytes_to_encode,
-                     unsigned int in_len) {
-  String ret;
-  int i = 0;
-  int j = 0;
-  unsigned char char_array_3[3];
-  unsigned char char_array_4[4];
+// Writes the token straight into the caller's buffer. While sha is set
+// every character written is also fed to the hash, so the signed part of
+// the token never has to be materialised twice.
+struct JwtWriter {
+  char *out;
+  size_t cap;
+  size_t len;
+  bool overflow;
+  Sha256Fast *sha;
+  unsigned char pending[3];
+  int npending;
+};
+
+static void jwt_put(JwtWriter *w, const char *chars, size_t n) {
+  if (w->overflow || w->len + n >= w->cap) {
+    w->overflow = true;
+    return;
+  }
+  memcpy(w->out + w->len, chars, n);
+  if (w->sha != NULL) {
+    w->sha->update((const unsigned char *)chars, n);
+  }
+  w->len += n;
+}
 
-  while (in_len--) {
-    char_array_3[i++] = *(bytes_to_encode++);
-    if (i == 3) {
-      char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-      char_array_4[1] =
-          ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-      char_array_4[2] =
-          ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-      char_array_4[3] = char_array_3[2] & 0x3f;
-
-      for (i = 0; (i < 4); i++) {
-        ret += base64_chars[char_array_4[i]];
-      }
-      i = 0;
-    }
+// Emits the pending 1-3 bytes as 2-4 base64url characters, without padding.
+static void base64_flush(JwtWriter *w) {
+  unsigned char *in = w->pending;
+  char enc[4];
+
+  if (w->npending == 0) {
+    return;
+  }
+  for (int j = w->npending; j < 3; j++) {
+    in[j] = '\0';
   }
 
-  if (i) {
-    for (j = i; j < 3; j++) {
-      char_array_3[j] = '\0';
-    }
+  enc[0] = base64_chars[(in[0] & 0xfc) >> 2];
+  enc[1] = base64_chars[((in[0] & 0x03) << 4) + ((in[1] & 0xf0) >> 4)];
+  enc[2] = base64_chars[((in[1] & 0x0f) << 2) + ((in[2] & 0xc0) >> 6)];
+  enc[3] = base64_chars[in[2] & 0x3f];
 
-    char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-    char_array_4[1] =
-        ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-    char_array_4[2] =
-        ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-    char_array_4[3] = char_array_3[2] & 0x3f;
+  jwt_put(w, enc, w->npending + 1);
+  w->npending = 0;
+}
 
-    for (j = 0; (j < i + 1); j++) {
-      ret += base64_chars[char_array_4[j]];
+static void base64_encode(JwtWriter *w, const unsigned char *bytes_to_encode,
+                          size_t in_len) {
+  while (in_len--) {
+    w->pending[w->npending++] = *(bytes_to_encode++);
+    if (w->npending == 3) {
+      base64_flush(w);
     }
   }
+}
 
-  return ret;
+static void base64_encode(JwtWriter *w, const char *str) {
+  base64_encode(w, (const unsigned char *)str, strlen(str));
 }
 
-String base64_encode(String str) {
-  return base64_encode((const unsigned char *)str.c_str(), str.length());
+// Convert an integer to a string.
+static void base64_encode_int(JwtWriter *w, long long int x) {
+  char buf[20];
+  snprintf(buf, 20, "%d", (int)x);
+  base64_encode(w, buf);
 }
 
-// Get base64 signature string from the signature_r and signature_s ecdsa
+// Write the base64 signature from the signature_r and signature_s ecdsa
 // signature.
-String MakeBase64Signature(NN_DIGIT *signature_r, NN_DIGIT *signature_s) {
+static void MakeBase64Signature(JwtWriter *w, NN_DIGIT *signature_r, NN_DIGIT *signature_s) {
   unsigned char signature[64];
   NN_Encode(signature, (NUMWORDS - 1) * NN_DIGIT_LEN, signature_r,
             (NN_UINT)(NUMWORDS - 1));
@@ -85,42 +104,138 @@ String MakeBase64Signature(NN_DIGIT *signature_r, NN_DIGIT *signature_s) {
             (NUMWORDS - 1) * NN_DIGIT_LEN, signature_s,
             (NN_UINT)(NUMWORDS - 1));
 
-  return base64_encode(signature, 64);
+  base64_encode(w, signature, 64);
+  base64_flush(w);
 }
 
-// Convert an integer to a string.
-String int_to_string(long long int x) {
-  char buf[20];
-  snprintf(buf, 20, "%d", (int)x);
-  return String(buf);
+// The ecc module keeps the curve parameters and base point table in globals,
+// so they only have to be computed once no matter how many contexts exist.
+static bool ecc_ready = false;
+
+void InitEcc() {
+  if (!ecc_ready) {
+    ecc_fast_init();
+    ecc_ready = true;
+  }
+  ecdsa_fast_init();
 }
 
-String CreateJwt(String project_id, long long int time, NN_DIGIT *priv_key, int lib_jwt_exp_secs) {
-  ecc_init();
-  // Making jwt token json
-  String header = "{\"alg\":\"ES256\",\"typ\":\"JWT\"}";
-  String payload = "{\"iat\":" + int_to_string(time) +
-                   ",\"exp\":" + int_to_string(time + lib_jwt_exp_secs) + ",\"aud\":\"" +
-                   project_id + "\"}";
-  String header_payload_base64 =
-      base64_encode(header) + "." + base64_encode(payload);
-
-  Sha256 sha256Instance;
-  sha256Instance.update((const unsigned char *)header_payload_base64.c_str(), header_payload_base64.length());
+#if !ECC_FIXED_BASE_COMB
+void InitEcc(const point_t *base_table) {
+  if (!ecc_ready) {
+    ecc_fast_init_table(base_table);
+    ecc_ready = true;
+  }
+  ecdsa_fast_init();
+}
+#endif
+
+void JwtSigningContext::init(const NN_DIGIT *priv_key) {
+  InitEcc();
+  memcpy(this->priv_key, priv_key, sizeof(this->priv_key));
+  // nonces are tied to the order only, but drop them with the old key anyway
+  memset(nonces, 0, sizeof(nonces));
+  nonce_count = 0;
+  nonce_active = false;
+  ready = true;
+}
+
+bool JwtSigningContext::isReady() {
+  return ready;
+}
+
+NN_DIGIT *JwtSigningContext::getPrivateKey() {
+  return priv_key;
+}
+
+void JwtSigningContext::sign(uint8_t *sha256sum, NN_DIGIT *r, NN_DIGIT *s) {
+  unsigned long start = micros();
+  while (nonce_count > 0) {
+    nonce_count--;
+    if (ecdsa_sign_nonce(sha256sum, r, s, priv_key, &nonces[nonce_count])) {
+      last_sign_us = micros() - start;
+      return;
+    }
+  }
+  ecdsa_fast_sign(sha256sum, r, s, priv_key);
+  last_sign_us = micros() - start;
+}
+
+void JwtSigningContext::precomputeNonces(unsigned long budget_us) {
+  unsigned long start = micros();
+  while (ready && nonce_count < JWT_NONCE_POOL_SIZE &&
+         (micros() - start) < budget_us) {
+    if (!nonce_active) {
+      ecdsa_gen_nonce_begin(&nonce_state);
+      nonce_active = true;
+    }
+    if (ecdsa_gen_nonce_step(&nonce_state, &nonces[nonce_count], 1)) {
+      nonce_active = false;
+      nonce_count++;
+    }
+  }
+}
+
+int JwtSigningContext::getNonceCount() {
+  return nonce_count;
+}
+
+unsigned long JwtSigningContext::getLastSignMicros() {
+  return last_sign_us;
+}
+
+size_t CreateJwt(char *out, size_t cap, const char *project_id,
+                 long long int time, JwtSigningContext &ctx, int lib_jwt_exp_secs) {
+  Sha256Fast sha256Instance;
+  JwtWriter w = { out, cap, 0, false, &sha256Instance, {0, 0, 0}, 0 };
+
+  // Making jwt token json, header and payload are encoded as they are hashed
+  base64_encode(&w, "{\"alg\":\"ES256\",\"typ\":\"JWT\"}");
+  base64_flush(&w);
+  jwt_put(&w, ".", 1);
+  base64_encode(&w, "{\"iat\":");
+  base64_encode_int(&w, time);
+  base64_encode(&w, ",\"exp\":");
+  base64_encode_int(&w, time + lib_jwt_exp_secs);
+  base64_encode(&w, ",\"aud\":\"");
+  base64_encode(&w, project_id);
+  base64_encode(&w, "\"}");
+  base64_flush(&w);
+
   unsigned char sha256[SHA256_DIGEST_LENGTH];
   sha256Instance.final(sha256);
+  w.sha = NULL;
 
-  // Signing sha with ec key. Bellow is the ec private key.
-  point_t pub_key;
-  ecc_gen_pub_key(priv_key, &pub_key);
-
-  ecdsa_init(&pub_key);
+  if (w.overflow) {
+    return 0;
+  }
 
+  // Signing sha with ec key. The curve and base point table come from ctx.
   NN_DIGIT signature_r[NUMWORDS], signature_s[NUMWORDS];
-  ecdsa_sign((uint8_t *)sha256, signature_r, signature_s, priv_key);
+  ctx.sign((uint8_t *)sha256, signature_r, signature_s);
+
+  jwt_put(&w, ".", 1);
+  MakeBase64Signature(&w, signature_r, signature_s);
 
-  return header_payload_base64 + "." +
-         MakeBase64Signature(signature_r, signature_s);
+  if (w.overflow) {
+    return 0;
+  }
+  out[w.len] = '\0';
+  return w.len;
+}
+
+String CreateJwt(String project_id, long long int time, JwtSigningContext &ctx, int lib_jwt_exp_secs) {
+  char jwt[JWT_MAX_LEN];
+  if (CreateJwt(jwt, sizeof(jwt), project_id.c_str(), time, ctx, lib_jwt_exp_secs) == 0) {
+    return String();
+  }
+  return String(jwt);
+}
+
+String CreateJwt(String project_id, long long int time, NN_DIGIT *priv_key, int lib_jwt_exp_secs) {
+  JwtSigningContext ctx;
+  ctx.init(priv_key);
+  return CreateJwt(project_id, time, ctx, lib_jwt_exp_secs);
 }
 
 String CreateJwt(String project_id, long long int time, NN_DIGIT *priv_key) {
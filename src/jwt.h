@@ -18,8 +18,69 @@
 
 #include <Arduino.h>
 #include "crypto/nn.h"
+#include "crypto/ecdsa_fast.h"
+
+// Buffer size for a JWT including the terminating zero. Enough for an
+// ES256 token with a 30 character project id, the longest IoT Core allows.
+#ifndef JWT_MAX_LEN
+#define JWT_MAX_LEN 256
+#endif
+
+// Number of signing nonces JwtSigningContext can precompute ahead of time.
+#ifndef JWT_NONCE_POOL_SIZE
+#define JWT_NONCE_POOL_SIZE 2
+#endif
+
+// Signing state that does not change between JWTs. init() loads the curve
+// parameters and the base point table once, so every later CreateJwt only
+// has to hash the token and run a single ecdsa_fast_sign.
+//
+// precomputeNonces() can fill a small pool of message independent nonces
+// while the device is idle. sign() then takes one from the pool and only
+// needs a few modular multiplies.
+class JwtSigningContext {
+ public:
+  void init(const NN_DIGIT* priv_key);
+  bool isReady();
+  NN_DIGIT* getPrivateKey();
+
+  void sign(uint8_t* sha256sum, NN_DIGIT* r, NN_DIGIT* s);
+  // Computes nonces until the pool is full or budget_us has passed. The
+  // base point multiplication runs one window at a time, so a call
+  // overshoots the budget by at most one window (or the final inversion)
+  // and an unfinished nonce is resumed by the next call.
+  void precomputeNonces(unsigned long budget_us);
+  int getNonceCount();
+  // Time the last sign() took
+  unsigned long getLastSignMicros();
+
+ private:
+  NN_DIGIT priv_key[9];
+  bool ready = false;
+  ecdsa_nonce_t nonces[JWT_NONCE_POOL_SIZE];
+  int nonce_count = 0;
+  ecdsa_nonce_state_t nonce_state;
+  bool nonce_active = false;
+  unsigned long last_sign_us = 0;
+};
+
+// Loads the curve parameters and the base point table, once per boot no
+// matter how often it is called. Contexts and verifiers call it for you.
+void InitEcc();
+#if !ECC_FIXED_BASE_COMB
+// Same, with a base point table saved from ecc_fast_get_base_table() on an
+// earlier boot, so it does not have to be computed again.
+void InitEcc(const point_t *base_table);
+#endif
 
 String CreateJwt(String project_id, long long int time, NN_DIGIT* priv_key);
 String CreateJwt(String project_id, long long int time, NN_DIGIT* priv_key, int JWT_EXP_SECS);
+String CreateJwt(String project_id, long long int time, JwtSigningContext &ctx, int JWT_EXP_SECS);
+
+// Builds the JWT into out without any heap allocation: the header and
+// payload are base64url encoded straight into out and hashed as they are
+// written. Returns the length, or 0 (out undefined) if cap is too small.
+size_t CreateJwt(char* out, size_t cap, const char* project_id, long long int time,
+                 JwtSigningContext &ctx, int JWT_EXP_SECS);
 
 #endif  // JWT_H_